@@ -7,6 +7,7 @@
 #include "cool-tree.h"
 #include "stringtab.h"
 #include "utilities.h"
+#include "trace.h"
 
 /* Set the size of the parser stack to be sufficient large to accomodate
    our tests.  There seems to be some problem with Bison's dynamic
@@ -77,6 +78,9 @@ extern char *curr_filename;
 
 void yyerror(const char *s);  /*  defined below; called for each parse error */
 extern int yylex();           /*  the entry point to the lexer  */
+static int traced_yylex();    /*  yylex, with a span for each file  */
+#undef yylex
+#define yylex traced_yylex
 Program ast_root;	      /* the result of the parse  */
 Classes parse_results;        /* for use in semantic analysis */
 int omerrs = 0;               /* number of erros in lexing and parsing */
@@ -353,6 +357,19 @@ lets: OBJECTID ':' TYPEID ASSIGN expression ',' lets
 /* end of grammar */
 %%
 
+/* a span for each file parsed when tracing (see trace.h) */
+static TraceFiles parsing("parser");
+
+static int traced_yylex()
+{
+  int token = cool_yylex();
+  if (token == 0)
+    parsing.end();
+  else
+    parsing.at(curr_filename);
+  return token;
+}
+
 /* This function is called automatically when Bison detects a parse error. */
 void yyerror(const char *s)
 {
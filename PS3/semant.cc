@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include "semant.h"
+#include "alloc.h"
+#include "interface.h"
+#include "perf.h"
+#include "trace.h"
 #include "utilities.h"
 #include <set>
 #include <vector>
@@ -12,6 +16,15 @@ extern int semant_debug;
 extern char *curr_filename;
 extern int node_lineno;
 
+// what the phases and the call sites that allocate most allocate (see alloc.h)
+static AllocStats classes_allocs(ALLOC_PHASES, "semant.classes"),
+                  environments_allocs(ALLOC_PHASES, "semant.environments"),
+                  type_check_allocs(ALLOC_PHASES, "semant.type_check"),
+                  basic_classes_allocs(ALLOC_SITES, "install_basic_classes"),
+                  new_classes_allocs(ALLOC_SITES, "install_new_classes"),
+                  environment_allocs(ALLOC_SITES, "new Environment");
+AllocStats add_variable_allocs(ALLOC_SITES, "Environment::add_variable");
+
 //////////////////////////////////////////////////////////////////////
 //
 // Symbols
@@ -728,22 +741,38 @@ ClassTable::ClassTable(Classes classes) : semant_errors(0), error_stream(cerr) {
   enterscope();
   
   // install base classes
-  install_basic_classes();
-  
+  {
+    TraceSpan trace("semant", "install_basic_classes");
+    install_basic_classes();
+  }
+
+  {
+    TraceSpan trace("semant", "install_interface_classes");
+    install_interface_classes();
+  }
+
   // install user-added new classes
-  install_new_classes(classes);
+  {
+    TraceSpan trace("semant", "install_new_classes");
+    install_new_classes(classes);
+  }
 
-  check_parents(classes);
+  {
+    TraceSpan trace("semant", "check_parents");
+    check_parents(classes);
+  }
   if (errors()) { abort(); }
   
   // check inheritance
-  check_inheritance(classes);
+  {
+    TraceSpan trace("semant", "check_inheritance");
+    check_inheritance(classes);
+  }
   if (errors()) { abort(); }
-
-  check_main();
 }
 
 void ClassTable::install_basic_classes() {
+  AllocScope alloc(basic_classes_allocs);
   // The tree package uses these globals to annotate the classes built below.
   node_lineno  = 0;
   Symbol filename = stringtable.add_string("<basic class>");
@@ -863,7 +892,32 @@ void ClassTable::install_basic_classes() {
       addid(Str, Str_inheritance);
 }
 
+//
+// The classes of the separately compiled modules the program uses come
+// from their interfaces (see interface.h), with no bodies, like the
+// basic classes.
+//
+void ClassTable::install_interface_classes() {
+  AllocScope alloc(new_classes_allocs);
+  for (Interface& ifc : interfaces()) {
+    for (InterfaceClass& ic : ifc.classes) {
+      Symbol name = ic.cls->get_name();
+      InheritanceNodeP parent = lookup(ic.cls->get_parent());
+      if (lookup(name) != nullptr) {
+        semant_error(ic.cls) << "Class " << name << " was previously defined." << endl;
+      } else if (parent == nullptr) {
+        semant_error(ic.cls) << "Class " << name << " inherits from an undefined class " << ic.cls->get_parent() << "." << endl;
+      } else {
+        parent->add_child(name);
+        addid(name, new InheritanceNode(ic.cls));
+        interface_classes.insert(name);
+      }
+    }
+  }
+}
+
 void ClassTable::install_new_classes(Classes classes) {
+  AllocScope alloc(new_classes_allocs);
   for (int i = classes->first() ; classes->more(i) ; i = classes->next(i)) {
     Class_ current = classes->nth(i);
     Symbol current_name = current->get_name();
@@ -975,7 +1029,11 @@ void ClassTable::create_environments() {
   // start at object, and recurse from there
   InheritanceNodeP root_inheritance = lookup(Object);
   std::vector<Symbol> root_children = root_inheritance->get_children();
-  EnvironmentP base_environment = new Environment(root_inheritance->get_node(), this);
+  EnvironmentP base_environment;
+  {
+    AllocScope alloc(environment_allocs);
+    base_environment = new Environment(root_inheritance->get_node(), this);
+  }
   root_inheritance->set_env(base_environment);
 
   for (long unsigned int i = 0 ; i < root_children.size() ; i++) {
@@ -988,7 +1046,11 @@ void ClassTable::create_environments(Symbol class_name, EnvironmentP last_enviro
   InheritanceNodeP current_inheritance = lookup(class_name);
   std::vector<Symbol> current_children = current_inheritance->get_children();
   Class_ current_node = current_inheritance->get_node();
-  EnvironmentP current_environment = new Environment(current_node, *last_environment, this);
+  EnvironmentP current_environment;
+  {
+    AllocScope alloc(environment_allocs);
+    current_environment = new Environment(current_node, *last_environment, this);
+  }
   current_inheritance->set_env(current_environment);
 
   for (long unsigned int i = 0 ; i < current_children.size() ; i++) {
@@ -998,6 +1060,8 @@ void ClassTable::create_environments(Symbol class_name, EnvironmentP last_enviro
 }
 
 void ClassTable::type_check_class(Symbol class_name) {
+  PerfRegion perf(PERF_CLASSES, class_name->get_string());
+  TraceSpan trace("semant.class", class_name->get_string());
   InheritanceNodeP curr_inheritance = lookup(class_name);
   if (!curr_inheritance) { return; }
   Class_ curr_class = curr_inheritance->get_node();
@@ -1019,7 +1083,7 @@ void ClassTable::type_check() {
   while (!q.empty()) {
     Symbol current_class = q.back();
     q.pop_back();
-    if (current_class != Object && current_class != Int && current_class != Bool && current_class != Str && current_class != IO) {
+    if (current_class != Object && current_class != Int && current_class != Bool && current_class != Str && current_class != IO && !interface_classes.count(current_class)) {
       type_check_class(current_class);
     }
 
@@ -1088,7 +1152,26 @@ ostream& ClassTable::semant_error()
  */
 void program_class::semant() {
    initialize_constants();
-   ClassTableP classtable = new ClassTable(classes);
-   classtable->create_environments();
+   ClassTableP classtable;
+   {
+     PerfRegion perf(PERF_PHASES, "semant.classes");
+     TraceSpan trace("semant", "ClassTable");
+     AllocScope alloc(classes_allocs);
+     classtable = new ClassTable(classes);
+   }
+   {
+     PerfRegion perf(PERF_PHASES, "semant.environments");
+     TraceSpan trace("semant", "create_environments");
+     AllocScope alloc(environments_allocs);
+     classtable->create_environments();
+   }
+   // after the environments, as it looks up Main's; a module has no Main
+   if (!module_interface()) {
+     TraceSpan trace("semant", "check_main");
+     classtable->check_main();
+   }
+   PerfRegion perf(PERF_PHASES, "semant.type_check");
+   TraceSpan trace("semant", "type_check");
+   AllocScope alloc(type_check_allocs);
    classtable->type_check();
 }
@@ -2,10 +2,12 @@
 #define SEMANT_H_
 
 #include <assert.h>
+#include "alloc.h"
 #include "cool-tree.h"
 #include "stringtab.h"
 #include "symtab.h"
 #include <list>
+#include <set>
 #include <vector>
 
 #define TRUE 1
@@ -13,6 +15,8 @@
 
 class InheritanceNode;
 class Environment;
+
+extern AllocStats add_variable_allocs;
 typedef Environment *EnvironmentP;
 
 class InheritanceNode
@@ -55,17 +59,20 @@ class ClassTable : public SymbolTable<Symbol, InheritanceNode>
 private:
   int semant_errors; // counts the number of semantic errors
   void install_basic_classes();
+  void install_interface_classes();
   void install_new_classes(Classes classes);
   void check_inheritance(Classes classes);
   void create_environments(Symbol class_name, EnvironmentP environment);
   void check_parents(Classes classes);
-  void check_main();
   void abort();
   std::ostream &error_stream;
   void type_check_class(Symbol class_name);
+  // those of the interfaces, which have been checked in their module
+  std::set<Symbol> interface_classes;
 
 public:
   ClassTable(Classes);
+  void check_main();
   int errors() { return semant_errors; }
   std::ostream &semant_error();
   std::ostream &semant_error(Class_ c);
@@ -109,6 +116,7 @@ public:
   }
 
   void add_variable(Symbol name, Symbol type) {
+    AllocScope alloc(add_variable_allocs);
     objects_table.addid(name, new Symbol(type));
   }
 
@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Runs the semantic checker on each program in tests and compares what
+# it reports on stderr with tests/<name>.err; a program with errors
+# must also make it exit with 1.  Programs named module_* are checked
+# as library modules, which have no Main (see interface.h).  Exits
+# non-zero on any difference.
+#
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+NC='\033[0m'
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+status=0
+
+for file in tests/*.cl; do
+    name=$(basename "$file" .cl)
+    unset COOL_MODULE
+    [[ $name = module_* ]] && export COOL_MODULE="$OUT/$name.ci"
+
+    ./lexer "$file" | ./parser | ./semant > /dev/null 2> "$OUT/$name.err"
+    code=${PIPESTATUS[2]}
+    want=0
+    [ -s "tests/$name.err" ] && want=1
+
+    if [ $code = $want ] && diff "tests/$name.err" "$OUT/$name.err" > /dev/null; then
+        echo -e "${file} ${GREEN}✓${NC}"
+    else
+        echo -e "${RED}Difference found in ${file} (exit status ${code}, expected ${want}):${NC}"
+        diff "tests/$name.err" "$OUT/$name.err"
+        status=1
+    fi
+done
+
+exit $status
@@ -0,0 +1,8 @@
+-- classes that inherit from each other
+class A inherits B { };
+class B inherits C { };
+class C inherits A { };
+
+class Main {
+  main() : Object { 0 };
+};
@@ -0,0 +1,4 @@
+-- main must take no arguments
+class Main {
+  main(x : Int) : Object { x };
+};
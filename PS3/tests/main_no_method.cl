@@ -0,0 +1,4 @@
+-- Main without a main method
+class Main {
+  start() : Object { 0 };
+};
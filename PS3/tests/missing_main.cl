@@ -0,0 +1,4 @@
+-- a program without a Main class
+class A {
+  f() : Int { 1 };
+};
@@ -0,0 +1,5 @@
+-- a library module has no Main (run with COOL_MODULE set)
+class Counter {
+  n : Int;
+  bump() : Int { n <- n + 1 };
+};
@@ -0,0 +1,6 @@
+-- a class that inherits from itself
+class A inherits A { };
+
+class Main {
+  main() : Object { 0 };
+};
@@ -0,0 +1,39 @@
+(*
+ *  Loops whose bodies recompute values that do not change between
+ *  iterations, and multiply the loop counter by a constant.
+ *)
+
+class Main inherits IO {
+   s : String <- "abcdefghijklmnopqrstuvwxyz";
+
+   sum(n : Int, k : Int) : Int {
+      let i : Int <- 0, total : Int <- 0 in {
+         while i < n * k loop {
+            total <- total + i * 3 + (n - k);
+            i <- i + 1;
+         } pool;
+         total;
+      }
+   };
+
+   scan(n : Int) : Int {
+      let i : Int <- 0, hits : Int <- 0 in {
+         while i < n loop {
+            let j : Int <- 0 in
+               while j < s.length() loop {
+                  if j * 4 < i then hits <- hits + 1 else 0 fi;
+                  j <- j + 1;
+               } pool;
+            i <- i + 1;
+         } pool;
+         hits;
+      }
+   };
+
+   main() : Object {{
+      out_int(sum(2000, 5));
+      out_string(" ");
+      out_int(scan(200));
+      out_string("\n");
+   }};
+};
@@ -22,9 +22,33 @@
 //
 //**************************************************************
 
+#include <algorithm>
+#include <fstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sstream>
+#include <thread>
 #include "cgen.h"
 #include "cgen_supp.h"
 #include "handle_flags.h"
+#include "alloc.h"
+#include "interface.h"
+#include "perf.h"
+#include "trace.h"
+#include "x86.h"
+
+extern int disable_reg_alloc;
+
+// what the phases and the call sites that allocate most allocate (see alloc.h)
+static AllocStats install_allocs(ALLOC_PHASES, "cgen.install"),
+                  optimize_allocs(ALLOC_PHASES, "cgen.optimize"),
+                  bytecode_allocs(ALLOC_PHASES, "cgen.bytecode"),
+                  data_allocs(ALLOC_PHASES, "cgen.data"),
+                  classes_allocs(ALLOC_PHASES, "cgen.classes"),
+                  lower_x86_allocs(ALLOC_PHASES, "cgen.lower_x86"),
+                  cgen_node_allocs(ALLOC_SITES, "new CgenNode"),
+                  var_location_allocs(ALLOC_SITES, "new VarLocation"),
+                  code_class_allocs(ALLOC_SITES, "code_init, code_methods");
 
 //
 // Two symbols from the semantic analyzer (semant.cc) are used.
@@ -112,6 +136,27 @@ static const char *gc_collect_names[] =
 BoolConst falsebool(FALSE);
 BoolConst truebool(TRUE);
 
+//  Labels are numbered consecutively within a class, and carry the tag of
+//  the class, so classes can be coded on different threads.
+static thread_local int next_label = 0;
+static thread_local int label_space = 0;
+
+static void begin_labels(int space)
+{
+  next_label = 0;
+  label_space = space;
+}
+
+//  The labels and constants of a module carry its name, so that they do
+//  not clash with those of the program it is put together with.
+static std::string label_prefix = "label";
+static std::string const_prefix = "";
+
+//  The stack maps of the class being coded go to a buffer of its own.
+static thread_local std::ostream *stack_map_out = NULL;
+
+static Register const temp_regs[NUM_TEMP_REGS] = { S1, S2, S3, S4, S5, S6 };
+
 //*********************************************************
 //
 // Define method for code generation
@@ -131,7 +176,20 @@ BoolConst truebool(TRUE);
 //*********************************************************
 void program_class::cgen(ostream &os) {
    initialize_constants();
-   CgenClassTable *codegen_classtable = new CgenClassTable(classes,os);
+   // The code is written a line at a time with endl, and most of what a
+   // small program compiles to is the fixed data of the basic classes
+   // (the boxed Int cache alone is over 5000 lines).  It is built in
+   // memory and written out at once, rather than flushed line by line.
+   std::stringstream mips;
+   CgenClassTable *codegen_classtable = new CgenClassTable(classes,mips);
+   if (cgen_target() != TARGET_X86_64) {
+     os << mips.rdbuf();
+     return;
+   }
+   PerfRegion perf(PERF_PHASES, "cgen.lower_x86");
+   TraceSpan trace("cgen", "lower_x86");
+   AllocScope alloc(lower_x86_allocs);
+   lower_x86(mips.str(), os);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -152,7 +210,7 @@ void program_class::cgen(ostream &os) {
 static std::string get_label_ref(int l)
 { std::stringstream ss;
   ss << l;
-  std::string lbl = "label" + ss.str();
+  std::string lbl = label_prefix + std::to_string(label_space) + "_" + ss.str();
   return lbl;
 }
 
@@ -227,10 +285,22 @@ static void emit_sub(const char *dest, const char *src1, const char *src2, ostre
 static void emit_sll(const char *dest, const char *src1, int num, ostream& s)
 { s << SLL << dest << " " << src1 << " " << num << std::endl; }
 
+static void emit_slt(const char *dest, const char *src1, const char *src2, ostream& s)
+{ s << SLT << dest << " " << src1 << " " << src2 << std::endl; }
+
+static void emit_sle(const char *dest, const char *src1, const char *src2, ostream& s)
+{ s << SLE << dest << " " << src1 << " " << src2 << std::endl; }
+
+static void emit_seq(const char *dest, const char *src1, const char *src2, ostream& s)
+{ s << SEQ << dest << " " << src1 << " " << src2 << std::endl; }
+
+static void emit_xori(const char *dest, const char *src1, int imm, ostream& s)
+{ s << XORI << dest << " " << src1 << " " << imm << std::endl; }
+
 static void emit_jalr(const char *dest, ostream& s)
 { s << JALR << "\t" << dest << std::endl; }
 
-static void emit_jal(char *address,ostream &s)
+static void emit_jal(const char *address,ostream &s)
 { s << JAL << address << endl; }
 
 static void emit_return(ostream& s)
@@ -251,6 +321,9 @@ static void emit_label_ref(int l, ostream &s)
 static void emit_protobj_ref(Symbol sym, ostream& s)
 { s << sym << PROTOBJ_SUFFIX; }
 
+static void emit_tags_ref(Symbol sym, ostream& s)
+{ s << sym << TAGS_SUFFIX; }
+
 static void emit_method_ref(Symbol classname, Symbol methodname, ostream& s)
 { s << classname << METHOD_SEP << methodname; }
 
@@ -355,6 +428,131 @@ static void emit_gc_check(const char *source, ostream &s)
   s << JAL << "_gc_check" << std::endl;
 }
 
+//
+// The generational collector must hear of every pointer stored into an
+// attribute, in case it makes an old object point to a young one.  The
+// constant objects are never young.
+//
+static void emit_gc_assign_attr(Register base, int offset, Expression value,
+                                CgenClassTableP ct, ostream &s)
+{
+  if (base != SELF || cgen_Memmgr != GC_GENGC)
+    return;
+  ct->count_barrier(value->is_constant_object());
+  if (value->is_constant_object())
+    return;
+  emit_addiu(A1, SELF, offset * WORD_SIZE, s);
+  emit_gc_assign(s);
+}
+
+//
+// Marks the return address of a call that may allocate (see
+// StackMapSite in cgen.h).  Only the collectors read the maps.
+//
+static void emit_call_return(CgenEnvironmentP env, ostream &s)
+{
+  if (cgen_Memmgr != GC_NOGC)
+    env->add_stack_map(s);
+}
+
+static void emit_stack_maps(CgenEnvironmentP env, int formals)
+{
+  for (auto& m : env->get_stack_maps()) {
+    *stack_map_out << WORD;
+    emit_label_ref(m.label, *stack_map_out);
+    *stack_map_out << ", " << formals << ", " << env->frame_locals() << ", "
+                   << env->saved_regs() << ", " << m.locals << ", " << m.temps
+                   << std::endl;
+  }
+}
+
+//
+// Method entry and exit.  The frame holds the saved $fp, $s0 and $ra,
+// `locals' words for let and case variables, and the `saved' temporary
+// registers the method uses (see the layout in cgen.h).  The callee pops
+// its arguments on return.
+//
+static void emit_method_prologue(int locals, int saved, ostream& s)
+{
+  int frame = 3 + locals + saved;
+  emit_addiu(SP, SP, -frame * WORD_SIZE, s);
+  emit_store(FP, frame, SP, s);
+  emit_store(SELF, frame - 1, SP, s);
+  emit_store(RA, frame - 2, SP, s);
+  for (int i = 0; i < saved; i++)
+    emit_store(temp_regs[i], frame - 3 - locals - i, SP, s);
+  // The collectors scan the stack, so locals must not hold stale pointers.
+  if (cgen_Memmgr != GC_NOGC)
+    for (int i = 0; i < locals; i++)
+      emit_store(ZERO, frame - 3 - i, SP, s);
+  emit_addiu(FP, SP, frame * WORD_SIZE, s);
+  emit_move(SELF, ACC, s);
+}
+
+static void emit_method_epilogue(int formals, int locals, int saved, ostream& s)
+{
+  emit_load(RA, -2, FP, s);
+  emit_load(SELF, -1, FP, s);
+  for (int i = 0; i < saved; i++)
+    emit_load(temp_regs[i], -3 - locals - i, FP, s);
+  emit_addiu(SP, FP, formals * WORD_SIZE, s);
+  emit_load(FP, 0, FP, s);
+  emit_return(s);
+}
+
+//
+// The new arguments are on top of the stack and move up to end where
+// the method's own end, so they are copied last first.  The receiver
+// stays in ACC; the saved $fp is read before it can be overwritten.
+//
+static void emit_tail_call(const TailCall& t, int formals, int locals,
+                           int saved, ostream& s)
+{
+  emit_label_def(t.label, s);
+  emit_load(RA, -2, FP, s);
+  emit_load(SELF, -1, FP, s);
+  for (int i = 0; i < saved; i++)
+    emit_load(temp_regs[i], -3 - locals - i, FP, s);
+  emit_load(T2, 0, FP, s);
+  for (int k = t.nargs; k > 0; k--) {
+    emit_load(T3, k, SP, s);
+    emit_store(T3, formals - t.nargs + k, FP, s);
+  }
+  emit_addiu(SP, FP, (formals - t.nargs) * WORD_SIZE, s);
+  emit_move(FP, T2, s);
+  if (t.impl != NULL) {
+    s << JUMP; emit_method_ref(t.impl, t.name, s); s << std::endl;
+  } else
+    s << JR << T1 << std::endl;
+}
+
+//
+// Load the default value of a variable of the given type: the boxed zero,
+// empty string or false for the basic classes, void for everything else.
+//
+static void emit_default_value(const char *dest, Symbol type, ostream& s)
+{
+  if (type == Int)
+    emit_load_int(dest, inttable.lookup_string("0"), s);
+  else if (type == Str)
+    emit_load_string(dest, stringtable.lookup_string(""), s);
+  else if (type == Bool)
+    emit_load_bool(dest, falsebool, s);
+  else
+    emit_move(dest, ZERO, s);
+}
+
+//
+// Runtime errors that report a source position take the file name in ACC
+// and the line number in T1.
+//
+static void emit_abort(const char *handler, Symbol filename, int line, ostream& s)
+{
+  emit_load_string(ACC, stringtable.lookup_string(filename->get_string()), s);
+  emit_load_imm(T1, line, s);
+  emit_jal(handler, s);
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -382,12 +580,11 @@ static void emit_gc_check(const char *source, ostream &s)
 //
 void StringEntry::code_ref(ostream& s)
 {
-  s << STRCONST_PREFIX << index;
+  s << const_prefix << STRCONST_PREFIX << index;
 }
 
 //
 // Emit code for a constant String.
-// You should fill in the code naming the dispatch table.
 //
 
 void StringEntry::code_def(ostream& s, int stringclasstag)
@@ -403,7 +600,7 @@ void StringEntry::code_def(ostream& s, int stringclasstag)
      << WORD << (DEFAULT_OBJFIELDS + STRING_SLOTS + (len+4)/4) << std::endl // size
      << WORD;
 
-  /***** Add dispatch information for class String ******/
+  emit_disptable_ref(Str, s);
   s << std::endl;                                              // dispatch table
   s << WORD;  lensym->code_ref(s);  s << std::endl;            // string length
   emit_string_constant(s,str);                                // ascii string
@@ -426,12 +623,11 @@ void StrTable::code_string_table(ostream& s, int stringclasstag) {
 //
 void IntEntry::code_ref(ostream &s)
 {
-  s << INTCONST_PREFIX << index;
+  s << const_prefix << INTCONST_PREFIX << index;
 }
 
 //
 // Emit code for a constant Integer.
-// You should fill in the code naming the dispatch table.
 //
 
 void IntEntry::code_def(ostream &s, int intclasstag)
@@ -445,8 +641,7 @@ void IntEntry::code_def(ostream &s, int intclasstag)
     << WORD << (DEFAULT_OBJFIELDS + INT_SLOTS) << std::endl  // object size
     << WORD;
 
-  /***** Add dispatch information for class Int ******/
-
+  emit_disptable_ref(Int, s);
   s << std::endl;                                          // dispatch table
   s << WORD << str << std::endl;                           // integer value
 }
@@ -474,7 +669,6 @@ void BoolConst::code_ref(ostream& s) const
 
 //
 // Emit code for a constant Bool.
-// You should fill in the code naming the dispatch table.
 //
 
 void BoolConst::code_def(ostream& s, int boolclasstag)
@@ -488,8 +682,7 @@ void BoolConst::code_def(ostream& s, int boolclasstag)
     << WORD << (DEFAULT_OBJFIELDS + BOOL_SLOTS) << std::endl   // object size
     << WORD;
 
-  /***** Add dispatch information for class Bool ******/
-
+  emit_disptable_ref(Bool, s);
   s << std::endl;                                            // dispatch table
   s << WORD << val << std::endl;                             // value (0 or 1)
 }
@@ -552,10 +745,7 @@ void CgenClassTable::code_global_data()
 
 void CgenClassTable::code_global_text()
 {
-  str << GLOBAL << HEAP_START << std::endl
-      << HEAP_START << LABEL
-      << WORD << 0 << std::endl
-      << "\t.text" << std::endl
+  str << "\t.text" << std::endl
       << GLOBAL;
   emit_init_ref(idtable.add_string("Main"), str);
   str << std::endl << GLOBAL;
@@ -616,26 +806,90 @@ void CgenClassTable::code_constants()
 
   stringtable.code_string_table(str,stringclasstag);
   inttable.code_string_table(str,intclasstag);
+  if (module)     // the program has the rest
+    return;
+  code_int_cache(intclasstag);
   code_bools();
 }
 
-CgenClassTable::CgenClassTable(Classes classes, ostream& s) : str(s) {
+//
+// The boxed Ints INT_CACHE_MIN..INT_CACHE_MAX, one after another, so that
+// the one for v is at _int_cache + v * 20 (see code_box).
+//
+void CgenClassTable::code_int_cache(int intclasstag)
+{
+  for (int v = INT_CACHE_MIN; v <= INT_CACHE_MAX; v++) {
+    str << WORD << "-1" << std::endl;
+    if (v == 0)
+      str << INT_CACHE << LABEL;
+    str << WORD << intclasstag << std::endl
+        << WORD << (DEFAULT_OBJFIELDS + INT_SLOTS) << std::endl
+        << WORD;
+    emit_disptable_ref(Int, str);
+    str << std::endl << WORD << v << std::endl;
+  }
+  str << INT_SCRATCH << LABEL
+      << WORD << 0 << std::endl;
+}
+
+CgenClassTable::CgenClassTable(Classes classes, ostream& s) : str(s),
+   dispatch_sites(0), devirtualized_sites(0), inlined_sites(0), tail_calls(0),
+   barriers(0), elided_barriers(0) {
 
   // make sure the various tables have a scope
   class_to_tag_table.enterscope();
 
+  const char *rules = getenv("CGEN_PEEPHOLE");
+  if (rules != NULL && !peephole.configure(rules))
+    std::cerr << "CGEN_PEEPHOLE: unknown rule in \"" << rules << "\"" << std::endl;
+
+  module = module_interface() != NULL;
+  if ((module || !interfaces().empty()) && cgen_target() != TARGET_MIPS) {
+    std::cerr << "separately compiled modules are only for the mips target" << std::endl;
+    exit(1);
+  }
+  if (module) {
+    label_prefix = module_name() + "_label";
+    const_prefix = module_name() + "_";
+  }
+
   enterscope();
   if (cgen_debug) std::cerr << "Building CgenClassTable" << std::endl;
-  install_basic_classes();
-  install_classes(classes);
-  build_inheritance_tree();
+  {
+    PerfRegion perf(PERF_PHASES, "cgen.install");
+    TraceSpan trace("cgen", "install");
+    AllocScope alloc(install_allocs);
+    install_basic_classes();
+    install_interfaces();
+    install_classes(classes);
+    build_inheritance_tree();
+    assign_tags(root());
+    root()->layout();
+    check_interfaces();
+  }
+  if (cgen_optimize) {
+    PerfRegion perf(PERF_PHASES, "cgen.optimize");
+    TraceSpan trace("cgen", "optimize");
+    AllocScope alloc(optimize_allocs);
+    fold_constants();
+    // the code of other modules is not seen here, nor what it reaches
+    if (!module && interfaces().empty())
+      eliminate_dead_code();
+  }
 
-  code();
+  if (cgen_target() == TARGET_BYTECODE) {
+    PerfRegion perf(PERF_PHASES, "cgen.bytecode");
+    TraceSpan trace("cgen", "bytecode");
+    AllocScope alloc(bytecode_allocs);
+    code_bytecode();
+  } else
+    code();
   exitscope();
 }
 
 
 void CgenClassTable::install_basic_classes() {
+  AllocScope alloc(cgen_node_allocs);
   Symbol filename = stringtable.add_string("<basic class>");
 
   //
@@ -677,29 +931,6 @@ void CgenClassTable::install_basic_classes() {
 	   filename),
     Basic,this));
 
-//
-// The IO class inherits from Object. Its methods are
-//        out_string(Str) : SELF_TYPE          writes a string to the output
-//        out_int(Int) : SELF_TYPE               "    an int    "  "     "
-//        in_string() : Str                    reads a string from the input
-//        in_int() : Int                         "   an int     "  "     "
-//
-   install_class(
-    new CgenNode(
-     class_(IO,
-            Object,
-            append_Features(
-            append_Features(
-            append_Features(
-            single_Features(method(out_string, single_Formals(formal(arg, Str)),
-                        SELF_TYPE, no_expr())),
-            single_Features(method(out_int, single_Formals(formal(arg, Int)),
-                        SELF_TYPE, no_expr()))),
-            single_Features(method(in_string, nil_Formals(), Str, no_expr()))),
-            single_Features(method(in_int, nil_Formals(), Int, no_expr()))),
-	   filename),
-    Basic,this));
-
 //
 // The Int class has no methods and only a single attribute, the
 // "val" for the integer.
@@ -751,6 +982,32 @@ void CgenClassTable::install_basic_classes() {
 	     filename),
         Basic,this));
 
+//
+// The IO class inherits from Object. It comes after Int, Bool and
+// String, which cannot be inherited, so that their tags (1, 2 and 3)
+// are the same in every program, as the constants of separately
+// compiled modules need.  Its methods are
+//        out_string(Str) : SELF_TYPE          writes a string to the output
+//        out_int(Int) : SELF_TYPE               "    an int    "  "     "
+//        in_string() : Str                    reads a string from the input
+//        in_int() : Int                         "   an int     "  "     "
+//
+   install_class(
+    new CgenNode(
+     class_(IO,
+            Object,
+            append_Features(
+            append_Features(
+            append_Features(
+            single_Features(method(out_string, single_Formals(formal(arg, Str)),
+                        SELF_TYPE, no_expr())),
+            single_Features(method(out_int, single_Formals(formal(arg, Int)),
+                        SELF_TYPE, no_expr()))),
+            single_Features(method(in_string, nil_Formals(), Str, no_expr()))),
+            single_Features(method(in_int, nil_Formals(), Int, no_expr()))),
+	   filename),
+    Basic,this));
+
 }
 
 // CgenClassTable::install_class
@@ -776,10 +1033,44 @@ void CgenClassTable::install_class(CgenNodeP nd) {
 }
 
 void CgenClassTable::install_classes(Classes cs) {
+  AllocScope alloc(cgen_node_allocs);
   for(int i = cs->first(); cs->more(i); i = cs->next(i))
     install_class(new CgenNode(cs->nth(i), NotBasic, this));
 }
 
+//
+// The classes of the interfaces the program is compiled against, in the
+// order they were read, so that a class comes after its parent.
+//
+void CgenClassTable::install_interfaces() {
+  AllocScope alloc(cgen_node_allocs);
+  for (auto& ifc : interfaces())
+    for (auto& ic : ifc.classes)
+      install_class(new CgenNode(ic.cls, External, this));
+}
+
+//
+// A module's code indexes the dispatch tables its interface gives.  The
+// tables laid out here must be the same, which they are unless a module
+// it uses has changed since it was compiled.
+//
+void CgenClassTable::check_interfaces() {
+  for (auto& ifc : interfaces())
+    for (auto& ic : ifc.classes) {
+      std::vector<std::pair<Symbol, method_class *> >& methods =
+        probe(ic.cls->get_name())->get_methods();
+      bool same = methods.size() == ic.slots.size();
+      for (size_t i = 0; same && i < methods.size(); i++)
+        same = methods[i].first == ic.slots[i].first &&
+               methods[i].second->get_name() == ic.slots[i].second;
+      if (!same) {
+        std::cerr << ifc.file << ": the dispatch table of " << ic.cls->get_name()
+                  << " has changed; compile the module again" << std::endl;
+        exit(1);
+      }
+    }
+}
+
 //
 // CgenClassTable::build_inheritance_tree
 //
@@ -818,35 +1109,362 @@ CgenNodeP CgenNode::get_parentnd()
 }
 
 
-void CgenClassTable::code()
+//
+// CgenClassTable::assign_tags
+//
+// Numbers the classes in a preorder walk of the inheritance tree, so that
+// a class and its descendants get the contiguous tags [tag, max_tag].
+//
+void CgenClassTable::assign_tags(CgenNodeP nd)
+{
+  int tag = tag_to_class.size();
+  tag_to_class.push_back(nd);
+  class_to_tag_table.addid(nd->get_name(), new int(tag));
+  for (auto child : nd->get_children())
+    assign_tags(child);
+  nd->set_tags(tag, tag_to_class.size() - 1);
+}
+
+//
+// class_nameTab maps a tag to the String object holding the class name;
+// class_objTab maps it to the prototype object and the initializer.
+//
+void CgenClassTable::code_class_nameTab()
+{
+  str << CLASSNAMETAB << LABEL;
+  for (auto nd : tag_to_class) {
+    str << WORD;
+    stringtable.lookup_string(nd->get_name()->get_string())->code_ref(str);
+    str << std::endl;
+  }
+}
+
+void CgenClassTable::code_class_objTab()
+{
+  str << CLASSOBJTAB << LABEL;
+  for (auto nd : tag_to_class) {
+    if (!nd->is_instantiated()) {
+      str << WORD << 0 << std::endl << WORD << 0 << std::endl;
+      continue;
+    }
+    str << WORD; emit_protobj_ref(nd->get_name(), str); str << std::endl;
+    str << WORD; emit_init_ref(nd->get_name(), str);    str << std::endl;
+  }
+}
+
+void CgenClassTable::code_dispatch_tables()
+{
+  for (auto nd : tag_to_class)
+    if (nd->is_instantiated())
+      nd->code_disptab(str);
+}
+
+void CgenClassTable::code_prototypes()
+{
+  for (auto nd : tag_to_class)
+    if (nd->is_instantiated())
+      nd->code_protobj(str);
+}
+
+void CgenClassTable::code_class_tags()
+{
+  for (auto nd : tag_to_class) {
+    emit_tags_ref(nd->get_name(), str);
+    str << LABEL << WORD << nd->get_tag() << ", " << nd->get_max_tag() << std::endl;
+  }
+}
+
+//
+// The classes the module defines, with their stack maps, which go in
+// the table of the program (see interface.h).
+//
+void CgenClassTable::write_interface(std::vector<std::stringstream>& maps)
+{
+  std::ofstream out(module_interface());
+  for (auto nd : tag_to_class) {
+    if (nd->coded_elsewhere())
+      continue;
+    out << "class " << nd->get_name() << " " << nd->get_parent() << std::endl;
+    Features features = nd->get_features();
+    for (int i = features->first(); features->more(i); i = features->next(i)) {
+      Feature f = features->nth(i);
+      if (!f->is_method()) {
+        out << "attr " << f->get_name() << " "
+            << ((attr_class *) f)->get_type_decl() << std::endl;
+        continue;
+      }
+      method_class *m = (method_class *) f;
+      out << "method " << m->get_name() << " " << m->get_return_type();
+      Formals formals = m->get_formals();
+      for (int j = formals->first(); formals->more(j); j = formals->next(j))
+        out << " " << formals->nth(j)->get_name() << " "
+            << formals->nth(j)->get_type_decl();
+      out << std::endl;
+    }
+    for (auto& m : nd->get_methods())
+      out << "slot " << m.first << " " << m.second->get_name() << std::endl;
+  }
+  for (auto& b : maps) {
+    std::string line;
+    while (std::getline(b, line))
+      out << "map " << line.substr(strlen(WORD)) << std::endl;
+  }
+  out.close();
+  if (!out) {
+    std::cerr << "COOL_MODULE: cannot write " << module_interface() << std::endl;
+    exit(1);
+  }
+}
+
+//
+// Each class is coded into buffers of its own, by a pool of threads that
+// take the next class in tag order.  The buffers are written out in tag
+// order, initializers first, so the output does not depend on the
+// number of threads.  The methods of the basic classes are part of the
+// runtime system.
+//
+// The stack maps follow in the data segment, as entries of six words
+// (return address, formals, frame locals, saved registers, live locals,
+// live temporaries) ending with a zero word.  heap_start must be the
+// last label of the data segment, so it comes after them.  Those of the
+// modules the program uses come first; a module's own go to its
+// interface.
+//
+void CgenClassTable::code_classes()
 {
+  size_t n = tag_to_class.size();
+  std::vector<std::stringstream> inits(n), methods(n), maps(n);
+  std::atomic<size_t> next(0);
+
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < n; ) {
+      CgenNodeP nd = tag_to_class[i];
+      PerfRegion perf(PERF_CLASSES, nd->get_name()->get_string());
+      TraceSpan trace("cgen.class", nd->get_name()->get_string());
+      AllocScope alloc(code_class_allocs);
+      begin_labels(nd->get_tag());
+      stack_map_out = &maps[i];
+      // a module leaves the basic initializers to the program
+      if (nd->is_initialized() && !nd->external() && !(module && nd->basic()))
+        nd->code_init(inits[i], this);
+      if (!nd->coded_elsewhere())
+        nd->code_methods(methods[i], this);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int t = 1; t < num_threads(); t++)
+    pool.push_back(std::thread(worker));
+  worker();
+  for (auto& t : pool)
+    t.join();
+
+  for (auto& b : inits)
+    str << b.str();
+  for (auto& b : methods)
+    str << b.str();
+
+  if (module) {
+    write_interface(maps);
+    return;
+  }
+  str << "\t.data" << std::endl
+      << GLOBAL << STACK_MAPS << std::endl
+      << STACK_MAPS << LABEL;
+  for (auto& ifc : interfaces())
+    for (auto& m : ifc.maps)
+      str << WORD << m << std::endl;
+  for (auto& b : maps)
+    str << b.str();
+  str << WORD << 0 << std::endl
+      << GLOBAL << HEAP_START << std::endl
+      << HEAP_START << LABEL
+      << WORD << 0 << std::endl;
+}
 
+int CgenClassTable::num_threads()
+{
+  const char *env = getenv("CGEN_THREADS");
+  int n = env != NULL ? atoi(env) : DEFAULT_THREADS;
+  if (n <= 0)
+    n = std::thread::hardware_concurrency();
+  return std::max(n, 1);
+}
 
+CgenTarget cgen_target()
+{
+  const char *target = getenv("CGEN_TARGET");
+  if (target == NULL || strcmp(target, "mips") == 0)
+    return TARGET_MIPS;
+  if (strcmp(target, "x86-64") == 0)
+    return TARGET_X86_64;
+  if (strcmp(target, "bytecode") == 0)
+    return TARGET_BYTECODE;
+  std::cerr << "CGEN_TARGET: unknown target \"" << target
+            << "\", using mips" << std::endl;
+  return TARGET_MIPS;
+}
 
-    if (cgen_debug) std::cerr << "coding global data" << std::endl;
-    code_global_data();
+//
+// Inlining codes the body of a method into its callers, so the same body
+// can be coded on several threads; it must not be annotated there.
+//
+void CgenClassTable::analyze()
+{
+  for (auto nd : tag_to_class) {
+    if (nd->coded_elsewhere())
+      continue;
+    Features features = nd->get_features();
+    for (int i = features->first(); features->more(i); i = features->next(i)) {
+      Feature f = features->nth(i);
+      Expression e = f->is_method() ? ((method_class *) f)->get_expr()
+                                    : ((attr_class *) f)->get_init();
+      EscapeAnalysis ea;
+      e->find_escapes(&ea, true);
+      e->temps_needed();
+    }
+  }
+}
 
-    if (cgen_debug) std::cerr << "choosing gc" << std::endl;
-    code_select_gc();
+void CgenClassTable::code()
+{
+  {
+    PerfRegion perf(PERF_PHASES, "cgen.data");
+    TraceSpan trace("cgen", "data");
+    AllocScope alloc(data_allocs);
+    if (module) {
+      // the tables of all the classes are the program's
+      if (cgen_debug) std::cerr << "coding constants" << std::endl;
+      str << "\t.data\n" << ALIGN;
+      code_constants();
+      str << "\t.text" << std::endl;
+    } else {
+      if (cgen_debug) std::cerr << "coding global data" << std::endl;
+      code_global_data();
+
+      if (cgen_debug) std::cerr << "choosing gc" << std::endl;
+      code_select_gc();
+
+      if (cgen_debug) std::cerr << "coding constants" << std::endl;
+      code_constants();
+
+      if (cgen_debug) std::cerr << "coding class tables" << std::endl;
+      code_class_nameTab();
+      code_class_objTab();
+      code_dispatch_tables();
+
+      if (cgen_debug) std::cerr << "coding prototype objects" << std::endl;
+      code_prototypes();
+      if (!interfaces().empty())
+        code_class_tags();
+
+      if (cgen_debug) std::cerr << "coding global text" << std::endl;
+      code_global_text();
+    }
+  }
 
-    if (cgen_debug) std::cerr << "coding constants" << std::endl;
-    code_constants();
+  {
+    PerfRegion perf(PERF_PHASES, "cgen.classes");
+    TraceSpan trace("cgen", "classes");
+    AllocScope alloc(classes_allocs);
+    if (cgen_debug) std::cerr << "coding initializers and methods" << std::endl;
+    analyze();
+    code_classes();
+  }
 
-    //                 Add your code to emit
-    //                   - prototype objects
-    //                   - class_nameTab
-    //                   - dispatch tables
-    //
+  if (cgen_debug) {
+    std::cerr << "devirtualized " << devirtualized_sites << " of "
+              << dispatch_sites << " dynamic dispatch sites" << std::endl;
+    std::cerr << "inlined " << inlined_sites << " call sites" << std::endl;
+    std::cerr << "made " << tail_calls << " tail calls" << std::endl;
+    if (cgen_Memmgr == GC_GENGC)
+      std::cerr << "elided " << elided_barriers << " of "
+                << barriers + elided_barriers << " write barriers" << std::endl;
+    if (cgen_optimize)
+      peephole.report(std::cerr);
+  }
+}
 
+//
+// Method and initializer code goes through the peephole optimizer when
+// optimizing (-O); the rules can be chosen with CGEN_PEEPHOLE.
+//
+void CgenClassTable::emit_code(const std::string& code, ostream& s)
+{
+  if (cgen_optimize)
+    peephole.run(code, s);
+  else
+    s << code;
+}
 
-    if (cgen_debug) std::cerr << "coding global text" << std::endl;
-    code_global_text();
+//
+// The first sweep finds the names assigned anywhere in the program, which
+// the loop optimizer of the second needs.  Code not seen here may assign
+// the attributes of external classes, and, in a module, of any class.
+//
+void CgenClassTable::fold_constants()
+{
+  ConstantFolder cf;
+  for (auto nd : tag_to_class)
+    if (nd->external() || (module && !nd->basic()))
+      for (auto a : nd->get_attrs())
+        cf.assign(a->get_name());
+  for (int sweep = 0; sweep < 2; sweep++) {
+    for (auto nd : tag_to_class) {
+      if (nd->coded_elsewhere())
+        continue;
+      Features features = nd->get_features();
+      for (int i = features->first(); features->more(i); i = features->next(i)) {
+        Feature f = features->nth(i);
+        if (f->is_method())
+          ((method_class *) f)->fold_constants(&cf);
+        else
+          ((attr_class *) f)->fold_constants(&cf);
+      }
+    }
+    cf.finish_scan();
+  }
+  if (cgen_debug) {
+    std::cerr << "folded " << cf.get_folded() << " expressions" << std::endl;
+    std::cerr << "hoisted " << cf.get_hoisted() << " loop invariants, reduced "
+              << cf.get_reduced() << " multiplications" << std::endl;
+  }
+}
 
-    //                 Add your code to emit
-    //                   - object initializer
-    //                   - the class methods
-    //                   - etc...
+void CgenClassTable::eliminate_dead_code()
+{
+  Reachability r(this);
+  r.run(Main, main_meth);
+
+  int classes = 0, dead_classes = 0, methods = 0, dead_methods = 0;
+  for (auto nd : tag_to_class) {
+    if (nd->basic())
+      continue;
+    nd->set_live(r.is_created(nd), r.is_initialized(nd));
+    classes++;
+    if (!nd->is_instantiated())
+      dead_classes++;
+    Features features = nd->get_features();
+    for (int i = features->first(); features->more(i); i = features->next(i)) {
+      if (!features->nth(i)->is_method())
+        continue;
+      method_class *m = (method_class *) features->nth(i);
+      m->live = r.is_live(m);
+      methods++;
+      if (!m->live)
+        dead_methods++;
+    }
+  }
+  if (cgen_debug)
+    std::cerr << "eliminated " << dead_methods << " of " << methods
+              << " methods and " << dead_classes << " of " << classes
+              << " classes" << std::endl;
+}
 
+void CgenClassTable::count_dispatch(bool devirtualized)
+{
+  dispatch_sites++;
+  if (devirtualized)
+    devirtualized_sites++;
 }
 
 
@@ -865,103 +1483,2646 @@ CgenNodeP CgenClassTable::root()
 CgenNode::CgenNode(Class_ nd,Basicness bstatus, CgenClassTableP ct) :
    class__class((const class__class &) *nd),
    parentnd(NULL),
-   basic_status(bstatus)
+   basic_status(bstatus),
+   tag(-1),
+   max_tag(-1),
+   instantiated(true),
+   initialized(true)
 {
-  // stringtable.add_string(name->get_string());          // Add class name to string table
+  stringtable.add_string(name->get_string());          // Add class name to string table
 }
 
-
-//******************************************************************
 //
-//   Fill in the following methods to produce code for the
-//   appropriate expression.  You may add or remove parameters
-//   as you wish, but if you do, remember to change the parameters
-//   of the declarations in `cool-tree.h'  Sample code for
-//   constant integers, strings, and booleans are provided.
+// CgenNode::layout
 //
-//*****************************************************************
+// A class starts with its parent's attributes and dispatch table.  Its own
+// attributes are appended; its methods either override the inherited slot
+// of the same name or are appended.
+//
+void CgenNode::layout()
+{
+  if (parentnd && parentnd->get_name() != No_class) {
+    attrs = parentnd->attrs;
+    methods = parentnd->methods;
+  }
 
-void branch_class::code(ostream &s) {
-}
+  for (int i = features->first(); features->more(i); i = features->next(i)) {
+    Feature f = features->nth(i);
+    if (!f->is_method()) {
+      attrs.push_back((attr_class *) f);
+      continue;
+    }
+    int offset = method_offset(f->get_name());
+    if (offset >= 0)
+      methods[offset] = std::make_pair(name, (method_class *) f);
+    else
+      methods.push_back(std::make_pair(name, (method_class *) f));
+  }
 
-void assign_class::code(ostream &s) {
+  for (auto child : children)
+    child->layout();
 }
 
-void static_dispatch_class::code(ostream &s) {
+int CgenNode::attr_offset(Symbol attr_name)
+{
+  for (size_t i = 0; i < attrs.size(); i++)
+    if (attrs[i]->get_name() == attr_name)
+      return DEFAULT_OBJFIELDS + i;
+  return -1;
 }
 
-void dispatch_class::code(ostream &s) {
+int CgenNode::method_offset(Symbol method_name)
+{
+  for (size_t i = 0; i < methods.size(); i++)
+    if (methods[i].second->get_name() == method_name)
+      return i;
+  return -1;
 }
 
-void cond_class::code(ostream &s) {
+Symbol CgenNode::unique_impl(Symbol method_name)
+{
+  Symbol impl = method_class_of(method_name);
+  for (auto child : children)
+    if (child->unique_impl(method_name) != impl)
+      return NULL;
+  return impl;
 }
 
-void loop_class::code(ostream &s) {
+void CgenNode::code_disptab(ostream& s)
+{
+  emit_disptable_ref(name, s); s << LABEL;
+  for (auto m : methods) {
+    s << WORD;
+    if (m.second->live)
+      emit_method_ref(m.first, m.second->get_name(), s);
+    else
+      s << 0;
+    s << std::endl;
+  }
 }
 
-void typcase_class::code(ostream &s) {
-}
+void CgenNode::code_protobj(ostream& s)
+{
+  // Add -1 eye catcher
+  s << WORD << "-1" << std::endl;
 
-void block_class::code(ostream &s) {
+  emit_protobj_ref(name, s);
+  s << LABEL                                                  // label
+    << WORD << tag << std::endl                               // class tag
+    << WORD << (DEFAULT_OBJFIELDS + attrs.size()) << std::endl // object size
+    << WORD;
+  emit_disptable_ref(name, s);
+  s << std::endl;                                             // dispatch table
+
+  for (auto a : attrs) {
+    Symbol type = a->get_type_decl();
+    s << WORD;
+    if (type == Int)
+      inttable.lookup_string("0")->code_ref(s);
+    else if (type == Str)
+      stringtable.lookup_string("")->code_ref(s);
+    else if (type == Bool)
+      falsebool.code_ref(s);
+    else
+      s << EMPTYSLOT;
+    s << std::endl;                                           // attribute
+  }
 }
 
-void let_class::code(ostream &s) {
-}
+//
+// CgenNode::code_init
+//
+// The initializer runs the parent's initializer, then evaluates the
+// initial values of the attributes this class defines, in order.  The
+// prototype already holds the defaults, so attributes without an
+// initializer need no code.
+//
+void CgenNode::code_init(ostream& s, CgenClassTableP ct)
+{
+  CgenEnvironment env(ct, this);
+  std::stringstream body;
+
+  if (parentnd->get_name() != No_class) {
+    body << JAL; emit_init_ref(parentnd->get_name(), body); body << std::endl;
+    emit_call_return(&env, body);
+  }
 
-void plus_class::code(ostream &s) {
+  for (int i = features->first(); features->more(i); i = features->next(i)) {
+    Feature f = features->nth(i);
+    if (f->is_method())
+      continue;
+    Expression init = ((attr_class *) f)->get_init();
+    if (init->is_no_expr())
+      continue;
+    init->code(body, &env);
+    int offset = attr_offset(f->get_name());
+    emit_store(ACC, offset, SELF, body);
+    emit_gc_assign_attr(SELF, offset, init, ct, body);
+  }
+  emit_move(ACC, SELF, body);
+
+  std::stringstream code;
+  emit_init_ref(name, code); code << LABEL;
+  emit_method_prologue(env.frame_locals(), env.saved_regs(), code);
+  code << body.str();
+  emit_method_epilogue(0, env.frame_locals(), env.saved_regs(), code);
+  ct->emit_code(code.str(), s);
+  emit_stack_maps(&env, 0);
 }
 
-void sub_class::code(ostream &s) {
+void CgenNode::code_methods(ostream& s, CgenClassTableP ct)
+{
+  for (int i = features->first(); features->more(i); i = features->next(i)) {
+    Feature f = features->nth(i);
+    if (f->is_method() && ((method_class *) f)->live) {
+      CgenEnvironment env(ct, this);
+      ((method_class *) f)->code(s, &env);
+    }
+  }
 }
 
-void mul_class::code(ostream &s) {
+//
+// The body is generated first so the prologue knows how many frame
+// slots and temporary registers it needs.
+//
+void method_class::code(ostream& s, CgenEnvironmentP env)
+{
+  int num_formals = formals->len();
+  std::stringstream body;
+
+  env->enterscope();
+  for (int i = formals->first(); formals->more(i); i = formals->next(i))
+    env->add_formal(formals->nth(i)->get_name(), i, num_formals);
+  if (cgen_optimize)
+    expr->code_tail(body, env);
+  else
+    expr->code(body, env);
+  env->exitscope();
+
+  std::stringstream code;
+  emit_method_ref(env->get_class()->get_name(), name, code); code << LABEL;
+  emit_method_prologue(env->frame_locals(), env->saved_regs(), code);
+  code << body.str();
+  emit_method_epilogue(num_formals, env->frame_locals(), env->saved_regs(), code);
+  for (auto& t : env->get_tail_calls())
+    emit_tail_call(t, num_formals, env->frame_locals(), env->saved_regs(), code);
+  env->get_classtable()->emit_code(code.str(), s);
+  emit_stack_maps(env, num_formals);
 }
 
-void divide_class::code(ostream &s) {
+///////////////////////////////////////////////////////////////////////
+//
+// CgenEnvironment methods
+//
+///////////////////////////////////////////////////////////////////////
+
+CgenEnvironment::CgenEnvironment(CgenClassTableP ct, CgenNodeP c) :
+   classtable(ct),
+   cls(c),
+   locals(0),
+   max_locals(0),
+   temps(0),
+   max_temps(0)
+{
+  vars.enterscope();
+  AllocScope alloc(var_location_allocs);
+  std::vector<attr_class *>& attrs = cls->get_attrs();
+  for (size_t i = 0; i < attrs.size(); i++)
+    vars.addid(attrs[i]->get_name(),
+               new VarLocation(SELF, DEFAULT_OBJFIELDS + i));
 }
 
-void neg_class::code(ostream &s) {
+void CgenEnvironment::add_formal(Symbol name, int index, int num_formals)
+{
+  AllocScope alloc(var_location_allocs);
+  vars.addid(name, new VarLocation(FP, num_formals - index));
 }
 
-void lt_class::code(ostream &s) {
+VarLocationP CgenEnvironment::add_local(Symbol name, bool unboxed)
+{
+  VarLocationP loc = alloc_local(unboxed);
+  vars.addid(name, loc);
+  return loc;
 }
 
-void eq_class::code(ostream &s) {
+int CgenEnvironment::add_tail_call(int nargs, Symbol impl, Symbol name)
+{
+  TailCall t = { next_label++, nargs, impl, name };
+  tail_calls.push_back(t);
+  classtable->count_tail_call();
+  return t.label;
 }
 
-void leq_class::code(ostream &s) {
+void CgenEnvironment::add_stack_map(ostream& s)
+{
+  StackMapSite m = { next_label++, locals,
+                     disable_reg_alloc ? 0 : std::min(temps, NUM_TEMP_REGS) };
+  emit_label_def(m.label, s);
+  stack_maps.push_back(m);
 }
 
-void comp_class::code(ostream &s) {
+VarLocationP CgenEnvironment::alloc_local(bool unboxed)
+{
+  AllocScope alloc(var_location_allocs);
+  VarLocationP loc = new VarLocation(FP, -3 - locals, unboxed);
+  if (++locals > max_locals)
+    max_locals = locals;
+  return loc;
 }
 
-void int_const_class::code(ostream& s)
+CgenNodeP CgenEnvironment::enter_inline(CgenNodeP c)
 {
-  //
-  // Need to be sure we have an IntEntry *, not an arbitrary Symbol
-  //
-  emit_load_int(ACC,inttable.lookup_string(token->get_string()),s);
+  CgenNodeP caller = cls;
+  cls = c;
+  vars.enterscope();
+  AllocScope alloc(var_location_allocs);
+  std::vector<attr_class *>& attrs = cls->get_attrs();
+  for (size_t i = 0; i < attrs.size(); i++)
+    vars.addid(attrs[i]->get_name(),
+               new VarLocation(SELF, DEFAULT_OBJFIELDS + i));
+  return caller;
 }
 
-void string_const_class::code(ostream& s)
+void CgenEnvironment::exit_inline(CgenNodeP caller)
 {
-  emit_load_string(ACC,stringtable.lookup_string(token->get_string()),s);
+  vars.exitscope();
+  cls = caller;
 }
 
-void bool_const_class::code(ostream& s)
+void CgenEnvironment::save_temp(ostream& s, Register src)
 {
-  emit_load_bool(ACC, BoolConst(val), s);
+  if (!disable_reg_alloc && temps < NUM_TEMP_REGS) {
+    emit_move(temp_regs[temps], src, s);
+    if (temps + 1 > max_temps)
+      max_temps = temps + 1;
+  } else {
+    emit_push(src, s);
+  }
+  temps++;
 }
 
-void new__class::code(ostream &s) {
+Register CgenEnvironment::release_temp(Register scratch, ostream& s)
+{
+  temps--;
+  if (!disable_reg_alloc && temps < NUM_TEMP_REGS)
+    return temp_regs[temps];
+  emit_addiu(SP, SP, 4, s);
+  emit_load(scratch, 0, SP, s);
+  return scratch;
 }
 
-void isvoid_class::code(ostream &s) {
+
+//******************************************************************
+//
+//   Code generation for expressions.  `code' leaves the value of the
+//   expression in ACC.  Intermediate values that must survive the
+//   evaluation of another subexpression are held in temporaries
+//   allocated from the environment (see CgenEnvironment::save_temp).
+//
+//   `code_unboxed' leaves the raw value of an Int or Bool in ACC.
+//   Arithmetic and comparisons work on raw values and box only the
+//   result their context needs; the default just unboxes `code'.
+//
+//*****************************************************************
+
+static bool is_unboxable(Symbol type)
+{
+  return type == Int || type == Bool;
 }
 
-void no_expr_class::code(ostream &s) {
+//
+// The collectors treat $s1-$s6 and every word of the stack as possible
+// pointers.  With a collector running, a raw value may only be held
+// across code that cannot allocate, and let variables stay boxed.
+//
+static bool raw_values_safe()
+{
+  return cgen_Memmgr == GC_NOGC;
 }
 
-void object_class::code(ostream &s) {
+void Expression_class::code_unboxed(ostream &s, CgenEnvironmentP env)
+{
+  code(s, env);
+  emit_fetch_int(ACC, ACC, s);
 }
 
+//
+// Box the raw value in ACC.  A Bool is one of the two constants, and so
+// is an Int in the small Int cache (see code_int_cache).  Other Ints are
+// a fresh copy of the prototype.  The raw value waits for the copy in
+// _int_scratch, which no collector looks at.
+//
+static void code_box(Symbol type, ostream &s, CgenEnvironmentP env)
+{
+  int done = next_label++;
+  if (type == Bool) {
+    emit_move(T1, ACC, s);
+    emit_load_bool(ACC, truebool, s);
+    emit_bne(T1, ZERO, done, s);
+    emit_load_bool(ACC, falsebool, s);
+    emit_label_def(done, s);
+    return;
+  }
+  int copy = next_label++;
+  emit_blti(ACC, INT_CACHE_MIN, copy, s);
+  emit_bgti(ACC, INT_CACHE_MAX, copy, s);
+  emit_sll(T1, ACC, 4, s);
+  emit_sll(T2, ACC, 2, s);
+  emit_addu(T1, T1, T2, s);
+  emit_load_address(ACC, INT_CACHE, s);
+  emit_addu(ACC, ACC, T1, s);
+  emit_branch(done, s);
+  emit_label_def(copy, s);
+  s << SW << ACC << " " << INT_SCRATCH << std::endl;
+  emit_partial_load_address(ACC, s); emit_protobj_ref(Int, s); s << std::endl;
+  emit_jal("Object.copy", s);
+  emit_call_return(env, s);
+  s << LW << T1 << " " << INT_SCRATCH << std::endl;
+  emit_store_int(T1, ACC, s);
+  emit_label_def(done, s);
+}
+
+//
+// Int results are computed unboxed and then boxed.
+//
+static void code_boxed_int(Expression e, ostream &s, CgenEnvironmentP env)
+{
+  e->code_unboxed(s, env);
+  code_box(Int, s, env);
+}
+
+//
+// Evaluate an expression whose value is not used.  Statements such as
+// `i <- i + 1' then never box their result.
+//
+void Expression_class::code_tail(ostream &s, CgenEnvironmentP env)
+{
+  code(s, env);
+}
+
+void Expression_class::code_discard(ostream &s, CgenEnvironmentP env)
+{
+  if (is_unboxable(get_type()) && has_unboxed_code())
+    code_unboxed(s, env);
+  else
+    code(s, env);
+}
+
+void assign_class::code(ostream &s, CgenEnvironmentP env) {
+  VarLocationP loc = env->lookup(name);
+  if (loc->unboxed) {
+    expr->code_unboxed(s, env);
+    emit_store(ACC, loc->offset, loc->base, s);
+    code_steps(s, env);
+    code_box(get_type(), s, env);
+    return;
+  }
+  expr->code(s, env);
+  emit_store(ACC, loc->offset, loc->base, s);
+  emit_gc_assign_attr(loc->base, loc->offset, expr, env->get_classtable(), s);
+  code_steps(s, env);
+}
+
+//
+// Steps the strength reduced variables that follow this variable.  They
+// wrap around like the multiplications they replace.
+//
+void assign_class::code_steps(ostream &s, CgenEnvironmentP env) {
+  for (auto& d : derived) {
+    VarLocationP loc = env->lookup(d.first);
+    emit_load(T1, loc->offset, loc->base, s);
+    if (d.second >= -32768 && d.second < 32768)
+      emit_addiu(T1, T1, d.second, s);
+    else {
+      emit_load_imm(T2, d.second, s);
+      emit_addu(T1, T1, T2, s);
+    }
+    emit_store(T1, loc->offset, loc->base, s);
+  }
+}
+
+void assign_class::code_discard(ostream &s, CgenEnvironmentP env) {
+  if (env->lookup(name)->unboxed)
+    code_unboxed(s, env);
+  else
+    code(s, env);
+}
+
+void assign_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  VarLocationP loc = env->lookup(name);
+  if (!loc->unboxed) {
+    Expression_class::code_unboxed(s, env);
+    return;
+  }
+  expr->code_unboxed(s, env);
+  emit_store(ACC, loc->offset, loc->base, s);
+  code_steps(s, env);
+}
+
+//
+// Arguments are pushed left to right, then the receiver is evaluated and
+// checked for void.  Dispatch goes through the dispatch table of the
+// receiver (dynamic) or of the named class (static).
+//
+static void code_actuals(Expressions actual, ostream &s, CgenEnvironmentP env)
+{
+  for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
+    actual->nth(i)->code(s, env);
+    emit_push(ACC, s);
+  }
+}
+
+static void emit_void_dispatch_check(CgenEnvironmentP env, int line, ostream &s)
+{
+  int ok = next_label++;
+  emit_bne(ACC, ZERO, ok, s);
+  emit_abort("_dispatch_abort", env->get_filename(), line, s);
+  emit_label_def(ok, s);
+}
+
+static void emit_direct_call(Symbol classname, Symbol methodname, ostream &s)
+{
+  s << JAL; emit_method_ref(classname, methodname, s); s << std::endl;
+}
+
+//
+// self, a new object and the basic values can never be void.
+//
+static bool never_void(Expression e)
+{
+  Symbol type = e->get_type();
+  return e->is_self() || e->exact_type() != NULL ||
+         type == Int || type == Bool || type == Str;
+}
+
+//
+// An inlined call evaluates the arguments into fresh frame slots, then
+// the receiver, which replaces self while the callee's body runs.  The
+// void check is the same as for a real call.
+//
+static void code_inline(Expression receiver, Expressions actual, CgenNodeP cls,
+                        method_class *m, int line, bool unboxed,
+                        ostream &s, CgenEnvironmentP env)
+{
+  std::vector<VarLocationP> slots;
+  for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
+    actual->nth(i)->code(s, env);
+    VarLocationP slot = env->alloc_local();
+    emit_store(ACC, slot->offset, slot->base, s);
+    slots.push_back(slot);
+  }
+
+  bool switch_self = !receiver->is_self();
+  if (switch_self) {
+    receiver->code(s, env);
+    if (!never_void(receiver))
+      emit_void_dispatch_check(env, line, s);
+    env->save_temp(s, SELF);
+    emit_move(SELF, ACC, s);
+  }
+
+  Expression body = m->get_expr();
+  CgenNodeP caller = env->enter_inline(cls);
+  Formals formals = m->get_formals();
+  for (int i = formals->first(); formals->more(i); i = formals->next(i))
+    env->bind(formals->nth(i)->get_name(), slots[i]);
+  if (unboxed)
+    body->code_unboxed(s, env);
+  else
+    body->code(s, env);
+  env->exit_inline(caller);
+
+  if (switch_self) {
+    Register saved = env->release_temp(T1, s);
+    emit_move(SELF, saved, s);
+  }
+  for (size_t i = 0; i < slots.size(); i++)
+    env->remove_local();
+}
+
+//
+// Generates a call of `name' on a receiver of static class `cls'.
+// `impl' is the class whose method is called when that is known
+// statically; small bodies are then inlined.  Otherwise the call goes
+// through the receiver's dispatch table.  A `tail' call, whose value the
+// method returns, jumps instead (see emit_tail_call).
+//
+static void code_call(Expression receiver, Expressions actual, Symbol name,
+                      CgenNodeP cls, Symbol impl, int line, bool unboxed,
+                      bool tail, ostream &s, CgenEnvironmentP env)
+{
+  CgenClassTableP ct = env->get_classtable();
+  if (impl != NULL) {
+    CgenNodeP impl_cls = ct->probe(impl);
+    method_class *m = impl_cls->get_methods()[impl_cls->method_offset(name)].second;
+    if (!impl_cls->coded_elsewhere() && m->get_expr()->inline_cost() <= INLINE_LIMIT) {
+      ct->count_inlined();
+      code_inline(receiver, actual, impl_cls, m, line, unboxed, s, env);
+      return;
+    }
+  }
+
+  code_actuals(actual, s, env);
+  receiver->code(s, env);
+  if (!never_void(receiver))
+    emit_void_dispatch_check(env, line, s);
+
+  if (impl == Str && name == length)
+    // String.length returns the String's length attribute.
+    emit_load(ACC, DEFAULT_OBJFIELDS, ACC, s);
+  else if (tail) {
+    if (impl == NULL) {
+      emit_load(T1, DISPTABLE_OFFSET, ACC, s);
+      emit_load(T1, cls->method_offset(name), T1, s);
+    }
+    emit_branch(env->add_tail_call(actual->len(), impl, name), s);
+  } else if (impl != NULL) {
+    emit_direct_call(impl, name, s);
+    emit_call_return(env, s);
+  } else {
+    emit_load(T1, DISPTABLE_OFFSET, ACC, s);
+    emit_load(T1, cls->method_offset(name), T1, s);
+    emit_jalr(T1, s);
+    emit_call_return(env, s);
+  }
+  if (unboxed)
+    emit_fetch_int(ACC, ACC, s);
+}
+
+//
+// Static dispatch always calls the method the named class has.
+//
+void static_dispatch_class::code(ostream &s, CgenEnvironmentP env) {
+  CgenNodeP cls = env->get_classtable()->probe(type_name);
+  code_call(expr, actual, name, cls, cls->method_class_of(name), line_number,
+            false, false, s, env);
+}
+
+void static_dispatch_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  CgenNodeP cls = env->get_classtable()->probe(type_name);
+  code_call(expr, actual, name, cls, cls->method_class_of(name), line_number,
+            true, false, s, env);
+}
+
+void static_dispatch_class::code_tail(ostream &s, CgenEnvironmentP env) {
+  CgenNodeP cls = env->get_classtable()->probe(type_name);
+  code_call(expr, actual, name, cls, cls->method_class_of(name), line_number,
+            false, true, s, env);
+}
+
+//
+// Class hierarchy analysis: when no subclass of the receiver's static
+// type overrides the method, every receiver reaches the same code and
+// the call is made directly.  The exact class of a new object is known.
+// A module cannot know the subclasses programs will add.
+//
+static Symbol dispatch_target(Expression receiver, Symbol name, CgenNodeP cls,
+                              CgenClassTableP ct)
+{
+  Symbol impl = NULL;
+  if (receiver->exact_type() != NULL)
+    impl = ct->probe(receiver->exact_type())->method_class_of(name);
+  else if (!ct->is_module())
+    impl = cls->unique_impl(name);
+  ct->count_dispatch(impl != NULL);
+  return impl;
+}
+
+static CgenNodeP receiver_class(Expression receiver, CgenEnvironmentP env)
+{
+  Symbol type = receiver->get_type();
+  if (type == SELF_TYPE)
+    return env->get_class();
+  return env->get_classtable()->probe(type);
+}
+
+void dispatch_class::code(ostream &s, CgenEnvironmentP env) {
+  CgenNodeP cls = receiver_class(expr, env);
+  Symbol impl = dispatch_target(expr, name, cls, env->get_classtable());
+  code_call(expr, actual, name, cls, impl, line_number, false, false, s, env);
+}
+
+void dispatch_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  CgenNodeP cls = receiver_class(expr, env);
+  Symbol impl = dispatch_target(expr, name, cls, env->get_classtable());
+  code_call(expr, actual, name, cls, impl, line_number, true, false, s, env);
+}
+
+void dispatch_class::code_tail(ostream &s, CgenEnvironmentP env) {
+  CgenNodeP cls = receiver_class(expr, env);
+  Symbol impl = dispatch_target(expr, name, cls, env->get_classtable());
+  code_call(expr, actual, name, cls, impl, line_number, false, true, s, env);
+}
+
+void cond_class::code(ostream &s, CgenEnvironmentP env) {
+  int else_label = next_label++;
+  int end_label = next_label++;
+
+  pred->code_unboxed(s, env);
+  emit_beqz(ACC, else_label, s);
+  then_exp->code(s, env);
+  emit_branch(end_label, s);
+  emit_label_def(else_label, s);
+  else_exp->code(s, env);
+  emit_label_def(end_label, s);
+}
+
+void cond_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  int else_label = next_label++;
+  int end_label = next_label++;
+
+  pred->code_unboxed(s, env);
+  emit_beqz(ACC, else_label, s);
+  then_exp->code_unboxed(s, env);
+  emit_branch(end_label, s);
+  emit_label_def(else_label, s);
+  else_exp->code_unboxed(s, env);
+  emit_label_def(end_label, s);
+}
+
+void cond_class::code_tail(ostream &s, CgenEnvironmentP env) {
+  int else_label = next_label++;
+  int end_label = next_label++;
+
+  pred->code_unboxed(s, env);
+  emit_beqz(ACC, else_label, s);
+  then_exp->code_tail(s, env);
+  emit_branch(end_label, s);
+  emit_label_def(else_label, s);
+  else_exp->code_tail(s, env);
+  emit_label_def(end_label, s);
+}
+
+//
+// Loop invariants are computed into frame slots first, unboxed where
+// raw values are safe.
+//
+void loop_class::code(ostream &s, CgenEnvironmentP env) {
+  int start_label = next_label++;
+  int end_label = next_label++;
+
+  env->enterscope();
+  for (auto& inv : invariants) {
+    bool unboxed = raw_values_safe() && is_unboxable(inv.second->get_type());
+    if (unboxed)
+      inv.second->code_unboxed(s, env);
+    else
+      inv.second->code(s, env);
+    VarLocationP loc = env->add_local(inv.first, unboxed);
+    emit_store(ACC, loc->offset, loc->base, s);
+  }
+
+  emit_label_def(start_label, s);
+  pred->code_unboxed(s, env);
+  emit_beqz(ACC, end_label, s);
+  body->code_discard(s, env);
+  emit_branch(start_label, s);
+  emit_label_def(end_label, s);
+  emit_move(ACC, ZERO, s);
+
+  for (size_t i = 0; i < invariants.size(); i++)
+    env->remove_local();
+  env->exitscope();
+}
+
+//
+// Branches are tested in order of decreasing tag.  A subclass always has
+// a larger tag than its ancestors, so the first match is the closest.
+//
+void typcase_class::code(ostream &s, CgenEnvironmentP env) {
+  code_case(s, env, false);
+}
+
+void typcase_class::code_tail(ostream &s, CgenEnvironmentP env) {
+  code_case(s, env, true);
+}
+
+void typcase_class::code_case(ostream &s, CgenEnvironmentP env, bool tail) {
+  CgenClassTableP ct = env->get_classtable();
+  int nonvoid_label = next_label++;
+  int end_label = next_label++;
+
+  expr->code(s, env);
+  emit_bne(ACC, ZERO, nonvoid_label, s);
+  emit_abort("_case_abort2", env->get_filename(), line_number, s);
+  emit_label_def(nonvoid_label, s);
+  emit_load(T2, TAG_OFFSET, ACC, s);
+
+  std::vector<Case> branches;
+  for (int i = cases->first(); cases->more(i); i = cases->next(i))
+    branches.push_back(cases->nth(i));
+  std::sort(branches.begin(), branches.end(), [ct](Case a, Case b) {
+    return ct->get_tag(a->get_type_decl()) > ct->get_tag(b->get_type_decl());
+  });
+
+  for (auto b : branches) {
+    CgenNodeP cls = ct->probe(b->get_type_decl());
+    int next_label_ = next_label++;
+    if (ct->is_module()) {
+      // the range is in the program's <class>_tags
+      emit_partial_load_address(T3, s); emit_tags_ref(cls->get_name(), s); s << std::endl;
+      emit_load(T1, 0, T3, s);
+      emit_blt(T2, T1, next_label_, s);
+      emit_load(T1, 1, T3, s);
+      emit_blt(T1, T2, next_label_, s);
+    } else {
+      emit_blti(T2, cls->get_tag(), next_label_, s);
+      emit_bgti(T2, cls->get_max_tag(), next_label_, s);
+    }
+
+    env->enterscope();
+    VarLocationP loc = env->add_local(b->get_name());
+    emit_store(ACC, loc->offset, loc->base, s);
+    if (tail)
+      b->get_expr()->code_tail(s, env);
+    else
+      b->get_expr()->code(s, env);
+    env->remove_local();
+    env->exitscope();
+    emit_branch(end_label, s);
+    emit_label_def(next_label_, s);
+  }
+
+  emit_jal("_case_abort", s);
+  emit_label_def(end_label, s);
+}
+
+void block_class::code(ostream &s, CgenEnvironmentP env) {
+  for (int i = body->first(); body->more(i); i = body->next(i)) {
+    if (body->more(body->next(i)))
+      body->nth(i)->code_discard(s, env);
+    else
+      body->nth(i)->code(s, env);
+  }
+}
+
+void block_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  for (int i = body->first(); body->more(i); i = body->next(i)) {
+    if (body->more(body->next(i)))
+      body->nth(i)->code_discard(s, env);
+    else
+      body->nth(i)->code_unboxed(s, env);
+  }
+}
+
+void block_class::code_tail(ostream &s, CgenEnvironmentP env) {
+  for (int i = body->first(); body->more(i); i = body->next(i)) {
+    if (body->more(body->next(i)))
+      body->nth(i)->code_discard(s, env);
+    else
+      body->nth(i)->code_tail(s, env);
+  }
+}
+
+//
+// Evaluates the initializer and binds the variable in a new scope; the
+// caller generates the body and closes the scope.
+//
+void let_class::code_bind(ostream &s, CgenEnvironmentP env) {
+  if (unboxed) {
+    if (init->is_no_expr())
+      emit_load_imm(ACC, 0, s);
+    else
+      init->code_unboxed(s, env);
+  } else if (init->is_no_expr())
+    emit_default_value(ACC, type_decl, s);
+  else
+    init->code(s, env);
+
+  env->enterscope();
+  VarLocationP loc = env->add_local(identifier, unboxed);
+  emit_store(ACC, loc->offset, loc->base, s);
+}
+
+void let_class::code(ostream &s, CgenEnvironmentP env) {
+  code_bind(s, env);
+  body->code(s, env);
+  env->remove_local();
+  env->exitscope();
+}
+
+void let_class::code_tail(ostream &s, CgenEnvironmentP env) {
+  code_bind(s, env);
+  body->code_tail(s, env);
+  env->remove_local();
+  env->exitscope();
+}
+
+void let_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  code_bind(s, env);
+  body->code_unboxed(s, env);
+  env->remove_local();
+  env->exitscope();
+}
+
+//
+// Evaluates the operands of an Int or Bool operator unboxed, leaving one
+// raw value in ACC and the other in the returned register.  The operand
+// needing more temporaries is evaluated first when the order cannot be
+// seen (Sethi-Ullman): both are pure and at most one may fail, so the
+// failure reported is the one left-to-right order would meet.  Otherwise
+// that order is kept, and `swapped' tells whether ACC holds e1.  If a
+// raw value may not be held while e2 is evaluated (see raw_values_safe),
+// e1 is held boxed instead.
+//
+static bool swappable(Expression e1, Expression e2)
+{
+  return e1->is_pure() && e2->is_pure() && (e1->is_total() || e2->is_total());
+}
+
+static Register code_operands(Expression e1, Expression e2, bool& swapped,
+                              ostream &s, CgenEnvironmentP env)
+{
+  swapped = swappable(e1, e2) && e2->temps_needed() > e1->temps_needed();
+  bool hold_raw = raw_values_safe() || e2->is_pure() || swapped;
+
+  Expression first = swapped ? e2 : e1;
+  if (hold_raw)
+    first->code_unboxed(s, env);
+  else
+    first->code(s, env);
+  env->save_temp(s);
+  (swapped ? e1 : e2)->code_unboxed(s, env);
+
+  Register held = env->release_temp(T2, s);
+  if (!hold_raw) {
+    emit_fetch_int(T2, held, s);
+    held = T2;
+  }
+  return held;
+}
+
+static int binary_temps(Expression e1, Expression e2)
+{
+  int n1 = e1->temps_needed();
+  int n2 = e2->temps_needed();
+  if (swappable(e1, e2) && n2 > n1)
+    return std::max(n2, n1 + 1);
+  return std::max(n1, n2 + 1);
+}
+
+//
+// Operators on raw values: the result of `emit_op e1 e2' goes to ACC.
+//
+typedef void (*arith_emitter)(const char *, const char *, const char *, ostream&);
+
+static void code_arith(Expression e1, Expression e2, arith_emitter emit_op,
+                       ostream &s, CgenEnvironmentP env)
+{
+  bool swapped;
+  Register held = code_operands(e1, e2, swapped, s, env);
+  if (swapped)
+    emit_op(ACC, ACC, held, s);
+  else
+    emit_op(ACC, held, ACC, s);
+}
+
+void plus_class::code(ostream &s, CgenEnvironmentP env) {
+  code_boxed_int(this, s, env);
+}
+
+void plus_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  code_arith(e1, e2, emit_add, s, env);
+}
+
+void sub_class::code(ostream &s, CgenEnvironmentP env) {
+  code_boxed_int(this, s, env);
+}
+
+void sub_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  code_arith(e1, e2, emit_sub, s, env);
+}
+
+void mul_class::code(ostream &s, CgenEnvironmentP env) {
+  code_boxed_int(this, s, env);
+}
+
+void mul_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  code_arith(e1, e2, emit_mul, s, env);
+}
+
+void divide_class::code(ostream &s, CgenEnvironmentP env) {
+  code_boxed_int(this, s, env);
+}
+
+void divide_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  code_arith(e1, e2, emit_div, s, env);
+}
+
+void neg_class::code(ostream &s, CgenEnvironmentP env) {
+  code_boxed_int(this, s, env);
+}
+
+void neg_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  e1->code_unboxed(s, env);
+  emit_neg(ACC, ACC, s);
+}
+
+//
+// A comparison whose result is needed as an object branches straight to
+// one of the two Bool constants.
+//
+typedef void (*branch_emitter)(const char *, const char *, int, ostream&);
+
+static void code_compare(Expression e1, Expression e2, branch_emitter emit_branch_if,
+                         ostream &s, CgenEnvironmentP env)
+{
+  bool swapped;
+  Register held = code_operands(e1, e2, swapped, s, env);
+  emit_move(T1, ACC, s);
+
+  int done = next_label++;
+  emit_load_bool(ACC, truebool, s);
+  if (swapped)
+    emit_branch_if(T1, held, done, s);
+  else
+    emit_branch_if(held, T1, done, s);
+  emit_load_bool(ACC, falsebool, s);
+  emit_label_def(done, s);
+}
+
+void lt_class::code(ostream &s, CgenEnvironmentP env) {
+  code_compare(e1, e2, emit_blt, s, env);
+}
+
+void lt_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  code_arith(e1, e2, emit_slt, s, env);
+}
+
+void leq_class::code(ostream &s, CgenEnvironmentP env) {
+  code_compare(e1, e2, emit_bleq, s, env);
+}
+
+void leq_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  code_arith(e1, e2, emit_sle, s, env);
+}
+
+//
+// Ints and Bools are compared by value.  Otherwise equal pointers are
+// equal objects, and the runtime compares the values of Strings.
+// Equality is symmetric, so the operand order does not matter here.
+//
+void eq_class::code(ostream &s, CgenEnvironmentP env) {
+  if (is_unboxable(e1->get_type())) {
+    code_compare(e1, e2, emit_beq, s, env);
+    return;
+  }
+
+  e1->code(s, env);
+  env->save_temp(s);
+  e2->code(s, env);
+  Register held = env->release_temp(T2, s);
+  if (held != T2)
+    emit_move(T2, held, s);
+  emit_move(T1, ACC, s);
+
+  int done = next_label++;
+  emit_load_bool(ACC, truebool, s);
+  emit_beq(T1, T2, done, s);
+  emit_load_bool(A1, falsebool, s);
+  emit_jal("equality_test", s);
+  emit_label_def(done, s);
+}
+
+void eq_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  if (is_unboxable(e1->get_type()))
+    code_arith(e1, e2, emit_seq, s, env);
+  else
+    Expression_class::code_unboxed(s, env);
+}
+
+void comp_class::code(ostream &s, CgenEnvironmentP env) {
+  e1->code_unboxed(s, env);
+  emit_move(T1, ACC, s);
+
+  int done = next_label++;
+  emit_load_bool(ACC, truebool, s);
+  emit_beqz(T1, done, s);
+  emit_load_bool(ACC, falsebool, s);
+  emit_label_def(done, s);
+}
+
+void comp_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  e1->code_unboxed(s, env);
+  emit_xori(ACC, ACC, 1, s);
+}
+
+void int_const_class::code(ostream& s, CgenEnvironmentP env)
+{
+  //
+  // Need to be sure we have an IntEntry *, not an arbitrary Symbol
+  //
+  emit_load_int(ACC,inttable.lookup_string(token->get_string()),s);
+}
+
+void int_const_class::code_unboxed(ostream& s, CgenEnvironmentP env)
+{
+  emit_load_imm(ACC, atoi(token->get_string()), s);
+}
+
+void string_const_class::code(ostream& s, CgenEnvironmentP env)
+{
+  emit_load_string(ACC,stringtable.lookup_string(token->get_string()),s);
+}
+
+void bool_const_class::code(ostream& s, CgenEnvironmentP env)
+{
+  emit_load_bool(ACC, BoolConst(val), s);
+}
+
+void bool_const_class::code_unboxed(ostream& s, CgenEnvironmentP env)
+{
+  emit_load_imm(ACC, val, s);
+}
+
+//
+// new SELF_TYPE finds the prototype and initializer of the dynamic class
+// of self in class_objTab, which has two words per tag.
+//
+void new__class::code(ostream &s, CgenEnvironmentP env) {
+  // The basic values are immutable, so their defaults can be shared.
+  if (type_name == Int) {
+    emit_load_address(ACC, INT_CACHE, s);
+    return;
+  }
+  if (type_name == Bool) {
+    emit_load_bool(ACC, falsebool, s);
+    return;
+  }
+  if (type_name == Str) {
+    emit_load_string(ACC, stringtable.lookup_string(""), s);
+    return;
+  }
+  if (type_name != SELF_TYPE) {
+    emit_partial_load_address(ACC, s); emit_protobj_ref(type_name, s); s << std::endl;
+    emit_jal("Object.copy", s);
+    emit_call_return(env, s);
+    s << JAL; emit_init_ref(type_name, s); s << std::endl;
+    emit_call_return(env, s);
+    return;
+  }
+
+  emit_load_address(T1, CLASSOBJTAB, s);
+  emit_load(T2, TAG_OFFSET, SELF, s);
+  emit_sll(T2, T2, LOG_WORD_SIZE + 1, s);
+  emit_addu(ACC, T1, T2, s);
+  env->save_temp(s);
+  emit_load(ACC, 0, ACC, s);
+  emit_jal("Object.copy", s);
+  emit_call_return(env, s);
+  Register entry = env->release_temp(T1, s);
+  emit_load(T1, 1, entry, s);
+  emit_jalr(T1, s);
+  emit_call_return(env, s);
+}
+
+void isvoid_class::code(ostream &s, CgenEnvironmentP env) {
+  e1->code(s, env);
+  emit_move(T1, ACC, s);
+
+  int done = next_label++;
+  emit_load_bool(ACC, truebool, s);
+  emit_beqz(T1, done, s);
+  emit_load_bool(ACC, falsebool, s);
+  emit_label_def(done, s);
+}
+
+void no_expr_class::code(ostream &s, CgenEnvironmentP env) {
+  emit_move(ACC, ZERO, s);
+}
+
+void object_class::code(ostream &s, CgenEnvironmentP env) {
+  if (name == self) {
+    emit_move(ACC, SELF, s);
+    return;
+  }
+  VarLocationP loc = env->lookup(name);
+  emit_load(ACC, loc->offset, loc->base, s);
+  if (loc->unboxed)
+    code_box(get_type(), s, env);
+}
+
+bool object_class::is_self() { return name == self; }
+
+Symbol new__class::exact_type()
+{
+  return type_name == SELF_TYPE ? NULL : type_name;
+}
+
+bool new__class::is_constant_object()
+{
+  return type_name == Int || type_name == Bool || type_name == Str;
+}
+
+void object_class::code_unboxed(ostream &s, CgenEnvironmentP env) {
+  VarLocationP loc = env->lookup(name);
+  emit_load(ACC, loc->offset, loc->base, s);
+  if (!loc->unboxed)
+    emit_fetch_int(ACC, ACC, s);
+}
+
+//******************************************************************
+//
+//   Constant folding and propagation.  Only rewrites that keep the
+//   static type of the node are made, so code generation sees the same
+//   types as before.  Arithmetic that would overflow or divide by zero
+//   is left for the program to report at run time.
+//
+//*****************************************************************
+
+Expression ConstantFolder::run(Expression e)
+{
+  assigned.clear();
+  for (propagate = false; ; propagate = true) {
+    enterscope();
+    e = e->fold(this);
+    exitscope();
+    if (propagate || !scanned)
+      return e;
+  }
+}
+
+void ConstantFolder::bind(Symbol name, Expression value)
+{
+  scope.addid(name, value);
+  depth.addid(name, new int(loops.size()));
+}
+
+Symbol ConstantFolder::fresh_name()
+{
+  std::string name = "_loop" + std::to_string(hoisted + reduced);
+  return idtable.add_string((char *) name.c_str());
+}
+
+//
+// Names bound by a let or case are in `depth', with the number of loops
+// around the binding; formals and attributes are not.
+//
+bool ConstantFolder::is_invariant(Expression e)
+{
+  int i;
+  bool b;
+  if (e->int_value(i) || e->bool_value(b) || e->string_value() != NULL)
+    return true;
+  Symbol name = e->variable();
+  if (name == NULL)
+    return false;
+  if (name == self)
+    return true;
+  int *d = depth.lookup(name);
+  if (d != NULL)
+    return *d < (int) loops.size() && !assigned.count(name);
+  return !assigned_anywhere.count(name);
+}
+
+//
+// Induction variables are let variables bound outside the loop whose
+// only assignment is a statement of the loop body.  Strength reduced
+// variables live unboxed, so this needs raw_values_safe.
+//
+void ConstantFolder::enter_loop(loop_class *l)
+{
+  Loop loop = { l, conditional, effects, std::vector<Induction>() };
+  if (propagate && raw_values_safe()) {
+    std::vector<Expression> stmts;
+    l->get_body()->statements(stmts);
+    for (auto stmt : stmts) {
+      Induction ind;
+      ind.update = stmt->induction_step(ind.var, ind.step);
+      int *d = ind.update != NULL ? depth.lookup(ind.var) : NULL;
+      if (d != NULL && *d <= (int) loops.size() && assigned[ind.var] == 1)
+        loop.inductions.push_back(ind);
+    }
+  }
+  loops.push_back(loop);
+}
+
+Expression ConstantFolder::hoist(Expression e, bool total, Expression e1,
+                                 Expression e2)
+{
+  if (!propagate || loops.empty() ||
+      (!total && (conditional != loops.back().conditional ||
+                  effects != loops.back().effects)) ||
+      !is_invariant(e1) || (e2 != NULL && !is_invariant(e2))) {
+    if (!total)
+      effect();
+    return e;
+  }
+  Symbol var = fresh_name();
+  loops.back().loop->invariants.push_back(std::make_pair(var, e));
+  hoisted++;
+  Expression ref = object(var);
+  ref->set(e);
+  return ref->set_type(e->get_type());
+}
+
+Expression ConstantFolder::reduce(Expression e, Symbol var, int k)
+{
+  for (auto l = loops.rbegin(); l != loops.rend(); l++)
+    for (auto& ind : l->inductions) {
+      if (ind.var != var)
+        continue;
+      Symbol& t = ind.derived[k];
+      if (t == NULL) {
+        t = fresh_name();
+        assigned_anywhere.insert(t);    // stepped each iteration
+        Expression init = mul(object(var)->set_type(Int),
+                              int_const(inttable.add_int(k))->set_type(Int));
+        l->loop->invariants.push_back(std::make_pair(t, init->set_type(Int)));
+        int step = (int) (unsigned) ((long long) ind.step * k);
+        ind.update->derived.push_back(std::make_pair(t, step));
+      }
+      reduced++;
+      Expression ref = object(t);
+      ref->set(e);
+      return ref->set_type(Int);
+    }
+  return e;
+}
+
+void method_class::fold_constants(ConstantFolderP cf)
+{
+  expr = cf->run(expr);
+}
+
+void attr_class::fold_constants(ConstantFolderP cf)
+{
+  init = cf->run(init);
+}
+
+static Expression int_result(long long v, Expression at, ConstantFolderP cf)
+{
+  if (v < INT32_MIN || v > INT32_MAX)
+    return at;
+  Expression e = int_const(inttable.add_int((int) v));
+  e->set(at);
+  return cf->replace(e->set_type(Int));
+}
+
+static Expression bool_result(bool v, Expression at, ConstantFolderP cf)
+{
+  Expression e = bool_const(v);
+  e->set(at);
+  return cf->replace(e->set_type(Bool));
+}
+
+static Expression string_result(const std::string& v, Expression at,
+                                ConstantFolderP cf)
+{
+  Expression e = string_const(stringtable.add_string((char *) v.c_str()));
+  e->set(at);
+  return cf->replace(e->set_type(Str));
+}
+
+static Expressions fold(Expressions es, ConstantFolderP cf)
+{
+  Expressions out = nil_Expressions();
+  for (int i = es->first(); es->more(i); i = es->next(i))
+    out = append_Expressions(out, single_Expressions(es->nth(i)->fold(cf)));
+  return out;
+}
+
+bool int_const_class::int_value(int& v)
+{
+  v = atoi(token->get_string());
+  return true;
+}
+
+Expression assign_class::fold(ConstantFolderP cf) {
+  cf->assign(name);
+  expr = expr->fold(cf);
+  cf->effect();
+  return this;
+}
+
+assign_class *assign_class::induction_step(Symbol& var, int& step) {
+  var = name;
+  return expr->increment_of(name, step) ? this : NULL;
+}
+
+bool plus_class::increment_of(Symbol var, int& step) {
+  return (e1->variable() == var && e2->int_value(step)) ||
+         (e2->variable() == var && e1->int_value(step));
+}
+
+bool sub_class::increment_of(Symbol var, int& step) {
+  if (e1->variable() != var || !e2->int_value(step) || step == INT32_MIN)
+    return false;
+  step = -step;
+  return true;
+}
+
+void block_class::statements(std::vector<Expression>& s) {
+  for (int i = body->first(); body->more(i); i = body->next(i))
+    s.push_back(body->nth(i));
+}
+
+//
+// The actuals of a dispatch are evaluated before the receiver.
+//
+Expression static_dispatch_class::fold(ConstantFolderP cf) {
+  actual = ::fold(actual, cf);
+  expr = expr->fold(cf);
+  cf->effect();
+  return this;
+}
+
+//
+// The length of a String is its length attribute, which never changes.  The
+// receiver may be void, so this is not total.
+//
+static Expression hoist_length(Expression e, Expression receiver, Symbol name,
+                               Expressions actual, ConstantFolderP cf)
+{
+  if (name == length && actual->len() == 0 && receiver->get_type() == Str &&
+      receiver->variable() != NULL)
+    return cf->hoist(e, false, receiver);
+  cf->effect();
+  return e;
+}
+
+//
+// String cannot be inherited from, so the methods of a String constant
+// are known and can be evaluated.  substr is left alone if it would
+// abort.
+//
+Expression dispatch_class::fold(ConstantFolderP cf) {
+  actual = ::fold(actual, cf);
+  expr = expr->fold(cf);
+
+  Symbol str = expr->string_value();
+  if (str == NULL)
+    return hoist_length(this, expr, name, actual, cf);
+  std::string s(str->get_string(), str->get_len());
+  int nargs = actual->len();
+  Symbol arg_str = nargs > 0 ? actual->nth(0)->string_value() : NULL;
+  int i, l;
+
+  if (name == length && nargs == 0)
+    return int_result(s.size(), this, cf);
+  if (name == concat && nargs == 1 && arg_str != NULL)
+    return string_result(s + std::string(arg_str->get_string(), arg_str->get_len()),
+                         this, cf);
+  if (name == substr && nargs == 2 &&
+      actual->nth(0)->int_value(i) && actual->nth(1)->int_value(l) &&
+      i >= 0 && l >= 0 && (size_t) i + l <= s.size())
+    return string_result(s.substr(i, l), this, cf);
+  cf->effect();
+  return this;
+}
+
+Expression cond_class::fold(ConstantFolderP cf) {
+  pred = pred->fold(cf);
+  cf->enter_conditional();
+  then_exp = then_exp->fold(cf);
+  else_exp = else_exp->fold(cf);
+  cf->exit_conditional();
+
+  bool b;
+  if (!pred->bool_value(b))
+    return this;
+  Expression taken = b ? then_exp : else_exp;
+  return taken->get_type() == type ? cf->replace(taken) : this;
+}
+
+//
+// `while false' never runs its body; like any loop its value is void.
+// A loop may not terminate, which counts as an effect.
+//
+Expression loop_class::fold(ConstantFolderP cf) {
+  cf->enter_loop(this);
+  pred = pred->fold(cf);
+  cf->enter_conditional();
+  body = body->fold(cf);
+  cf->exit_conditional();
+  cf->exit_loop();
+  cf->effect();
+
+  bool b;
+  if (!pred->bool_value(b) || b)
+    return this;
+  Expression e = no_expr();
+  e->set(this);
+  return cf->replace(e->set_type(type));
+}
+
+void branch_class::fold(ConstantFolderP cf) {
+  cf->enterscope();
+  cf->bind(name, NULL);
+  expr = expr->fold(cf);
+  cf->exitscope();
+}
+
+Expression typcase_class::fold(ConstantFolderP cf) {
+  expr = expr->fold(cf);
+  cf->effect();
+  cf->enter_conditional();
+  for (int i = cases->first(); cases->more(i); i = cases->next(i))
+    ((branch_class *) cases->nth(i))->fold(cf);
+  cf->exit_conditional();
+  return this;
+}
+
+//
+// Statements other than the last are evaluated for their effects only,
+// so total ones are dropped.  A pure statement that may fail stays, as
+// its failure is an effect: { 1 / x; ... } must still stop on zero.
+//
+Expression block_class::fold(ConstantFolderP cf) {
+  Expressions out = nil_Expressions();
+  for (int i = body->first(); body->more(i); i = body->next(i)) {
+    Expression e = body->nth(i)->fold(cf);
+    if (body->more(body->next(i)) && e->is_total())
+      cf->replace(e);
+    else
+      out = append_Expressions(out, single_Expressions(e));
+  }
+  body = out;
+  return body->len() == 1 ? body->nth(0) : this;
+}
+
+static bool is_constant(Expression e)
+{
+  int i;
+  bool b;
+  return e->int_value(i) || e->bool_value(b) || e->string_value() != NULL;
+}
+
+//
+// A let whose variable is never assigned and starts out as a constant of
+// its declared type disappears; its uses become copies of the constant.
+// Without an initializer Int, Bool and String variables start out as 0,
+// false and "".
+//
+Expression let_class::fold(ConstantFolderP cf) {
+  init = init->fold(cf);
+
+  Expression value = NULL;
+  if (cf->propagating(identifier)) {
+    if (!init->is_no_expr())
+      value = init->get_type() == type_decl && is_constant(init) ? init : NULL;
+    else if (type_decl == Int)
+      value = int_const(inttable.add_int(0))->set_type(Int);
+    else if (type_decl == Bool)
+      value = bool_const(false)->set_type(Bool);
+    else if (type_decl == Str)
+      value = string_const(stringtable.add_string(""))->set_type(Str);
+  }
+  cf->enterscope();
+  cf->bind(identifier, value);
+  body = body->fold(cf);
+  cf->exitscope();
+  return value != NULL ? cf->replace(body) : this;
+}
+
+Expression plus_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  e2 = e2->fold(cf);
+  int a, b;
+  if (e1->int_value(a) && e2->int_value(b))
+    return int_result((long long) a + b, this, cf);
+  return cf->hoist(this, false, e1, e2);
+}
+
+Expression sub_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  e2 = e2->fold(cf);
+  int a, b;
+  if (e1->int_value(a) && e2->int_value(b))
+    return int_result((long long) a - b, this, cf);
+  return cf->hoist(this, false, e1, e2);
+}
+
+Expression mul_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  e2 = e2->fold(cf);
+  int a, b;
+  if (e1->int_value(a) && e2->int_value(b))
+    return int_result((long long) a * b, this, cf);
+  Expression reduced = this;
+  if (e1->variable() != NULL && e2->int_value(b))
+    reduced = cf->reduce(this, e1->variable(), b);
+  else if (e2->variable() != NULL && e1->int_value(a))
+    reduced = cf->reduce(this, e2->variable(), a);
+  return reduced != this ? reduced : cf->hoist(this, true, e1, e2);
+}
+
+Expression divide_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  e2 = e2->fold(cf);
+  int a, b;
+  if (e1->int_value(a) && e2->int_value(b) && b != 0)
+    return int_result((long long) a / b, this, cf);
+  return cf->hoist(this, e2->int_value(b) && b != 0 && b != -1, e1, e2);
+}
+
+Expression neg_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  int a;
+  if (e1->int_value(a))
+    return int_result(-(long long) a, this, cf);
+  return cf->hoist(this, false, e1);
+}
+
+Expression lt_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  e2 = e2->fold(cf);
+  int a, b;
+  if (e1->int_value(a) && e2->int_value(b))
+    return bool_result(a < b, this, cf);
+  return cf->hoist(this, true, e1, e2);
+}
+
+Expression leq_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  e2 = e2->fold(cf);
+  int a, b;
+  if (e1->int_value(a) && e2->int_value(b))
+    return bool_result(a <= b, this, cf);
+  return cf->hoist(this, true, e1, e2);
+}
+
+//
+// Equal strings are the same entry of the string table.
+//
+Expression eq_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  e2 = e2->fold(cf);
+  int a, b;
+  bool p, q;
+  if (e1->int_value(a) && e2->int_value(b))
+    return bool_result(a == b, this, cf);
+  if (e1->bool_value(p) && e2->bool_value(q))
+    return bool_result(p == q, this, cf);
+  if (e1->string_value() != NULL && e2->string_value() != NULL)
+    return bool_result(e1->string_value() == e2->string_value(), this, cf);
+  return cf->hoist(this, true, e1, e2);
+}
+
+Expression comp_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  bool b;
+  if (e1->bool_value(b))
+    return bool_result(!b, this, cf);
+  return cf->hoist(this, true, e1);
+}
+
+Expression isvoid_class::fold(ConstantFolderP cf) {
+  e1 = e1->fold(cf);
+  return is_constant(e1) ? bool_result(false, this, cf) : this;
+}
+
+Expression new__class::fold(ConstantFolderP cf) { cf->effect(); return this; }
+
+Expression int_const_class::fold(ConstantFolderP cf) { return this; }
+
+Expression bool_const_class::fold(ConstantFolderP cf) { return this; }
+
+Expression string_const_class::fold(ConstantFolderP cf) { return this; }
+
+Expression no_expr_class::fold(ConstantFolderP cf) { return this; }
+
+Expression object_class::fold(ConstantFolderP cf) {
+  Expression value = cf->lookup(name);
+  return value != NULL ? cf->replace(value->copy_Expression()) : this;
+}
+
+//******************************************************************
+//
+//   Reachability.  See Reachability in cgen.h; the bodies of live
+//   methods and the initializers of created classes are queued in
+//   `work' and scanned with `cls' set to the class they belong to.
+//
+//*****************************************************************
+
+void Reachability::run(Symbol main_class, Symbol main_method)
+{
+  for (Symbol basic : {Object, IO, Int, Bool, Str})
+    create(basic);
+  create(main_class);
+  call(resolve(main_class), main_method);
+
+  while (!work.empty()) {
+    std::pair<CgenNodeP, Expression> w = work.back();
+    work.pop_back();
+    cls = w.first;
+    w.second->find_calls(this);
+  }
+}
+
+CgenNodeP Reachability::resolve(Symbol type)
+{
+  return ct->probe(type == SELF_TYPE ? cls->get_name() : type);
+}
+
+// The method `name' of class `c' becomes live.
+void Reachability::call(CgenNodeP c, Symbol name)
+{
+  std::pair<Symbol, method_class *> impl = c->get_methods()[c->method_offset(name)];
+  if (!live.insert(impl.second).second)
+    return;
+  CgenNodeP owner = ct->probe(impl.first);
+  if (!owner->coded_elsewhere())
+    work.push_back(std::make_pair(owner, impl.second->get_expr()));
+}
+
+void Reachability::create(Symbol type)
+{
+  if (type == SELF_TYPE)      // self's class has been created already
+    return;
+  CgenNodeP c = ct->probe(type);
+  if (!created.insert(c).second)
+    return;
+
+  for (CgenNodeP a = c; a->get_name() != No_class; a = a->get_parentnd()) {
+    if (!initialized.insert(a).second)
+      break;
+    Features features = a->get_features();
+    for (int i = features->first(); features->more(i); i = features->next(i))
+      if (!features->nth(i)->is_method())
+        work.push_back(std::make_pair(a, ((attr_class *) features->nth(i))->get_init()));
+  }
+
+  for (size_t i = 0; i < sites.size(); i++)
+    if (c->conforms_to(sites[i].first))
+      call(c, sites[i].second);
+}
+
+//
+// The code generator calls the class hierarchy analysis' choice
+// directly, so it is live even if no conforming class is created.
+//
+void Reachability::dispatch(Symbol type, Symbol name)
+{
+  CgenNodeP c = resolve(type);
+  std::pair<CgenNodeP, Symbol> site(c, name);
+  if (std::find(sites.begin(), sites.end(), site) != sites.end())
+    return;
+  sites.push_back(site);
+
+  Symbol impl = c->unique_impl(name);
+  if (impl != NULL)
+    call(ct->probe(impl), name);
+  for (auto created_class : created)
+    if (created_class->conforms_to(c))
+      call(created_class, name);
+}
+
+static void find_calls(Expressions es, ReachabilityP r)
+{
+  for (int i = es->first(); es->more(i); i = es->next(i))
+    es->nth(i)->find_calls(r);
+}
+
+void assign_class::find_calls(ReachabilityP r) {
+  expr->find_calls(r);
+}
+
+void static_dispatch_class::find_calls(ReachabilityP r) {
+  expr->find_calls(r);
+  ::find_calls(actual, r);
+  r->static_dispatch(type_name, name);
+}
+
+void dispatch_class::find_calls(ReachabilityP r) {
+  expr->find_calls(r);
+  ::find_calls(actual, r);
+  r->dispatch(expr->get_type(), name);
+}
+
+void cond_class::find_calls(ReachabilityP r) {
+  pred->find_calls(r);
+  then_exp->find_calls(r);
+  else_exp->find_calls(r);
+}
+
+void loop_class::find_calls(ReachabilityP r) {
+  for (auto& inv : invariants)
+    inv.second->find_calls(r);
+  pred->find_calls(r);
+  body->find_calls(r);
+}
+
+void typcase_class::find_calls(ReachabilityP r) {
+  expr->find_calls(r);
+  for (int i = cases->first(); cases->more(i); i = cases->next(i))
+    cases->nth(i)->get_expr()->find_calls(r);
+}
+
+void block_class::find_calls(ReachabilityP r) {
+  ::find_calls(body, r);
+}
+
+void let_class::find_calls(ReachabilityP r) {
+  init->find_calls(r);
+  body->find_calls(r);
+}
+
+void plus_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+  e2->find_calls(r);
+}
+
+void sub_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+  e2->find_calls(r);
+}
+
+void mul_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+  e2->find_calls(r);
+}
+
+void divide_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+  e2->find_calls(r);
+}
+
+void neg_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+}
+
+void lt_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+  e2->find_calls(r);
+}
+
+void eq_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+  e2->find_calls(r);
+}
+
+void leq_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+  e2->find_calls(r);
+}
+
+void comp_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+}
+
+void isvoid_class::find_calls(ReachabilityP r) {
+  e1->find_calls(r);
+}
+
+void new__class::find_calls(ReachabilityP r) {
+  r->create(type_name);
+}
+
+void int_const_class::find_calls(ReachabilityP r) { }
+
+void bool_const_class::find_calls(ReachabilityP r) { }
+
+void string_const_class::find_calls(ReachabilityP r) { }
+
+void no_expr_class::find_calls(ReachabilityP r) { }
+
+void object_class::find_calls(ReachabilityP r) { }
+
+//******************************************************************
+//
+//   Escape analysis.  Every let of type Int or Bool is a candidate for
+//   an unboxed frame slot; see EscapeAnalysis in cgen.h for the cost
+//   model.  Values that are discarded, tested, or used as operands of
+//   arithmetic and comparisons never need a box.
+//
+//*****************************************************************
+
+void EscapeAnalysis::use(Symbol name, bool boxed)
+{
+  let_class *let = lookup(name);
+  if (let != NULL && boxed)
+    let->boxed_uses += weight;
+}
+
+void EscapeAnalysis::define(let_class *let, Expression value)
+{
+  if (let != NULL && value->allocates_int())
+    let->allocating_defs += weight;
+}
+
+static void find_escapes(Expressions es, EscapeAnalysisP ea, bool boxed)
+{
+  for (int i = es->first(); es->more(i); i = es->next(i))
+    es->nth(i)->find_escapes(ea, boxed);
+}
+
+void assign_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  let_class *let = ea->lookup(name);
+  expr->find_escapes(ea, let == NULL || !let->unboxed);
+  ea->define(let, expr);
+}
+
+void static_dispatch_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  ::find_escapes(actual, ea, true);
+  expr->find_escapes(ea, true);
+}
+
+void dispatch_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  ::find_escapes(actual, ea, true);
+  expr->find_escapes(ea, true);
+}
+
+void cond_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  pred->find_escapes(ea, false);
+  then_exp->find_escapes(ea, boxed);
+  else_exp->find_escapes(ea, boxed);
+}
+
+void loop_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  for (auto& inv : invariants)
+    inv.second->find_escapes(ea, false);
+  ea->enter_loop();
+  pred->find_escapes(ea, false);
+  body->find_escapes(ea, false);
+  ea->exit_loop();
+}
+
+void typcase_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  expr->find_escapes(ea, true);
+  for (int i = cases->first(); cases->more(i); i = cases->next(i)) {
+    Case c = cases->nth(i);
+    ea->enterscope();
+    ea->bind(c->get_name(), NULL);
+    c->get_expr()->find_escapes(ea, boxed);
+    ea->exitscope();
+  }
+}
+
+void block_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  for (int i = body->first(); body->more(i); i = body->next(i))
+    body->nth(i)->find_escapes(ea, body->more(body->next(i)) ? false : boxed);
+}
+
+//
+// While the body is analyzed `unboxed' says whether the variable is a
+// candidate, which is what assignments to it assume.
+//
+void let_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  bool candidate = raw_values_safe() && is_unboxable(type_decl);
+  unboxed = candidate;
+  boxed_uses = allocating_defs = 0;
+  init->find_escapes(ea, !unboxed);
+  ea->define(this, init);
+
+  ea->enterscope();
+  ea->bind(identifier, this);
+  body->find_escapes(ea, boxed);
+  ea->exitscope();
+  unboxed = candidate && (type_decl == Bool || boxed_uses <= allocating_defs);
+}
+
+void plus_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  e1->find_escapes(ea, false);
+  e2->find_escapes(ea, false);
+}
+
+void sub_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  e1->find_escapes(ea, false);
+  e2->find_escapes(ea, false);
+}
+
+void mul_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  e1->find_escapes(ea, false);
+  e2->find_escapes(ea, false);
+}
+
+void divide_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  e1->find_escapes(ea, false);
+  e2->find_escapes(ea, false);
+}
+
+void neg_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  e1->find_escapes(ea, false);
+}
+
+void lt_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  e1->find_escapes(ea, false);
+  e2->find_escapes(ea, false);
+}
+
+void eq_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  bool by_value = is_unboxable(e1->get_type());
+  e1->find_escapes(ea, !by_value);
+  e2->find_escapes(ea, !by_value);
+}
+
+void leq_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  e1->find_escapes(ea, false);
+  e2->find_escapes(ea, false);
+}
+
+void comp_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  e1->find_escapes(ea, false);
+}
+
+void isvoid_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  e1->find_escapes(ea, true);
+}
+
+void new__class::find_escapes(EscapeAnalysisP ea, bool boxed) { }
+
+void int_const_class::find_escapes(EscapeAnalysisP ea, bool boxed) { }
+
+void bool_const_class::find_escapes(EscapeAnalysisP ea, bool boxed) { }
+
+void string_const_class::find_escapes(EscapeAnalysisP ea, bool boxed) { }
+
+void no_expr_class::find_escapes(EscapeAnalysisP ea, bool boxed) { }
+
+void object_class::find_escapes(EscapeAnalysisP ea, bool boxed) {
+  ea->use(name, boxed);
+}
+
+//******************************************************************
+//
+//   Sethi-Ullman numbers.  Only binary operators (and new SELF_TYPE)
+//   hold a temporary while evaluating a subexpression; everything else
+//   needs as many as its most demanding subexpression.
+//
+//*****************************************************************
+
+static int max_temps(Expressions es)
+{
+  int n = 0;
+  for (int i = es->first(); es->more(i); i = es->next(i))
+    n = std::max(n, es->nth(i)->temps_needed());
+  return n;
+}
+
+int assign_class::temps_needed() {
+  if (temps < 0) temps = expr->temps_needed();
+  return temps;
+}
+
+int static_dispatch_class::temps_needed() {
+  if (temps < 0) temps = std::max(expr->temps_needed(), max_temps(actual));
+  return temps;
+}
+
+int dispatch_class::temps_needed() {
+  if (temps < 0) temps = std::max(expr->temps_needed(), max_temps(actual));
+  return temps;
+}
+
+int cond_class::temps_needed() {
+  if (temps < 0)
+    temps = std::max(pred->temps_needed(),
+                     std::max(then_exp->temps_needed(), else_exp->temps_needed()));
+  return temps;
+}
+
+int loop_class::temps_needed() {
+  if (temps < 0) {
+    temps = std::max(pred->temps_needed(), body->temps_needed());
+    for (auto& inv : invariants)
+      temps = std::max(temps, inv.second->temps_needed());
+  }
+  return temps;
+}
+
+int typcase_class::temps_needed() {
+  if (temps < 0) {
+    temps = expr->temps_needed();
+    for (int i = cases->first(); cases->more(i); i = cases->next(i))
+      temps = std::max(temps, cases->nth(i)->get_expr()->temps_needed());
+  }
+  return temps;
+}
+
+int block_class::temps_needed() {
+  if (temps < 0) temps = max_temps(body);
+  return temps;
+}
+
+int let_class::temps_needed() {
+  if (temps < 0) temps = std::max(init->temps_needed(), body->temps_needed());
+  return temps;
+}
+
+int plus_class::temps_needed() {
+  if (temps < 0) temps = binary_temps(e1, e2);
+  return temps;
+}
+
+int sub_class::temps_needed() {
+  if (temps < 0) temps = binary_temps(e1, e2);
+  return temps;
+}
+
+int mul_class::temps_needed() {
+  if (temps < 0) temps = binary_temps(e1, e2);
+  return temps;
+}
+
+int divide_class::temps_needed() {
+  if (temps < 0) temps = binary_temps(e1, e2);
+  return temps;
+}
+
+int lt_class::temps_needed() {
+  if (temps < 0) temps = binary_temps(e1, e2);
+  return temps;
+}
+
+int eq_class::temps_needed() {
+  if (temps < 0) temps = binary_temps(e1, e2);
+  return temps;
+}
+
+int leq_class::temps_needed() {
+  if (temps < 0) temps = binary_temps(e1, e2);
+  return temps;
+}
+
+int neg_class::temps_needed() { return e1->temps_needed(); }
+
+int comp_class::temps_needed() { return e1->temps_needed(); }
+
+int isvoid_class::temps_needed() { return e1->temps_needed(); }
+
+int new__class::temps_needed() { return type_name == SELF_TYPE ? 1 : 0; }
+
+int int_const_class::temps_needed() { return 0; }
+
+int bool_const_class::temps_needed() { return 0; }
+
+int string_const_class::temps_needed() { return 0; }
+
+int no_expr_class::temps_needed() { return 0; }
+
+int object_class::temps_needed() { return 0; }
+
+//******************************************************************
+//
+//   Inlining costs: roughly one per node.  Bodies that call, loop or
+//   branch on a type are never inlined, which also rules out recursion.
+//
+//*****************************************************************
+
+#define NOT_INLINABLE (INLINE_LIMIT + 1)
+
+static int inline_cost(Expressions es)
+{
+  int n = 0;
+  for (int i = es->first(); es->more(i); i = es->next(i))
+    n += es->nth(i)->inline_cost();
+  return n;
+}
+
+int assign_class::inline_cost() { return 1 + expr->inline_cost(); }
+
+int static_dispatch_class::inline_cost() { return NOT_INLINABLE; }
+
+int dispatch_class::inline_cost() { return NOT_INLINABLE; }
+
+int cond_class::inline_cost() {
+  return 1 + pred->inline_cost() + then_exp->inline_cost() + else_exp->inline_cost();
+}
+
+int loop_class::inline_cost() { return NOT_INLINABLE; }
+
+int typcase_class::inline_cost() { return NOT_INLINABLE; }
+
+int block_class::inline_cost() { return ::inline_cost(body); }
+
+int let_class::inline_cost() { return 1 + init->inline_cost() + body->inline_cost(); }
+
+int plus_class::inline_cost() { return 1 + e1->inline_cost() + e2->inline_cost(); }
+
+int sub_class::inline_cost() { return 1 + e1->inline_cost() + e2->inline_cost(); }
+
+int mul_class::inline_cost() { return 1 + e1->inline_cost() + e2->inline_cost(); }
+
+int divide_class::inline_cost() { return 1 + e1->inline_cost() + e2->inline_cost(); }
+
+int neg_class::inline_cost() { return 1 + e1->inline_cost(); }
+
+int lt_class::inline_cost() { return 1 + e1->inline_cost() + e2->inline_cost(); }
+
+int eq_class::inline_cost() { return 1 + e1->inline_cost() + e2->inline_cost(); }
+
+int leq_class::inline_cost() { return 1 + e1->inline_cost() + e2->inline_cost(); }
+
+int comp_class::inline_cost() { return 1 + e1->inline_cost(); }
+
+int int_const_class::inline_cost() { return 1; }
+
+int bool_const_class::inline_cost() { return 1; }
+
+int string_const_class::inline_cost() { return 1; }
+
+int new__class::inline_cost() { return 2; }
+
+int isvoid_class::inline_cost() { return 1 + e1->inline_cost(); }
+
+int no_expr_class::inline_cost() { return 0; }
+
+int object_class::inline_cost() { return 1; }
+
+//******************************************************************
+//
+//   Bytecode.  Each expression leaves its value in the register the
+//   caller names, writing it last, so a variable's own register can
+//   be the destination of the value assigned to it.  An operand is
+//   read straight from a variable's register when nothing evaluated
+//   after it can assign the variable.
+//
+//*****************************************************************
+
+void CgenClassTable::code_bytecode()
+{
+  VmCompiler vm(this);
+  vm.compile();
+  vm.get_program().write(str);
+}
+
+int VmCompiler::add_string(const std::string& s)
+{
+  auto it = strings.find(s);
+  if (it != strings.end())
+    return it->second;
+  prog.strings.push_back(s);
+  return strings[s] = prog.strings.size() - 1;
+}
+
+int VmCompiler::add_const(int kind, int value)
+{
+  auto key = std::make_pair(kind, value);
+  auto it = consts.find(key);
+  if (it != consts.end())
+    return it->second;
+  VmConst c;
+  c.kind = (decltype(c.kind)) kind;
+  c.value = value;
+  prog.consts.push_back(c);
+  return consts[key] = prog.consts.size() - 1;
+}
+
+int VmCompiler::default_const(Symbol type)
+{
+  if (type == Int)
+    return int_const(0);
+  if (type == Bool)
+    return bool_const(false);
+  if (type == Str)
+    return add_const(VmConst::STRING, add_string(""));
+  return void_const();
+}
+
+int VmCompiler::builtin_of(Symbol name)
+{
+  static const struct { Symbol *name; VmBuiltin builtin; } builtins[] = {
+    { &cool_abort, VM_ABORT }, { &type_name, VM_TYPE_NAME }, { &::copy, VM_COPY },
+    { &out_string, VM_OUT_STRING }, { &out_int, VM_OUT_INT },
+    { &in_string, VM_IN_STRING }, { &in_int, VM_IN_INT },
+    { &length, VM_LENGTH }, { &concat, VM_CONCAT }, { &substr, VM_SUBSTR },
+  };
+  for (auto& b : builtins)
+    if (*b.name == name)
+      return b.builtin;
+  return VM_NOT_BUILTIN;
+}
+
+int VmCompiler::emit(VmOp op, int a, int b, int c, int d)
+{
+  int at = here();
+  int args[] = { a, b, c, d };
+  code->push_back(op);
+  for (int i = 0; i < vm_op_args[op]; i++)
+    code->push_back(args[i]);
+  return at;
+}
+
+int VmCompiler::alloc(int n)
+{
+  int reg = next_reg;
+  next_reg += n;
+  max_regs = std::max(max_regs, next_reg);
+  return reg;
+}
+
+int VmCompiler::operand(Expression e)
+{
+  if (e->is_self())
+    return 0;
+  if (e->variable() != NULL && lookup(e->variable()) >= 0)
+    return lookup(e->variable());
+  int reg = alloc();
+  e->vm_code(this, reg);
+  return reg;
+}
+
+int VmCompiler::method_of(Symbol impl, Symbol name)
+{
+  CgenNodeP c = ct->probe(impl);
+  auto it = method_index.find(c->get_methods()[c->method_offset(name)].second);
+  return it != method_index.end() ? it->second : -1;
+}
+
+int VmCompiler::add_site(int line, int target)
+{
+  VmSite site;
+  site.file = add_string(cls->get_filename()->get_string());
+  site.line = line;
+  site.target = target;
+  prog.sites.push_back(site);
+  return prog.sites.size() - 1;
+}
+
+int VmCompiler::add_case(int line)
+{
+  VmCase c;
+  c.file = add_string(cls->get_filename()->get_string());
+  c.line = line;
+  prog.cases.push_back(c);
+  return prog.cases.size() - 1;
+}
+
+void VmCompiler::add_branch(int table, CgenNodeP c)
+{
+  VmCase::Branch b = { c->get_tag(), c->get_max_tag(), here() };
+  prog.cases[table].branches.push_back(b);
+}
+
+//
+// Attributes are in scope in every method of the class, formals and
+// locals in registers from r1 up.
+//
+void VmCompiler::begin_method(CgenNodeP c, VmMethodInfo& m)
+{
+  cls = c;
+  code = &m.code;
+  vars.enterscope();
+  std::vector<attr_class *>& attrs = c->get_attrs();
+  for (size_t i = 0; i < attrs.size(); i++)
+    bind(attrs[i]->get_name(), -(int) i - 1);
+  vars.enterscope();
+  next_reg = max_regs = 1 + m.nformals;
+}
+
+void VmCompiler::end_method(VmMethodInfo& m)
+{
+  m.nregs = max_regs;
+  vars.exitscope();
+  vars.exitscope();
+}
+
+void VmCompiler::code_method(CgenNodeP c, method_class *m, VmMethodInfo& info)
+{
+  begin_method(c, info);
+  Formals formals = m->get_formals();
+  for (int i = formals->first(); formals->more(i); i = formals->next(i))
+    bind(formals->nth(i)->get_name(), 1 + i);
+  int result = alloc();
+  m->get_expr()->vm_code(this, result);
+  emit(VM_RET, result);
+  end_method(info);
+}
+
+//
+// Like CgenNode::code_init: the parent's initializer runs first.
+//
+void VmCompiler::code_init(CgenNodeP c, VmMethodInfo& info)
+{
+  begin_method(c, info);
+  CgenNodeP parent = c->get_parentnd();
+  if (init_index.count(parent)) {
+    int base = alloc();
+    emit(VM_MOVE, base, 0);
+    emit(VM_SCALL, base, base, 0, add_site(c->get_line_number(), init_index[parent]));
+  }
+
+  Features features = c->get_features();
+  for (int i = features->first(); features->more(i); i = features->next(i)) {
+    Feature f = features->nth(i);
+    if (f->is_method() || ((attr_class *) f)->get_init()->is_no_expr())
+      continue;
+    int m = mark();
+    int reg = alloc();
+    ((attr_class *) f)->get_init()->vm_code(this, reg);
+    emit(VM_SETATTR, -lookup(f->get_name()) - 1, reg);
+    release(m);
+  }
+  emit(VM_RET, 0);
+  end_method(info);
+}
+
+//
+// Methods are numbered first, so calls can name any of them; then the
+// bodies of the live ones and the initializers are compiled.
+//
+void VmCompiler::compile()
+{
+  std::vector<CgenNodeP>& classes = ct->get_classes();
+  std::vector<std::pair<CgenNodeP, method_class *> > bodies;
+  for (auto nd : classes) {
+    Features features = nd->get_features();
+    for (int i = features->first(); features->more(i); i = features->next(i)) {
+      Feature f = features->nth(i);
+      if (!f->is_method() || !((method_class *) f)->live)
+        continue;
+      method_class *m = (method_class *) f;
+      VmMethodInfo info;
+      info.name = add_string(std::string(nd->get_name()->get_string()) + "." +
+                             m->get_name()->get_string());
+      info.nformals = m->get_formals()->len();
+      info.nregs = 0;
+      info.builtin = nd->basic() ? builtin_of(m->get_name()) : VM_NOT_BUILTIN;
+      method_index[m] = prog.methods.size();
+      prog.methods.push_back(info);
+      if (!nd->basic())
+        bodies.push_back(std::make_pair(nd, m));
+    }
+  }
+  for (auto nd : classes) {
+    if (nd->basic() || !nd->is_initialized())
+      continue;
+    VmMethodInfo info;
+    info.name = add_string(std::string(nd->get_name()->get_string()) + "_init");
+    info.nformals = 0;
+    info.nregs = 0;
+    info.builtin = VM_NOT_BUILTIN;
+    init_index[nd] = prog.methods.size();
+    prog.methods.push_back(info);
+  }
+
+  for (auto nd : classes) {
+    VmClassInfo c;
+    c.name = add_string(nd->get_name()->get_string());
+    c.parent = nd->get_parentnd()->get_name() != No_class ?
+               nd->get_parentnd()->get_tag() : -1;
+    c.max_tag = nd->get_max_tag();
+    if (!nd->basic())
+      for (auto a : nd->get_attrs()) {
+        Symbol type = a->get_type_decl();
+        c.attrs.push_back(type == Int ? VM_ZERO : type == Bool ? VM_FALSE
+                          : type == Str ? VM_EMPTY_STRING : VM_VOID);
+      }
+    c.init = init_index.count(nd) ? init_index[nd] : -1;
+    for (auto& m : nd->get_methods())
+      c.vtable.push_back(method_index.count(m.second) ? method_index[m.second] : -1);
+    prog.classes.push_back(c);
+  }
+
+  for (auto& init : init_index)
+    code_init(init.first, prog.methods[init.second]);
+  for (auto& b : bodies)
+    code_method(b.first, b.second, prog.methods[method_index[b.second]]);
+
+  CgenNodeP main = ct->probe(Main);
+  prog.int_class = ct->get_tag(Int);
+  prog.bool_class = ct->get_tag(Bool);
+  prog.string_class = ct->get_tag(Str);
+  prog.main_class = main->get_tag();
+  prog.main_method = method_of(Main, main_meth);
+}
+
+static void vm_code_call(Expression receiver, Expressions actual, Symbol name,
+                         CgenNodeP cls, Symbol impl, int line,
+                         VmCompilerP vm, int dest)
+{
+  int m = vm->mark();
+  int n = actual->len();
+  int base = vm->alloc(1 + n);
+  for (int i = actual->first(); actual->more(i); i = actual->next(i))
+    actual->nth(i)->vm_code(vm, base + 1 + i);
+  receiver->vm_code(vm, base);
+  int target = impl != NULL ? vm->method_of(impl, name) : -1;
+  if (target >= 0)
+    vm->emit(VM_SCALL, dest, base, n, vm->add_site(line, target));
+  else
+    vm->emit(VM_CALL, dest, base, n, vm->add_site(line, cls->method_offset(name)));
+  vm->release(m);
+}
+
+//
+// Binary operators: `e1' is copied to a register of its own unless `e2'
+// cannot change it.
+//
+static void vm_code_binary(VmOp op, Expression e1, Expression e2,
+                           VmCompilerP vm, int dest)
+{
+  int m = vm->mark();
+  int a;
+  if (e2->is_pure())
+    a = vm->operand(e1);
+  else {
+    a = vm->alloc();
+    e1->vm_code(vm, a);
+  }
+  int b = vm->operand(e2);
+  vm->emit(op, dest, a, b);
+  vm->release(m);
+}
+
+static void vm_code_unary(VmOp op, Expression e1, VmCompilerP vm, int dest)
+{
+  int m = vm->mark();
+  vm->emit(op, dest, vm->operand(e1));
+  vm->release(m);
+}
+
+//
+// Discards the value of `e'.
+//
+static void vm_code_discard(Expression e, VmCompilerP vm)
+{
+  int m = vm->mark();
+  e->vm_code(vm, vm->alloc());
+  vm->release(m);
+}
+
+void assign_class::vm_code(VmCompilerP vm, int dest) {
+  int var = vm->lookup(name);
+  if (var >= 0) {
+    expr->vm_code(vm, var);
+    if (dest != var)
+      vm->emit(VM_MOVE, dest, var);
+  } else {
+    expr->vm_code(vm, dest);
+    vm->emit(VM_SETATTR, -var - 1, dest);
+  }
+  for (auto& d : derived)
+    vm->emit(VM_STEP, vm->lookup(d.first), d.second);
+}
+
+void static_dispatch_class::vm_code(VmCompilerP vm, int dest) {
+  CgenNodeP cls = vm->get_classtable()->probe(type_name);
+  vm_code_call(expr, actual, name, cls, cls->method_class_of(name), line_number,
+               vm, dest);
+}
+
+void dispatch_class::vm_code(VmCompilerP vm, int dest) {
+  CgenClassTableP ct = vm->get_classtable();
+  CgenNodeP cls = expr->get_type() == SELF_TYPE ? vm->get_class()
+                                                : ct->probe(expr->get_type());
+  Symbol impl = dispatch_target(expr, name, cls, ct);
+  vm_code_call(expr, actual, name, cls, impl, line_number, vm, dest);
+}
+
+void cond_class::vm_code(VmCompilerP vm, int dest) {
+  int m = vm->mark();
+  int test = vm->emit(VM_JFALSE, vm->operand(pred));
+  vm->release(m);
+  then_exp->vm_code(vm, dest);
+  int end = vm->emit(VM_JUMP);
+  vm->set_target(test);
+  else_exp->vm_code(vm, dest);
+  vm->set_target(end);
+}
+
+void loop_class::vm_code(VmCompilerP vm, int dest) {
+  int m = vm->mark();
+  vm->enterscope();
+  for (auto& inv : invariants) {
+    int reg = vm->alloc();
+    inv.second->vm_code(vm, reg);
+    vm->bind(inv.first, reg);
+  }
+
+  int start = vm->here();
+  int test = vm->emit(VM_JFALSE, vm->operand(pred));
+  vm_code_discard(body, vm);
+  vm->emit(VM_JUMP, start);
+  vm->set_target(test);
+  vm->emit(VM_CONST, dest, vm->void_const());
+  vm->exitscope();
+  vm->release(m);
+}
+
+//
+// VM_CASE picks the first branch that matches, so the table lists them
+// in order of decreasing tag, like typcase_class::code tests them.  The
+// variable of every branch is the register holding the value.
+//
+void typcase_class::vm_code(VmCompilerP vm, int dest) {
+  CgenClassTableP ct = vm->get_classtable();
+  int m = vm->mark();
+  int value = vm->alloc();
+  expr->vm_code(vm, value);
+  int table = vm->add_case(line_number);
+  vm->emit(VM_CASE, value, table);
+
+  std::vector<Case> branches;
+  for (int i = cases->first(); cases->more(i); i = cases->next(i))
+    branches.push_back(cases->nth(i));
+  std::sort(branches.begin(), branches.end(), [ct](Case a, Case b) {
+    return ct->get_tag(a->get_type_decl()) > ct->get_tag(b->get_type_decl());
+  });
+
+  std::vector<int> ends;
+  for (auto b : branches) {
+    vm->add_branch(table, ct->probe(b->get_type_decl()));
+    vm->enterscope();
+    vm->bind(b->get_name(), value);
+    b->get_expr()->vm_code(vm, dest);
+    vm->exitscope();
+    ends.push_back(vm->emit(VM_JUMP));
+  }
+  for (int end : ends)
+    vm->set_target(end);
+  vm->release(m);
+}
+
+void block_class::vm_code(VmCompilerP vm, int dest) {
+  for (int i = body->first(); body->more(i); i = body->next(i)) {
+    if (body->more(body->next(i)))
+      vm_code_discard(body->nth(i), vm);
+    else
+      body->nth(i)->vm_code(vm, dest);
+  }
+}
+
+void let_class::vm_code(VmCompilerP vm, int dest) {
+  int m = vm->mark();
+  int reg = vm->alloc();
+  if (init->is_no_expr())
+    vm->emit(VM_CONST, reg, vm->default_const(type_decl));
+  else
+    init->vm_code(vm, reg);
+  vm->enterscope();
+  vm->bind(identifier, reg);
+  body->vm_code(vm, dest);
+  vm->exitscope();
+  vm->release(m);
+}
+
+void plus_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_binary(VM_ADD, e1, e2, vm, dest);
+}
+
+void sub_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_binary(VM_SUB, e1, e2, vm, dest);
+}
+
+void mul_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_binary(VM_MUL, e1, e2, vm, dest);
+}
+
+void divide_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_binary(VM_DIV, e1, e2, vm, dest);
+}
+
+void neg_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_unary(VM_NEG, e1, vm, dest);
+}
+
+void lt_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_binary(VM_LT, e1, e2, vm, dest);
+}
+
+void eq_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_binary(VM_EQ, e1, e2, vm, dest);
+}
+
+void leq_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_binary(VM_LE, e1, e2, vm, dest);
+}
+
+void comp_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_unary(VM_NOT, e1, vm, dest);
+}
+
+void int_const_class::vm_code(VmCompilerP vm, int dest) {
+  vm->emit(VM_CONST, dest, vm->int_const(atoi(token->get_string())));
+}
+
+void bool_const_class::vm_code(VmCompilerP vm, int dest) {
+  vm->emit(VM_CONST, dest, vm->bool_const(val));
+}
+
+void string_const_class::vm_code(VmCompilerP vm, int dest) {
+  vm->emit(VM_CONST, dest, vm->string_const(token));
+}
+
+//
+// Ints, Bools and Strings are values in the interpreter; a new one is
+// the default.
+//
+void new__class::vm_code(VmCompilerP vm, int dest) {
+  int m = vm->mark();
+  if (type_name == Int || type_name == Bool || type_name == Str)
+    vm->emit(VM_CONST, dest, vm->default_const(type_name));
+  else if (type_name == SELF_TYPE)
+    vm->emit(VM_NEWSELF, dest, vm->alloc());
+  else
+    vm->emit(VM_NEW, dest, vm->get_classtable()->get_tag(type_name), vm->alloc());
+  vm->release(m);
+}
+
+void isvoid_class::vm_code(VmCompilerP vm, int dest) {
+  vm_code_unary(VM_ISVOID, e1, vm, dest);
+}
+
+void no_expr_class::vm_code(VmCompilerP vm, int dest) {
+  vm->emit(VM_CONST, dest, vm->void_const());
+}
+
+void object_class::vm_code(VmCompilerP vm, int dest) {
+  int var = name == self ? 0 : vm->lookup(name);
+  if (var < 0)
+    vm->emit(VM_GETATTR, dest, -var - 1);
+  else if (var != dest)
+    vm->emit(VM_MOVE, dest, var);
+}
@@ -1,15 +1,61 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 #include <list>
+#include <map>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <utility>
 #include "cool-tree.h"
 #include "emit.h"
 #include "symtab.h"
+#include "peephole.h"
+#include "vm.h"
 
-enum Basicness     {Basic, NotBasic};
+//
+// External classes are those of the interfaces of separately compiled
+// modules (see interface.h): their tables are coded here, their
+// initializers and methods in their module.
+//
+enum Basicness     {Basic, NotBasic, External};
 #define TRUE 1
 #define FALSE 0
 
+//
+// Expression temporaries are kept in the callee-saved registers $s1-$s6
+// (the collector treats $s0-$s6 as roots).  Deeper temporaries spill to
+// the stack.
+//
+#define NUM_TEMP_REGS 6
+
+//
+// Calls with a statically known target are inlined when the callee's body
+// costs at most this much (see Expression::inline_cost).
+//
+#define INLINE_LIMIT 8
+
+//
+// Int results in this range are boxed as one of the preallocated
+// constants of the small Int cache instead of a new object.
+//
+#define INT_CACHE_MIN -128
+#define INT_CACHE_MAX 1023
+
+//
+// Classes are coded by this many threads unless CGEN_THREADS says
+// otherwise; 0 means one per processor.
+//
+#define DEFAULT_THREADS 0
+
+//
+// What the code generator produces, chosen by CGEN_TARGET: "mips" (the
+// default), "x86-64" (see x86.h) or "bytecode" (see vm.h).
+//
+enum CgenTarget { TARGET_MIPS, TARGET_X86_64, TARGET_BYTECODE };
+CgenTarget cgen_target();
+
 class CgenClassTable;
 typedef CgenClassTable *CgenClassTableP;
 
@@ -22,6 +68,7 @@ private:
   std::list<CgenNodeP> nds;
   std::ostream& str;
   SymbolTable<Symbol,int> class_to_tag_table;
+  std::vector<CgenNodeP> tag_to_class;
 
   // The following methods emit code for constants and global declarations.
   void code_global_data();
@@ -29,6 +76,26 @@ private:
   void code_bools();
   void code_select_gc();
   void code_constants();
+  void code_int_cache(int intclasstag);
+
+  // The following emit the per-class tables and code.
+  void code_class_nameTab();
+  void code_class_objTab();
+  void code_dispatch_tables();
+  void code_prototypes();
+  void code_classes();
+
+  // Writes the program as bytecode instead (see VmCompiler).
+  void code_bytecode();
+
+  // Separate compilation (see interface.h).  A program compiled against
+  // interfaces has the tag range of every class as a word pair, for the
+  // case branches of the modules' code.
+  bool module;
+  void install_interfaces();
+  void check_interfaces();
+  void code_class_tags();
+  void write_interface(std::vector<std::stringstream>& maps);
 
   // The following creates an inheritance graph from a list of classes. The
   // graph is implemented as  a tree of `CgenNode', and class names are placed
@@ -38,10 +105,49 @@ private:
   void install_classes(Classes cs);
   void build_inheritance_tree();
   void set_relations(CgenNodeP nd);
+
+  // Tags are assigned in a preorder walk of the tree, so the tags of a
+  // class and all of its descendants form the range [tag, max_tag].
+  void assign_tags(CgenNodeP nd);
+
+  // Folds constants in every method and initializer (with -O).  This
+  // runs before the constant tables are emitted, since folding adds
+  // entries to them.
+  void fold_constants();
+
+  // Drops methods and classes that Main.main cannot reach (with -O).
+  void eliminate_dead_code();
+
+  // Runs the analyses that annotate the tree (escapes, temporaries) on
+  // every body, so that coding, which may happen on several threads at
+  // once, only reads the tree.
+  void analyze();
+  int num_threads();
+
+  // Dynamic dispatch sites, and those bound to a single method by class
+  // hierarchy analysis (see dispatch_class::code).
+  std::atomic<int> dispatch_sites;
+  std::atomic<int> devirtualized_sites;
+  std::atomic<int> inlined_sites;
+  std::atomic<int> tail_calls;
+  std::atomic<int> barriers;
+  std::atomic<int> elided_barriers;
+
+  Peephole peephole;
 public:
   CgenClassTable(Classes, std::ostream& str);
   void code();
   CgenNodeP root();
+  std::vector<CgenNodeP>& get_classes() { return tag_to_class; }
+  int get_tag(Symbol name) { return *class_to_tag_table.lookup(name); }
+  // Compiling a module: classes may be inherited and called by code not
+  // seen here, and tags are only known when the program is put together.
+  bool is_module() { return module; }
+  void count_dispatch(bool devirtualized);
+  void count_inlined() { inlined_sites++; }
+  void count_tail_call() { tail_calls++; }
+  void count_barrier(bool elided) { (elided ? elided_barriers : barriers)++; }
+  void emit_code(const std::string& code, std::ostream& s);
 };
 
 class CgenNode : public class__class {
@@ -50,6 +156,18 @@ private:
   CgenNodeP parentnd;
   std::list<CgenNodeP> children;
   Basicness basic_status;
+  int tag;
+  int max_tag;
+
+  // Cleared by dead code elimination for classes that are never created,
+  // and for those whose initializer never runs.
+  bool instantiated;
+  bool initialized;
+
+  // All attributes in object layout order, inherited ones first.
+  std::vector<attr_class *> attrs;
+  // Dispatch table: the class defining each method, in slot order.
+  std::vector<std::pair<Symbol, method_class *> > methods;
 
 public:
   CgenNode(Class_ c,
@@ -61,6 +179,35 @@ public:
   void set_parentnd(CgenNodeP p);
   CgenNodeP get_parentnd();
   int basic() { return (basic_status == Basic); }
+  int external() { return (basic_status == External); }
+  // the methods of basic classes are in the runtime, of external ones
+  // in their module
+  bool coded_elsewhere() { return (basic_status != NotBasic); }
+
+  void set_tags(int t, int max) { tag = t; max_tag = max; }
+  int get_tag() { return tag; }
+  int get_max_tag() { return max_tag; }
+  bool conforms_to(CgenNodeP c) { return c->tag <= tag && tag <= c->max_tag; }
+
+  void set_live(bool inst, bool init) { instantiated = inst; initialized = init; }
+  bool is_instantiated() { return instantiated; }
+  bool is_initialized() { return initialized; }
+
+  // Builds the attribute layout and dispatch table from the parent's.
+  void layout();
+  std::vector<attr_class *>& get_attrs() { return attrs; }
+  std::vector<std::pair<Symbol, method_class *> >& get_methods() { return methods; }
+  int attr_offset(Symbol name);
+  int method_offset(Symbol name);
+  Symbol method_class_of(Symbol name) { return methods[method_offset(name)].first; }
+  // The class whose `name' this class and all its descendants inherit,
+  // or NULL if some descendant overrides it.
+  Symbol unique_impl(Symbol name);
+
+  void code_disptab(std::ostream&);
+  void code_protobj(std::ostream&);
+  void code_init(std::ostream&, CgenClassTableP);
+  void code_methods(std::ostream&, CgenClassTableP);
 };
 
 class BoolConst {
@@ -72,3 +219,336 @@ class BoolConst {
   void code_ref(std::ostream&) const;
 };
 
+//
+// A variable lives either in an attribute slot of self or in a word of
+// the current frame.  `base' is SELF or FP and `offset' is in words.
+// An unboxed variable holds the raw value of an Int or Bool.
+//
+class VarLocation {
+public:
+  Register base;
+  int offset;
+  bool unboxed;
+  VarLocation(Register b, int o, bool u = false) : base(b), offset(o), unboxed(u) { }
+};
+typedef VarLocation *VarLocationP;
+
+//
+// A call in tail position jumps to a stub emitted after the epilogue,
+// where the frame size is known.  The stub restores the caller's
+// registers, moves the `nargs' arguments over the method's own, and
+// jumps to `impl'.`name', or to the address in $t1 if `impl' is NULL.
+//
+struct TailCall {
+  int label;
+  int nargs;
+  Symbol impl;
+  Symbol name;
+};
+
+//
+// CgenEnvironment carries what expression code generation needs to know
+// about the method being compiled: the class, where each identifier lives,
+// the frame slots used by let and case, and the live temporaries.
+//
+// Frame layout, with $fp pointing at the word the caller's $sp pointed to:
+//
+//        arg 0            (n)($fp)   pushed first by the caller
+//        ...
+//        arg n-1          (1)($fp)
+//        saved $fp        (0)($fp)
+//        saved $s0       (-1)($fp)
+//        saved $ra       (-2)($fp)
+//        locals          (-3)($fp)   let and case variables
+//        ...
+//        saved $s1-$s6               temporaries used by this method
+//
+// With a collector, every call that may allocate is followed by a label
+// for its return address, and `stack_maps' records how many locals and
+// temporaries are live there.  Everything the frame has pushed below
+// them (arguments, spilled temporaries) is live as well.
+//
+struct StackMapSite {
+  int label;
+  int locals;
+  int temps;
+};
+
+class CgenEnvironment {
+private:
+  CgenClassTableP classtable;
+  CgenNodeP cls;
+  SymbolTable<Symbol, VarLocation> vars;
+  int locals;
+  int max_locals;
+  int temps;
+  int max_temps;
+  std::vector<TailCall> tail_calls;
+  std::vector<StackMapSite> stack_maps;
+
+public:
+  CgenEnvironment(CgenClassTableP ct, CgenNodeP c);
+
+  CgenClassTableP get_classtable() { return classtable; }
+  CgenNodeP get_class() { return cls; }
+  Symbol get_filename() { return cls->get_filename(); }
+
+  void enterscope() { vars.enterscope(); }
+  void exitscope() { vars.exitscope(); }
+  VarLocationP lookup(Symbol name) { return vars.lookup(name); }
+  void add_formal(Symbol name, int index, int num_formals);
+  VarLocationP add_local(Symbol name, bool unboxed = false);
+  VarLocationP alloc_local(bool unboxed = false);
+  void bind(Symbol name, VarLocationP loc) { vars.addid(name, loc); }
+  void remove_local() { locals--; }
+
+  // An inlined method body of class `c' sees c's attributes in a new
+  // scope, in which the caller binds the formals.  enter_inline returns
+  // the class to give back to exit_inline.
+  CgenNodeP enter_inline(CgenNodeP c);
+  void exit_inline(CgenNodeP caller);
+
+  // Temporaries are allocated and released in stack order.  save_temp
+  // moves `src' into a fresh temporary; release_temp frees the youngest
+  // one and returns the register holding its value, popping it into
+  // `scratch' if it had been spilled.
+  void save_temp(std::ostream& s, Register src = ACC);
+  Register release_temp(Register scratch, std::ostream& s);
+
+  int add_tail_call(int nargs, Symbol impl, Symbol name);
+  std::vector<TailCall>& get_tail_calls() { return tail_calls; }
+
+  void add_stack_map(std::ostream& s);
+  std::vector<StackMapSite>& get_stack_maps() { return stack_maps; }
+
+  int frame_locals() { return max_locals; }
+  int saved_regs() { return max_temps < NUM_TEMP_REGS ? max_temps : NUM_TEMP_REGS; }
+};
+
+//
+// Constant folding and propagation, and loop optimization.  `run' folds
+// one method body or attribute initializer in two passes.  The first
+// evaluates operators on constants, picks the taken arm of a cond, and
+// drops `while false' loops and pure statements of blocks, while
+// counting the assignments to each name.  The second also replaces
+// variables bound by a let to a constant, if nothing assigns that name,
+// by the constant.  `scope' maps let variables to their constant value;
+// any other binding maps to NULL.
+//
+// The second pass also moves loop invariant expressions into variables
+// computed before the loop (see loop_class::invariants), and replaces
+// i * k, where i is only changed by an `i <- i + c' statement of the
+// loop body, by a variable stepped by c * k along with i.  A name is
+// invariant in a loop if it is bound outside it and never assigned; for
+// attributes and formals that must hold for the whole program, which
+// the first sweep over all methods (before `finish_scan') records.
+// Expressions in the loop body, or under a cond or case, may not run,
+// so only those that cannot fail are hoisted from there.
+//
+class ConstantFolder {
+private:
+  SymbolTable<Symbol, Expression_class> scope;
+  SymbolTable<Symbol, int> depth;
+  std::map<Symbol, int> assigned;
+  std::set<Symbol> assigned_anywhere;
+  bool scanned;
+  bool propagate;
+  int folded;
+  int hoisted;
+  int reduced;
+
+  struct Induction {
+    Symbol var;
+    int step;
+    assign_class *update;
+    std::map<int, Symbol> derived;
+  };
+  struct Loop {
+    loop_class *loop;
+    int conditional;
+    int effects;
+    std::vector<Induction> inductions;
+  };
+  std::vector<Loop> loops;
+  int conditional;
+  int effects;
+
+  Symbol fresh_name();
+  bool is_invariant(Expression e);
+
+public:
+  ConstantFolder() : scanned(false), propagate(false), folded(0), hoisted(0),
+                     reduced(0), conditional(0), effects(0) { }
+  Expression run(Expression e);
+  void finish_scan() { scanned = true; }
+
+  void enterscope() { scope.enterscope(); depth.enterscope(); }
+  void exitscope() { scope.exitscope(); depth.exitscope(); }
+  void bind(Symbol name, Expression value);
+  Expression lookup(Symbol name) { return scope.lookup(name); }
+
+  void assign(Symbol name) { assigned[name]++; assigned_anywhere.insert(name); }
+  bool propagating(Symbol name) { return propagate && !assigned.count(name); }
+
+  void enter_loop(loop_class *l);
+  void exit_loop() { loops.pop_back(); }
+  void enter_conditional() { conditional++; }
+  void exit_conditional() { conditional--; }
+  // Counts an expression just folded that may have effects, fail or not
+  // terminate, in evaluation order.
+  void effect() { effects++; }
+
+  // `e' is replaced by a variable computed before the innermost loop if
+  // its operands `e1' and `e2' are invariant there.  `total' says it
+  // cannot fail; if it may, it is only moved when it is the first thing
+  // of the loop's predicate to have an effect, as it would fail there
+  // anyway.
+  Expression hoist(Expression e, bool total, Expression e1, Expression e2 = NULL);
+  // var * k is replaced by a strength reduced variable, if var is an
+  // induction variable of an enclosing loop.
+  Expression reduce(Expression e, Symbol var, int k);
+
+  // Each rewrite is counted for the -c report.
+  Expression replace(Expression e) { folded++; return e; }
+  int get_folded() { return folded; }
+  int get_hoisted() { return hoisted; }
+  int get_reduced() { return reduced; }
+};
+
+//
+// Rapid type analysis from Main.main, for dead code elimination.  A
+// method is live if a live method or initializer calls it: directly, by
+// static dispatch or by a dispatch bound by class hierarchy analysis, or
+// as the implementation in a created class of a dynamic dispatch whose
+// static type that class conforms to.  A class is created by a live new;
+// Main and the basic classes always are.  Creating a class runs the
+// initializers of it and its ancestors.  Case branches only compare
+// tags, so they keep nothing alive.
+//
+class Reachability {
+private:
+  CgenClassTableP ct;
+  CgenNodeP cls;
+  std::set<CgenNodeP> created;
+  std::set<CgenNodeP> initialized;
+  std::set<method_class *> live;
+  std::vector<std::pair<CgenNodeP, Symbol> > sites;
+  std::vector<std::pair<CgenNodeP, Expression> > work;
+
+  CgenNodeP resolve(Symbol type);
+  void call(CgenNodeP c, Symbol name);
+
+public:
+  Reachability(CgenClassTableP ct) : ct(ct), cls(NULL) { }
+  void run(Symbol main_class, Symbol main_method);
+
+  void create(Symbol type);
+  void dispatch(Symbol type, Symbol name);
+  void static_dispatch(Symbol type, Symbol name) { call(resolve(type), name); }
+
+  bool is_created(CgenNodeP c) { return created.count(c) > 0; }
+  bool is_initialized(CgenNodeP c) { return initialized.count(c) > 0; }
+  bool is_live(method_class *m) { return live.count(m) > 0; }
+};
+
+//
+// Escape analysis for let variables of type Int and Bool.  A use escapes
+// when it needs the variable as an object (an argument, a receiver, an
+// attribute store, a case scrutinee, a return value); other uses and
+// definitions work on raw values.  An Int is kept unboxed unless its
+// escaping uses outnumber the definitions that would allocate a box,
+// each counted ten times over per enclosing loop.  Bools box for free.
+// Names bound by anything but a let map to NULL.
+//
+class EscapeAnalysis {
+private:
+  SymbolTable<Symbol, let_class> scope;
+  int weight;
+
+public:
+  EscapeAnalysis() : weight(1) { scope.enterscope(); }
+  void enterscope() { scope.enterscope(); }
+  void exitscope() { scope.exitscope(); }
+  void bind(Symbol name, let_class *let) { scope.addid(name, let); }
+  let_class *lookup(Symbol name) { return scope.lookup(name); }
+
+  void enter_loop() { weight *= 10; }
+  void exit_loop() { weight /= 10; }
+  void use(Symbol name, bool boxed);
+  void define(let_class *let, Expression value);
+};
+
+//
+// The bytecode compiler (CGEN_TARGET=bytecode, see vm.h).  Classes keep
+// their tags, attribute layout and dispatch tables, and every live
+// method and every initializer becomes a bytecode method; the methods
+// of the basic classes are built into the interpreter.  Calls that class
+// hierarchy analysis binds to one method name it directly, the others
+// go through the vtable.
+//
+// Registers are allocated in stack order after self and the formals:
+// `mark' remembers the top and `release' pops back to it.  `vars' maps
+// a formal or a let or case variable to its register, and an attribute
+// to -(i + 1), i being its index in the object.  `operand' gives the
+// register holding the value of an expression, which is the variable's
+// own register for a variable and a fresh one otherwise.
+//
+class VmCompiler {
+private:
+  CgenClassTableP ct;
+  VmProgram prog;
+  CgenNodeP cls;
+  std::vector<int32_t> *code;
+  SymbolTable<Symbol, int> vars;
+  int next_reg;
+  int max_regs;
+  std::map<std::string, int> strings;
+  std::map<std::pair<int, int>, int> consts;
+  std::map<method_class *, int> method_index;
+  std::map<CgenNodeP, int> init_index;
+
+  int add_string(const std::string& s);
+  int add_const(int kind, int value);
+  int builtin_of(Symbol name);
+  void begin_method(CgenNodeP c, VmMethodInfo& m);
+  void end_method(VmMethodInfo& m);
+  void code_method(CgenNodeP c, method_class *m, VmMethodInfo& info);
+  void code_init(CgenNodeP c, VmMethodInfo& info);
+
+public:
+  VmCompiler(CgenClassTableP ct) : ct(ct), cls(NULL), code(NULL),
+                                   next_reg(0), max_regs(0) { }
+  void compile();
+  const VmProgram& get_program() { return prog; }
+
+  CgenClassTableP get_classtable() { return ct; }
+  CgenNodeP get_class() { return cls; }
+
+  // Appends an instruction and returns its index; `set_target' points
+  // the jump at index `at' to the next instruction.
+  int emit(VmOp op, int a = 0, int b = 0, int c = 0, int d = 0);
+  int here() { return code->size(); }
+  void set_target(int at) { (*code)[at + vm_op_args[(*code)[at]]] = here(); }
+
+  int mark() { return next_reg; }
+  void release(int m) { next_reg = m; }
+  int alloc(int n = 1);
+  int operand(Expression e);
+
+  void enterscope() { vars.enterscope(); }
+  void exitscope() { vars.exitscope(); }
+  void bind(Symbol name, int reg) { vars.addid(name, new int(reg)); }
+  int lookup(Symbol name) { return *vars.lookup(name); }
+
+  int int_const(int v) { return add_const(VmConst::INT, v); }
+  int bool_const(bool v) { return add_const(VmConst::BOOL, v); }
+  int string_const(Symbol s) { return add_const(VmConst::STRING, add_string(s->get_string())); }
+  int void_const() { return add_const(VmConst::VOID, 0); }
+  int default_const(Symbol type);
+
+  // The method `name' of class `impl', or -1 if it is dead.
+  int method_of(Symbol impl, Symbol name);
+  int add_site(int line, int target);
+  int add_case(int line);
+  void add_branch(int table, CgenNodeP c);
+};
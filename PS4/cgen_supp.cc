@@ -5,7 +5,7 @@
 
 #include <iostream>
 
-static int ascii = 0;
+static thread_local int ascii = 0;
 
 static void ascii_mode(std::ostream& str)
 {
@@ -2,6 +2,8 @@
 #define COOL_TREE_HANDCODE_H
 
 #include <iostream>
+#include <utility>
+#include <vector>
 #include "tree.h"
 #include "stringtab.h"
 #define yylineno curr_lineno
@@ -20,6 +22,17 @@ Symbol copy_Symbol(Symbol b);
 
 typedef const char* Register;
 
+class CgenEnvironment;
+typedef CgenEnvironment *CgenEnvironmentP;
+class EscapeAnalysis;
+typedef EscapeAnalysis *EscapeAnalysisP;
+class ConstantFolder;
+typedef ConstantFolder *ConstantFolderP;
+class Reachability;
+typedef Reachability *ReachabilityP;
+class VmCompiler;
+typedef VmCompiler *VmCompilerP;
+
 class Program_class;
 typedef Program_class *Program;
 class Class__class;
@@ -32,6 +45,7 @@ class Expression_class;
 typedef Expression_class *Expression;
 class Case_class;
 typedef Case_class *Case;
+class assign_class;
 
 
 typedef list_node<Class_> Classes_class;
@@ -57,47 +71,232 @@ typedef Cases_class *Cases;
   virtual Symbol get_name() = 0;			\
   virtual Symbol get_parent() = 0;			\
   virtual Symbol get_filename() = 0;			\
+  virtual Features get_features() = 0;			\
   virtual void dump_with_types(ostream&,int) = 0;
 
 #define class__EXTRAS                                  \
   Symbol get_name()   { return name; }		       \
   Symbol get_parent() { return parent; }     	       \
   Symbol get_filename() { return filename; }	       \
+  Features get_features() { return features; }	       \
   void dump_with_types(ostream&,int);
 
 #define Feature_EXTRAS						\
+  virtual bool is_method() = 0;					\
+  virtual Symbol get_name() = 0;				\
   virtual void dump_with_types(ostream&,int) = 0;
 
 #define Feature_SHARED_EXTRAS					\
   void dump_with_types(ostream&,int);
 
+#define method_EXTRAS						\
+  bool is_method() { return true; }				\
+  Symbol get_name() { return name; }				\
+  Formals get_formals() { return formals; }			\
+  Symbol get_return_type() { return return_type; }		\
+  Expression get_expr() { return expr; }			\
+  void fold_constants(ConstantFolderP);				\
+  void code(ostream&, CgenEnvironmentP);			\
+  bool live = true;
+
+#define attr_EXTRAS						\
+  bool is_method() { return false; }				\
+  Symbol get_name() { return name; }				\
+  Symbol get_type_decl() { return type_decl; }			\
+  Expression get_init() { return init; }			\
+  void fold_constants(ConstantFolderP);
+
 
 #define Formal_EXTRAS					\
+  virtual Symbol get_name() = 0;			\
+  virtual Symbol get_type_decl() = 0;			\
   virtual void dump_with_types(ostream&,int) = 0;
 
 #define formal_EXTRAS                           \
+  Symbol get_name() { return name; }		\
+  Symbol get_type_decl() { return type_decl; }	\
   void dump_with_types(ostream&,int);
 
 #define Case_EXTRAS							\
-  virtual void code(ostream&) = 0;					\
+  virtual Symbol get_name() = 0;					\
+  virtual Symbol get_type_decl() = 0;					\
+  virtual Expression get_expr() = 0;					\
   virtual void dump_with_types(ostream& ,int) = 0;
 
 #define branch_EXTRAS						\
-  void code(ostream&);						\
+  Symbol get_name() { return name; }				\
+  Symbol get_type_decl() { return type_decl; }			\
+  Expression get_expr() { return expr; }			\
+  void fold(ConstantFolderP);					\
   void dump_with_types(ostream& ,int);
 
+//
+// `temps_needed' is the Sethi-Ullman number of an expression: how many
+// temporaries must be live at once to evaluate it.  It is computed on
+// first use and cached in `temps'.  `is_pure' is true for expressions
+// whose evaluation has no side effects, but which may still fail: Int
+// arithmetic traps on overflow and division by zero.  `is_total' is true
+// for pure expressions that cannot fail, which may be dropped or moved
+// to where they might not have run; of two pure expressions, one must
+// be total for their order to be changed.
+//
+// `inline_cost' is the size of an expression for the inliner, or more
+// than INLINE_LIMIT if it may not be inlined.  `is_self' and
+// `exact_type' tell what is known about the class of a value.
+// `is_constant_object' is true if `code' always leaves one of the
+// constant objects of the data segment in ACC, which the collector
+// neither moves nor needs to remember in its assignment table.
+//
+// Expressions of type Int or Bool can also be generated with
+// `code_unboxed', which leaves the raw value in ACC instead of a pointer
+// to an object.  `code_discard' generates an expression whose value is
+// not used.  `code_tail' generates an expression whose value the method
+// returns, so a call can reuse the frame.  `find_escapes' decides which
+// let variables may be kept unboxed: `boxed' says whether the context
+// needs the value as an object.
+//
+// `fold' returns the expression with its constant parts evaluated (see
+// ConstantFolder in cgen.h).  `int_value', `bool_value' and
+// `string_value' give the value of a constant.  `find_calls' reports the
+// classes an expression creates and the methods it calls.
+//
+// For the loop optimizer, `variable' is the name an object expression
+// refers to, `statements' lists the statements of a block, and
+// `induction_step' recognizes an assignment `i <- i + c' (for which
+// `increment_of' recognizes the right side), returning the assignment.
+//
+// `vm_code' compiles an expression to bytecode that leaves its value in
+// register `dest' (see VmCompiler in cgen.h).
+//
 #define Expression_EXTRAS					   \
-  virtual void code(ostream&) = 0;				   \
+  virtual void code(ostream&, CgenEnvironmentP) = 0;		   \
+  virtual void code_unboxed(ostream&, CgenEnvironmentP);	   \
+  virtual bool has_unboxed_code() { return false; }		   \
+  virtual void code_discard(ostream&, CgenEnvironmentP);	   \
+  virtual void code_tail(ostream&, CgenEnvironmentP);		   \
+  virtual bool allocates_int() { return false; }		   \
+  virtual int temps_needed() = 0;				   \
+  virtual void find_escapes(EscapeAnalysisP, bool boxed) = 0;	   \
+  virtual int inline_cost() = 0;				   \
+  virtual bool is_self() { return false; }			   \
+  virtual Symbol exact_type() { return NULL; }			   \
+  virtual bool is_constant_object() { return false; }		   \
+  virtual bool is_pure() { return false; }			   \
+  virtual bool is_total() { return false; }			   \
+  virtual bool is_no_expr() { return false; }			   \
+  virtual Expression fold(ConstantFolderP) = 0;			   \
+  virtual bool int_value(int&) { return false; }		   \
+  virtual bool bool_value(bool&) { return false; }		   \
+  virtual Symbol string_value() { return NULL; }		   \
+  virtual void find_calls(ReachabilityP) = 0;			   \
+  virtual void vm_code(VmCompilerP, int dest) = 0;		   \
+  virtual Symbol variable() { return NULL; }			   \
+  virtual void statements(std::vector<Expression>& s) { s.push_back(this); } \
+  virtual assign_class *induction_step(Symbol&, int&) { return NULL; } \
+  virtual bool increment_of(Symbol, int&) { return false; }	   \
+  int temps;							   \
   Symbol type;							   \
   Symbol get_type() { return type; }				   \
   Expression set_type(Symbol s) { type = s; return this; }	   \
   virtual void dump_with_types(ostream&,int) = 0;		   \
   void dump_type(ostream&, int);				   \
-  Expression_class() { type = (Symbol) NULL; }
+  Expression_class() { type = (Symbol) NULL; temps = -1; }
 
 #define Expression_SHARED_EXTRAS				\
-  void code(ostream&);						\
+  void code(ostream&, CgenEnvironmentP);			\
+  int temps_needed();						\
+  void find_escapes(EscapeAnalysisP, bool);			\
+  int inline_cost();						\
+  Expression fold(ConstantFolderP);				\
+  void find_calls(ReachabilityP);				\
+  void vm_code(VmCompilerP, int dest);				\
   void dump_with_types(ostream&,int);
 
+#define unboxed_EXTRAS						\
+  void code_unboxed(ostream&, CgenEnvironmentP);		\
+  bool has_unboxed_code() { return true; }
+
+#define pure_unary_EXTRAS					\
+  bool is_pure() { return e1->is_pure(); }
+
+#define pure_binary_EXTRAS					\
+  bool is_pure() { return e1->is_pure() && e2->is_pure(); }
+
+// Operators that cannot fail are total when their operands are.
+#define total_unary_EXTRAS pure_unary_EXTRAS			\
+  bool is_total() { return e1->is_total(); }
+
+#define total_binary_EXTRAS pure_binary_EXTRAS			\
+  bool is_total() { return e1->is_total() && e2->is_total(); }
+
+// A dispatch that is inlined can produce its value unboxed.
+#define dispatch_EXTRAS						\
+  void code_unboxed(ostream&, CgenEnvironmentP);		\
+  void code_tail(ostream&, CgenEnvironmentP);
+#define static_dispatch_EXTRAS dispatch_EXTRAS
+
+// `derived' lists the strength reduced variables to step, and by how
+// much, whenever the assignment runs (see ConstantFolder in cgen.h).
+#define assign_EXTRAS						\
+  unboxed_EXTRAS						\
+  void code_discard(ostream&, CgenEnvironmentP);		\
+  std::vector<std::pair<Symbol, int> > derived;			\
+  void code_steps(ostream&, CgenEnvironmentP);			\
+  assign_class *induction_step(Symbol&, int&);
+
+// Variables holding loop invariants and strength reduced values are
+// computed from these expressions before the loop starts.
+#define loop_EXTRAS						\
+  std::vector<std::pair<Symbol, Expression> > invariants;	\
+  Expression get_body() { return body; }
+#define tail_EXTRAS						\
+  void code_tail(ostream&, CgenEnvironmentP);
+
+#define cond_EXTRAS unboxed_EXTRAS tail_EXTRAS
+#define block_EXTRAS unboxed_EXTRAS tail_EXTRAS			\
+  void statements(std::vector<Expression>&);
+#define typcase_EXTRAS tail_EXTRAS					\
+  void code_case(ostream&, CgenEnvironmentP, bool tail);
+
+// `unboxed' is set by escape analysis when the variable lives in its
+// frame slot as a raw value; the counts are the analysis' cost model.
+#define let_EXTRAS						\
+  bool unboxed = false;						\
+  int boxed_uses = 0;						\
+  int allocating_defs = 0;					\
+  void code_bind(ostream&, CgenEnvironmentP);			\
+  unboxed_EXTRAS tail_EXTRAS
+
+// Boxed Int arithmetic allocates its result.
+#define arith_EXTRAS						\
+  bool allocates_int() { return true; }
+
+#define plus_EXTRAS pure_binary_EXTRAS unboxed_EXTRAS arith_EXTRAS \
+  bool increment_of(Symbol, int&);
+#define sub_EXTRAS pure_binary_EXTRAS unboxed_EXTRAS arith_EXTRAS \
+  bool increment_of(Symbol, int&);
+#define mul_EXTRAS total_binary_EXTRAS unboxed_EXTRAS arith_EXTRAS
+#define divide_EXTRAS pure_binary_EXTRAS unboxed_EXTRAS arith_EXTRAS
+// Comparisons produce one of the two Bool constants.
+#define constant_EXTRAS						\
+  bool is_constant_object() { return true; }
+
+#define lt_EXTRAS total_binary_EXTRAS unboxed_EXTRAS constant_EXTRAS
+#define eq_EXTRAS total_binary_EXTRAS unboxed_EXTRAS constant_EXTRAS
+#define leq_EXTRAS total_binary_EXTRAS unboxed_EXTRAS constant_EXTRAS
+#define neg_EXTRAS pure_unary_EXTRAS unboxed_EXTRAS arith_EXTRAS
+#define comp_EXTRAS total_unary_EXTRAS unboxed_EXTRAS constant_EXTRAS
+#define isvoid_EXTRAS total_unary_EXTRAS constant_EXTRAS
+#define leaf_EXTRAS bool is_pure() { return true; } bool is_total() { return true; }
+#define int_const_EXTRAS leaf_EXTRAS unboxed_EXTRAS \
+  constant_EXTRAS bool int_value(int&);
+#define bool_const_EXTRAS leaf_EXTRAS unboxed_EXTRAS \
+  constant_EXTRAS bool bool_value(bool& v) { v = val; return true; }
+#define string_const_EXTRAS leaf_EXTRAS \
+  constant_EXTRAS Symbol string_value() { return token; }
+#define object_EXTRAS leaf_EXTRAS bool is_self(); unboxed_EXTRAS \
+  Symbol variable() { return name; }
+#define new__EXTRAS Symbol exact_type(); bool is_constant_object();
+#define no_expr_EXTRAS bool is_no_expr() { return true; }
 
 #endif  // COOL_TREE_HANDCODE_H
@@ -0,0 +1,340 @@
+//
+// coolbench: times each phase of the compiler on a corpus of programs.
+//
+//     coolbench [-n repeats] [-t percent] [-b baseline.json] [-o report.json]
+//               prog.cl|a.cl+b.cl ...
+//
+// Every program (a list of files joined by `+') is run through ./lexer,
+// ./parser, ./semant and ./cgen, each phase reading the output of the
+// one before from a file, so that it is timed on its own.  Each phase is
+// run `repeats' times (3) and the fastest run counts.  The report gives
+// the tokens lexed, AST nodes parsed, classes type checked and MIPS
+// instructions emitted per second over the whole corpus, and the peak
+// resident set of any phase.  Where the machine lets it, each phase is
+// also counted with hardware counters (see perf.h), which are reported
+// with the fastest run.
+//
+// With -b the report is compared with an earlier one, and coolbench
+// exits with status 1 when a rate has fallen, or the peak resident set
+// has grown, by more than the threshold (10 percent).
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "perf.h"
+
+enum Phase { LEXER, PARSER, SEMANT, CGEN, PHASES };
+
+static const char *phase_names[] = { "lexer", "parser", "semant", "cgen" };
+
+// The quantities the phases are measured by, and their rates in the report.
+static const char *unit_names[] = { "tokens", "nodes", "classes", "instructions" };
+static const char *rate_names[] = {
+  "tokens_per_sec", "nodes_per_sec", "classes_per_sec", "instructions_per_sec"
+};
+
+struct Run {
+  double seconds;
+  long rss_kb;
+  PerfCounts counts;
+};
+
+struct Program {
+  std::string name;
+  std::vector<std::string> files;
+  long count[PHASES];
+  Run best[PHASES];
+};
+
+static std::string tmpdir;
+
+[[noreturn]] static void fatal(const std::string& msg)
+{
+  std::cerr << "coolbench: " << msg << std::endl;
+  exit(2);
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//
+// Runs argv with its standard input and output redirected to the given
+// files (NULL for none), and returns its wall time, peak resident set
+// and counts.  The child waits for its counters to be opened before it
+// calls exec, where they start.
+//
+static Run run(const std::vector<std::string>& argv, const char *in, const char *out)
+{
+  int go[2];
+  if (pipe(go) < 0)
+    fatal(std::string("pipe: ") + strerror(errno));
+  double start = now();
+  pid_t pid = fork();
+  if (pid < 0)
+    fatal(std::string("fork: ") + strerror(errno));
+  if (pid == 0) {
+    char c;
+    close(go[1]);
+    if (::read(go[0], &c, 1) != 1)
+      _exit(127);
+    close(go[0]);
+    if (in && dup2(open(in, O_RDONLY), 0) < 0)
+      _exit(127);
+    int fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || dup2(fd, 1) < 0)
+      _exit(127);
+    std::vector<char *> args;
+    for (const std::string& a : argv)
+      args.push_back((char *) a.c_str());
+    args.push_back(NULL);
+    execv(args[0], args.data());
+    _exit(127);
+  }
+
+  PerfCounters counters(pid, true);
+  close(go[0]);
+  if (write(go[1], "", 1) != 1)
+    fatal(std::string("write: ") + strerror(errno));
+  close(go[1]);
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0)
+    fatal(std::string("wait: ") + strerror(errno));
+  Run r = { now() - start, usage.ru_maxrss, counters.read() };
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    fatal(argv[0] + " failed");
+  return r;
+}
+
+//
+// The number of lines of the file satisfying match.
+//
+template <class Match>
+static long count_lines(const std::string& file, Match match)
+{
+  std::ifstream in(file);
+  std::string line;
+  long n = 0;
+  while (std::getline(in, line))
+    if (match(line))
+      n++;
+  return n;
+}
+
+static long count(Phase p, const std::string& file)
+{
+  switch (p) {
+  case LEXER:
+    // `#12 TYPEID Main'
+    return count_lines(file, [](const std::string& l)
+                       { return l.size() > 1 && l[0] == '#' && isdigit(l[1]); });
+  case PARSER:
+  case SEMANT: {
+    // every node of the dump starts a line with its constructor, `_plus'
+    const char *node = p == PARSER ? "_" : "_class";
+    return count_lines(file, [node, p](const std::string& l) {
+        size_t i = l.find_first_not_of(' ');
+        return i != std::string::npos && l.compare(i, strlen(node), node) == 0 &&
+               (p == PARSER || l.size() == i + strlen(node));
+      });
+  }
+  default:
+    // `\tlw\t$a0 ...', not a directive
+    return count_lines(file, [](const std::string& l)
+                       { return l.size() > 1 && l[0] == '\t' && l[1] != '.'; });
+  }
+}
+
+static void measure(Program& prog, int repeats)
+{
+  std::string stage[PHASES];
+  for (int p = 0; p < PHASES; p++)
+    stage[p] = tmpdir + "/" + phase_names[p] + ".out";
+
+  for (int p = 0; p < PHASES; p++) {
+    std::vector<std::string> argv = { std::string("./") + phase_names[p] };
+    if (p == LEXER)
+      argv.insert(argv.end(), prog.files.begin(), prog.files.end());
+    const char *in = p == LEXER ? NULL : stage[p - 1].c_str();
+    for (int i = 0; i < repeats; i++) {
+      Run r = run(argv, in, stage[p].c_str());
+      if (i == 0 || r.seconds < prog.best[p].seconds) {
+        prog.best[p].seconds = r.seconds;
+        prog.best[p].counts = r.counts;
+      }
+      if (i == 0 || r.rss_kb > prog.best[p].rss_kb)
+        prog.best[p].rss_kb = r.rss_kb;
+    }
+    prog.count[p] = count((Phase) p, stage[p]);
+  }
+}
+
+struct Totals {
+  double rate[PHASES];
+  long peak_rss_kb;
+};
+
+static Totals totals(const std::vector<Program>& progs)
+{
+  Totals t;
+  t.peak_rss_kb = 0;
+  for (int p = 0; p < PHASES; p++) {
+    double seconds = 0, n = 0;
+    for (const Program& prog : progs) {
+      seconds += prog.best[p].seconds;
+      n += prog.count[p];
+      t.peak_rss_kb = std::max(t.peak_rss_kb, prog.best[p].rss_kb);
+    }
+    t.rate[p] = seconds > 0 ? n / seconds : 0;
+  }
+  return t;
+}
+
+//
+// The counters of a phase that were available, as more JSON fields.
+//
+static std::string counts(const PerfCounts& c)
+{
+  std::stringstream s;
+  for (int e = 0; e < PERF_EVENTS; e++)
+    if (c.valid[e])
+      s << ", \"" << perf_event_names[e] << "\": " << c.value[e];
+  return s.str();
+}
+
+static void report(std::ostream& s, const std::vector<Program>& progs, const Totals& t)
+{
+  s << std::fixed << "{" << std::endl << "  \"programs\": [" << std::endl;
+  for (size_t i = 0; i < progs.size(); i++) {
+    const Program& prog = progs[i];
+    s << "    { \"name\": \"" << prog.name << "\"";
+    for (int p = 0; p < PHASES; p++)
+      s << ", \"" << unit_names[p] << "\": " << prog.count[p];
+    for (int p = 0; p < PHASES; p++)
+      s << "," << std::endl << "      \"" << phase_names[p] << "\": { \"seconds\": "
+        << std::setprecision(6) << prog.best[p].seconds << ", \"rss_kb\": "
+        << prog.best[p].rss_kb << counts(prog.best[p].counts) << " }";
+    s << " }" << (i + 1 < progs.size() ? "," : "") << std::endl;
+  }
+  s << "  ]," << std::endl;
+  for (int p = 0; p < PHASES; p++)
+    s << "  \"" << rate_names[p] << "\": " << std::setprecision(1) << t.rate[p] << "," << std::endl;
+  s << "  \"peak_rss_kb\": " << t.peak_rss_kb << std::endl << "}" << std::endl;
+}
+
+//
+// The number after "key": in a report; the summary keys occur once.
+//
+static bool lookup(const std::string& json, const std::string& key, double& value)
+{
+  size_t at = json.find("\"" + key + "\":");
+  if (at == std::string::npos)
+    return false;
+  value = strtod(json.c_str() + at + key.size() + 3, NULL);
+  return true;
+}
+
+//
+// Prints each summary figure against the baseline; returns false if any
+// has regressed by more than threshold percent.
+//
+static bool compare(const std::string& baseline, const Totals& t, double threshold)
+{
+  std::ifstream in(baseline);
+  if (!in)
+    fatal("cannot read " + baseline);
+  std::stringstream json;
+  json << in.rdbuf();
+
+  bool ok = true;
+  for (int p = 0; p <= PHASES; p++) {
+    std::string key = p < PHASES ? rate_names[p] : "peak_rss_kb";
+    double after = p < PHASES ? t.rate[p] : t.peak_rss_kb, before;
+    if (!lookup(json.str(), key, before) || before <= 0)
+      continue;
+    // a rate may not fall, nor the resident set grow
+    double change = (after - before) / before * 100;
+    bool worse = p < PHASES ? change < -threshold : change > threshold;
+    std::cerr << std::left << std::setw(22) << key << std::right << std::fixed
+              << std::setprecision(1) << std::setw(14) << before << " -> "
+              << std::setw(14) << after << std::showpos << std::setw(8) << change
+              << std::noshowpos << "%" << (worse ? "  REGRESSED" : "") << std::endl;
+    ok = ok && !worse;
+  }
+  return ok;
+}
+
+static void usage()
+{
+  std::cerr << "usage: coolbench [-n repeats] [-t percent] [-b baseline.json] "
+            << "[-o report.json] prog.cl|a.cl+b.cl ..." << std::endl;
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  int repeats = 3;
+  double threshold = 10;
+  const char *baseline = NULL, *output = NULL;
+  int c;
+  while ((c = getopt(argc, argv, "n:t:b:o:")) != -1) {
+    switch (c) {
+    case 'n': repeats = atoi(optarg); break;
+    case 't': threshold = atof(optarg); break;
+    case 'b': baseline = optarg; break;
+    case 'o': output = optarg; break;
+    default: usage();
+    }
+  }
+  if (optind == argc || repeats < 1)
+    usage();
+
+  char dir[] = "/tmp/coolbench.XXXXXX";
+  if (mkdtemp(dir) == NULL)
+    fatal(std::string("mkdtemp: ") + strerror(errno));
+  tmpdir = dir;
+
+  std::vector<Program> progs;
+  for (int i = optind; i < argc; i++) {
+    Program prog;
+    std::stringstream files(argv[i]);
+    std::string f;
+    while (std::getline(files, f, '+'))
+      prog.files.push_back(f);
+    std::string base = prog.files[0].substr(prog.files[0].rfind('/') + 1);
+    prog.name = base.substr(0, base.rfind(".cl"));
+    measure(prog, repeats);
+    progs.push_back(prog);
+  }
+  for (int p = 0; p < PHASES; p++)
+    unlink((tmpdir + "/" + phase_names[p] + ".out").c_str());
+  rmdir(dir);
+
+  Totals t = totals(progs);
+  if (output) {
+    std::ofstream out(output);
+    report(out, progs, t);
+  } else
+    report(std::cout, progs, t);
+
+  if (baseline && !compare(baseline, t, threshold))
+    return 1;
+  return 0;
+}
@@ -0,0 +1,535 @@
+//
+// coolgen: writes synthetic Cool programs for testing the compiler at
+// scale.
+//
+//     coolgen [options] [-o prefix]
+//
+//     -c n   classes (20)                -m n   methods per class (5)
+//     -d n   inheritance depth (4)       -e n   expression depth (4)
+//     -f n   subclasses per class (3)    -l n   let nesting (2)
+//     -s n   string literals per class (4)
+//     -n n   files (1)                   -r n   seed (1)
+//
+// The program goes to prefix.cl, or to prefix1.cl ... prefixN.cl when
+// it is split into N files, or to the standard output without -o.  The
+// same options and seed always give the same program.
+//
+// Every program is type correct and terminates: a method only calls
+// methods of classes defined before its own, or earlier methods of its
+// own class, and makes at most one call, so the calls cannot recurse.
+// Each method reduces its result modulo 4096, and every expression is
+// generated with a bound on its magnitude, so the arithmetic cannot
+// overflow.  Main instantiates every class, calls its methods and prints
+// a checksum, which lets the output of different back ends be compared.
+//
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The bound on variables, arguments and method results.
+static const long VALUE_BOUND = 4096;
+// The bound on the length of a string expression.
+static const long LENGTH_BOUND = 1 << 16;
+
+struct Options {
+  int classes = 20, depth = 4, fanout = 3, methods = 5;
+  int expr_depth = 4, let_depth = 2, strings = 4, files = 1;
+  uint64_t seed = 1;
+};
+
+//
+// splitmix64, so that a seed names the same program on every platform
+// (the distributions of <random> are not portable).
+//
+class Random {
+public:
+  Random(uint64_t seed) : state(seed) { }
+  uint64_t next()
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+  // uniform in [0, n)
+  int below(int n) { return n <= 0 ? 0 : (int) (next() % (uint64_t) n); }
+  int range(int lo, int hi) { return lo + below(hi - lo + 1); }
+  bool chance(int percent) { return below(100) < percent; }
+
+private:
+  uint64_t state;
+};
+
+struct Class {
+  int parent;                       // -1 for a class inheriting from IO
+  int depth;
+  std::vector<std::string> ints;    // Int attributes
+  std::vector<std::string> strs;    // String attributes
+  std::vector<int> str_lengths;
+};
+
+class Generator {
+public:
+  Generator(const Options& opt) : opt(opt), rnd(opt.seed) { }
+  void hierarchy();
+  void write_class(int c, std::ostream& s);
+  void write_main(std::ostream& s);
+  int file_of(int c) { return (int) ((long) c * opt.files / opt.classes); }
+
+private:
+  const Options& opt;
+  Random rnd;
+  std::vector<Class> classes;
+
+  // state of the method being generated
+  int cls;
+  int method;
+  int lets;
+  int calls;
+  std::vector<std::string> locals;
+
+  std::string int_expr(int d, long limit, int indent);
+  std::string bool_expr(int d, int indent);
+  std::string str_expr(int d, int indent, long& length);
+  std::string variable();
+  std::string call(int d, int indent);
+  std::string literal(int& length);
+  std::string attr_name(int c, const char *kind, int i);
+  std::string newline(int indent) { return "\n" + std::string(indent, ' '); }
+  std::vector<int> ancestors(int c);
+};
+
+std::string Generator::attr_name(int c, const char *kind, int i)
+{
+  std::stringstream s;
+  s << kind << c << "_" << i;
+  return s.str();
+}
+
+std::vector<int> Generator::ancestors(int c)
+{
+  std::vector<int> result;
+  for (int a = classes[c].parent; a >= 0; a = classes[a].parent)
+    result.push_back(a);
+  return result;
+}
+
+//
+// Classes are added breadth first: each is a subclass of the oldest
+// class that still has room for one within the depth limit, or starts
+// a new tree under IO when there is none.
+//
+void Generator::hierarchy()
+{
+  std::vector<int> open, children(opt.classes, 0);
+  size_t next = 0;
+  for (int c = 0; c < opt.classes; c++) {
+    while (next < open.size() && children[open[next]] >= opt.fanout)
+      next++;
+    Class k;
+    if (next < open.size()) {
+      k.parent = open[next];
+      k.depth = classes[k.parent].depth + 1;
+      children[k.parent]++;
+    } else {
+      k.parent = -1;
+      k.depth = 1;
+    }
+    if (k.depth < opt.depth && opt.fanout > 0)
+      open.push_back(c);
+
+    int ints = rnd.range(1, 3);
+    for (int i = 0; i < ints; i++)
+      k.ints.push_back(attr_name(c, "a", i));
+    for (int i = 0; i < opt.strings; i++) {
+      k.strs.push_back(attr_name(c, "s", i));
+      k.str_lengths.push_back(0);
+    }
+    classes.push_back(k);
+  }
+}
+
+static const char *words[] = {
+  "alpha", "beta", "gamma", "delta", "cool", "class", "object", "string",
+  "method", "parse", "lex", "emit", "spill", "heap", "stack", "dispatch",
+};
+
+//
+// A string literal of a few words, with the occasional escape.
+//
+std::string Generator::literal(int& length)
+{
+  std::string s = "\"";
+  length = 0;
+  int n = rnd.range(1, 8);
+  for (int i = 0; i < n; i++) {
+    std::string w = words[rnd.below(sizeof(words) / sizeof(words[0]))];
+    if (i > 0) {
+      if (rnd.chance(10)) {
+        s += "\\t";
+      } else
+        s += " ";
+      length++;
+    }
+    s += w;
+    length += w.size();
+  }
+  if (rnd.chance(20)) {
+    s += "\\\"";
+    length++;
+  }
+  return s + "\"";
+}
+
+//
+// An Int variable: a formal, a let variable or an attribute of this
+// class or one it inherits from.
+//
+std::string Generator::variable()
+{
+  std::vector<std::string> vars = locals;
+  vars.push_back("x");
+  vars.push_back("y");
+  for (const std::string& a : classes[cls].ints)
+    vars.push_back(a);
+  for (int a : ancestors(cls))
+    for (const std::string& v : classes[a].ints)
+      vars.push_back(v);
+  return vars[rnd.below(vars.size())];
+}
+
+//
+// A call with Int arguments: to an earlier method of this class, a
+// method of an ancestor, or a method of an object of an earlier class.
+//
+std::string Generator::call(int d, int indent)
+{
+  std::vector<int> ancs = ancestors(cls);
+  int choice = rnd.below(3);
+  if (choice == 0 && method == 0)
+    choice = 1;
+  if (choice == 1 && ancs.empty())
+    choice = 2;
+  if (choice == 2 && cls == 0)
+    return int_expr(d - 1, VALUE_BOUND, indent);
+
+  calls++;
+  std::stringstream s;
+  if (choice == 0)
+    s << "f" << cls << "_" << rnd.below(method);
+  else if (choice == 1) {
+    int target = ancs[rnd.below(ancs.size())];
+    s << "f" << target << "_" << rnd.below(opt.methods);
+  } else {
+    int target = rnd.below(cls);
+    s << "(new C" << target << ").f" << target << "_" << rnd.below(opt.methods);
+  }
+  s << "(" << int_expr(d - 1, VALUE_BOUND, indent) << ", "
+    << int_expr(d - 1, VALUE_BOUND, indent) << ")";
+  return s.str();
+}
+
+//
+// An Int expression of depth at most d whose value is at most limit in
+// magnitude.
+//
+std::string Generator::int_expr(int d, long limit, int indent)
+{
+  std::stringstream s;
+  if (d <= 0 || rnd.chance(15)) {
+    if (limit >= VALUE_BOUND && rnd.chance(60))
+      return variable();
+    s << rnd.range(0, (int) std::min(limit, 1000L));
+    return s.str();
+  }
+
+  switch (rnd.below(12)) {
+  case 0:
+  case 1:
+    s << "(" << int_expr(d - 1, limit / 2, indent) << " + "
+      << int_expr(d - 1, limit / 2, indent) << ")";
+    break;
+  case 2:
+    s << "(" << int_expr(d - 1, limit / 2, indent) << " - "
+      << int_expr(d - 1, limit / 2, indent) << ")";
+    break;
+  case 3: {
+    int k = rnd.range(1, 9);
+    s << "(" << int_expr(d - 1, limit / k, indent) << " * " << k << ")";
+    break;
+  }
+  case 4:
+    s << "(" << int_expr(d - 1, limit, indent) << " / " << rnd.range(1, 9) << ")";
+    break;
+  case 5:
+    s << "(~" << int_expr(d - 1, limit, indent) << ")";
+    break;
+  case 6:
+    s << "if " << bool_expr(d - 1, indent + 3) << " then"
+      << newline(indent + 3) << int_expr(d - 1, limit, indent + 3)
+      << newline(indent) << "else"
+      << newline(indent + 3) << int_expr(d - 1, limit, indent + 3)
+      << newline(indent) << "fi";
+    break;
+  case 7: {
+    if (lets >= opt.let_depth || limit < VALUE_BOUND)
+      return int_expr(d - 1, limit, indent);
+    std::stringstream v;
+    v << "v" << locals.size();
+    std::string init = int_expr(d - 1, VALUE_BOUND, indent + 3);
+    lets++;
+    locals.push_back(v.str());
+    s << "(let " << v.str() << " : Int <- " << init << " in"
+      << newline(indent + 3) << int_expr(d - 1, limit, indent + 3) << ")";
+    locals.pop_back();
+    lets--;
+    break;
+  }
+  case 8:
+    if (calls > 0 || limit < VALUE_BOUND || opt.methods == 0)
+      return int_expr(d - 1, limit, indent);
+    return call(d, indent);
+  case 9: {
+    // a loop of a few iterations, with no calls in it
+    if (lets >= opt.let_depth || limit < VALUE_BOUND)
+      return int_expr(d - 1, limit, indent);
+    std::stringstream i;
+    i << "i" << locals.size();
+    s << "(let " << i.str() << " : Int <- 0 in {"
+      << newline(indent + 3) << "while " << i.str() << " < " << rnd.range(1, 10)
+      << " loop " << i.str() << " <- " << i.str() << " + 1 pool;"
+      << newline(indent + 3) << i.str() << ";"
+      << newline(indent) << "})";
+    break;
+  }
+  case 10: {
+    if (limit < LENGTH_BOUND)
+      return int_expr(d - 1, limit, indent);
+    long length;
+    s << "(" << str_expr(d - 1, indent, length) << ").length()";
+    break;
+  }
+  default: {
+    // a case on self with a branch for each class it may be
+    if (limit < 3)
+      return int_expr(d - 1, limit, indent);
+    s << "case self of";
+    s << newline(indent + 3) << "o : Object => " << rnd.range(0, 1) << ";";
+    s << newline(indent + 3) << "c : C" << cls << " => 2;";
+    if (classes[cls].parent >= 0)
+      s << newline(indent + 3) << "p : C" << classes[cls].parent << " => 3;";
+    s << newline(indent) << "esac";
+    break;
+  }
+  }
+  return s.str();
+}
+
+std::string Generator::bool_expr(int d, int indent)
+{
+  static const char *ops[] = { " < ", " <= ", " = " };
+  std::stringstream s;
+  switch (rnd.below(d <= 0 ? 1 : 4)) {
+  case 0:
+    s << int_expr(d - 1, VALUE_BOUND, indent) << ops[rnd.below(3)]
+      << int_expr(d - 1, VALUE_BOUND, indent);
+    break;
+  case 1:
+    s << "not (" << bool_expr(d - 1, indent) << ")";
+    break;
+  case 2:
+    s << (rnd.chance(50) ? "isvoid self" : "true");
+    break;
+  default: {
+    long a, b;
+    s << str_expr(d - 1, indent, a) << " = " << str_expr(d - 1, indent, b);
+    break;
+  }
+  }
+  return s.str();
+}
+
+//
+// A String expression; length is set to a bound on its length.
+//
+std::string Generator::str_expr(int d, int indent, long& length)
+{
+  const Class& k = classes[cls];
+  std::stringstream s;
+  if (d <= 0 || k.strs.empty() || rnd.chance(20)) {
+    if (!k.strs.empty() && rnd.chance(70)) {
+      int i = rnd.below(k.strs.size());
+      length = k.str_lengths[i];
+      return k.strs[i];
+    }
+    length = 2 + 16;
+    return rnd.chance(50) ? "type_name()" : "\"\"";
+  }
+
+  switch (rnd.below(3)) {
+  case 0: {
+    long a, b;
+    std::string left = str_expr(d - 1, indent, a);
+    std::string right = str_expr(d - 1, indent, b);
+    if (a + b > LENGTH_BOUND)
+      return str_expr(0, indent, length);
+    s << left << ".concat(" << right << ")";
+    length = a + b;
+    break;
+  }
+  case 1: {
+    int i = rnd.below(k.strs.size());
+    int n = k.str_lengths[i];
+    int start = rnd.below(n);
+    length = rnd.range(0, n - start);
+    s << k.strs[i] << ".substr(" << start << ", " << length << ")";
+    break;
+  }
+  default: {
+    long a, b;
+    s << "(if " << bool_expr(d - 1, indent) << " then "
+      << str_expr(d - 1, indent, a) << " else " << str_expr(d - 1, indent, b)
+      << " fi)";
+    length = std::max(a, b);
+    break;
+  }
+  }
+  return s.str();
+}
+
+void Generator::write_class(int c, std::ostream& s)
+{
+  Class& k = classes[c];
+  cls = c;
+  s << "class C" << c << " inherits "
+    << (k.parent < 0 ? std::string("IO") : "C" + std::to_string(k.parent))
+    << " {" << std::endl;
+  for (const std::string& a : k.ints)
+    s << "   " << a << " : Int <- " << rnd.range(0, 1000) << ";" << std::endl;
+  for (size_t i = 0; i < k.strs.size(); i++) {
+    int length;
+    std::string lit = literal(length);
+    k.str_lengths[i] = length;
+    s << "   " << k.strs[i] << " : String <- " << lit << ";" << std::endl;
+  }
+
+  for (method = 0; method < opt.methods; method++) {
+    lets = calls = 0;
+    locals.clear();
+    s << std::endl
+      << "   f" << c << "_" << method << "(x : Int, y : Int) : Int {" << std::endl
+      << "      let r : Int <-" << std::endl
+      << "         " << int_expr(opt.expr_depth, 1L << 30, 9) << std::endl
+      << "      in r - r / " << VALUE_BOUND << " * " << VALUE_BOUND << std::endl
+      << "   };" << std::endl;
+  }
+
+  // value() is overridden in every class; it calls its own last method
+  // and, by static dispatch, the one it overrides
+  s << std::endl << "   value(x : Int) : Int {" << std::endl;
+  std::string own = "f" + std::to_string(c) + "_" + std::to_string(opt.methods - 1) + "(x, x)";
+  if (opt.methods == 0)
+    own = "x";
+  if (k.parent < 0)
+    s << "      " << own << std::endl;
+  else
+    s << "      let r : Int <- self@C" << k.parent << ".value(x) + " << own << " in" << std::endl
+      << "         r - r / " << VALUE_BOUND << " * " << VALUE_BOUND << std::endl;
+  s << "   };" << std::endl;
+
+  if (!k.strs.empty()) {
+    method = opt.methods;
+    lets = calls = 0;
+    locals.clear();
+    long length;
+    s << std::endl << "   text(x : Int, y : Int) : String {" << std::endl
+      << "      " << str_expr(opt.expr_depth, 6, length) << std::endl
+      << "   };" << std::endl;
+  }
+  s << "};" << std::endl << std::endl;
+}
+
+void Generator::write_main(std::ostream& s)
+{
+  s << "class Main inherits IO {" << std::endl
+    << "   total : Int <- 0;" << std::endl << std::endl
+    << "   add(v : Int) : Int {" << std::endl
+    << "      total <- (total + v) - (total + v) / " << VALUE_BOUND << " * " << VALUE_BOUND << std::endl
+    << "   };" << std::endl << std::endl
+    << "   main() : Object {{" << std::endl;
+  for (int c = 0; c < opt.classes; c++) {
+    s << "      add((new C" << c << ").value(" << c % 100 << "));" << std::endl;
+    if (opt.strings > 0)
+      s << "      add((new C" << c << ").text(" << c % 100 << ", 1).length());" << std::endl;
+  }
+  s << "      out_int(total);" << std::endl
+    << "      out_string(\"\\n\");" << std::endl
+    << "   }};" << std::endl
+    << "};" << std::endl;
+}
+
+static void usage()
+{
+  std::cerr << "usage: coolgen [-c classes] [-d depth] [-f fanout] [-m methods]\n"
+            << "               [-e expr depth] [-l let depth] [-s strings] [-n files]\n"
+            << "               [-r seed] [-o prefix]" << std::endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  Options opt;
+  const char *prefix = NULL;
+  int c;
+  while ((c = getopt(argc, argv, "c:d:f:m:e:l:s:n:r:o:")) != -1) {
+    switch (c) {
+    case 'c': opt.classes = atoi(optarg); break;
+    case 'd': opt.depth = atoi(optarg); break;
+    case 'f': opt.fanout = atoi(optarg); break;
+    case 'm': opt.methods = atoi(optarg); break;
+    case 'e': opt.expr_depth = atoi(optarg); break;
+    case 'l': opt.let_depth = atoi(optarg); break;
+    case 's': opt.strings = atoi(optarg); break;
+    case 'n': opt.files = atoi(optarg); break;
+    case 'r': opt.seed = strtoull(optarg, NULL, 10); break;
+    case 'o': prefix = optarg; break;
+    default: usage();
+    }
+  }
+  if (optind != argc || opt.classes < 1 || opt.depth < 1 || opt.methods < 0 ||
+      opt.files < 1 || opt.strings < 0 || (opt.files > 1 && prefix == NULL))
+    usage();
+
+  Generator gen(opt);
+  gen.hierarchy();
+
+  std::vector<std::ofstream> files(prefix ? opt.files : 0);
+  for (int f = 0; prefix && f < opt.files; f++) {
+    std::string name = prefix;
+    if (opt.files > 1)
+      name += std::to_string(f + 1);
+    files[f].open(name + ".cl");
+    if (!files[f]) {
+      std::cerr << "coolgen: cannot write " << name << ".cl" << std::endl;
+      return 1;
+    }
+  }
+  auto out = [&](int f) -> std::ostream& { return prefix ? files[f] : std::cout; };
+
+  for (int f = 0; f < opt.files; f++)
+    out(f) << "(*" << std::endl
+           << " *  Generated by coolgen -c " << opt.classes << " -d " << opt.depth
+           << " -f " << opt.fanout << " -m " << opt.methods << " -e " << opt.expr_depth
+           << " -l " << opt.let_depth << " -s " << opt.strings << " -n " << opt.files
+           << " -r " << opt.seed << std::endl
+           << " *)" << std::endl << std::endl;
+  for (int k = 0; k < opt.classes; k++)
+    gen.write_class(k, out(gen.file_of(k)));
+  gen.write_main(out(opt.files - 1));
+  return 0;
+}
@@ -0,0 +1,955 @@
+//
+// coolsim: a small MIPS32 simulator for the output of the Cool code
+// generator, so that programs can be run and measured without SPIM.
+//
+//     ./mycoolc -o prog.s prog.cl
+//     coolsim [-s] [-l n] prog.s
+//
+// coolsim assembles the subset of SPIM assembly that cgen emits, supplies
+// the Cool runtime system (Object.copy, the IO and String methods,
+// equality_test and the abort handlers) as native routines, and runs the
+// program starting the way the SPIM trap handler does: copy Main_protObj,
+// run Main_init, call Main.main.  `add', `addi', `sub' and `neg' trap on
+// overflow and `div' on a zero divisor, as they do on SPIM.  The heap is
+// never collected, so the collector entry points do nothing.
+//
+// Besides the program output it can report instruction, load/store and
+// cycle counts, allocation totals, and a per-label execution histogram,
+// so code generator changes can be measured deterministically.  The
+// cycle count is a simple model: one cycle per instruction, plus one
+// for a load or a taken branch, three for a multiply and eleven for a
+// divide.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#define WORD_SIZE        4
+#define TEXT_BASE        0x00400000u
+#define NATIVE_BASE      0x00300000u
+#define DATA_BASE        0x10000000u
+#define STACK_TOP        0x7ffffffcu
+#define STACK_SIZE       (8 * 1024 * 1024)
+#define HEAP_LIMIT       (256 * 1024 * 1024)
+
+// Cool object layout (see emit.h in the code generator)
+#define TAG_OFFSET       0
+#define SIZE_OFFSET      1
+#define DISPTABLE_OFFSET 2
+#define ATTR_OFFSET      3
+
+//////////////////////////////////////////////////////////////////////
+//
+// Instructions
+//
+//////////////////////////////////////////////////////////////////////
+
+enum Opcode {
+  OP_LW, OP_SW, OP_LB, OP_SB, OP_LI, OP_LA, OP_MOVE, OP_NEG, OP_NEGU, OP_NOT,
+  OP_ADD, OP_ADDU, OP_ADDI, OP_ADDIU, OP_SUB, OP_SUBU, OP_MUL, OP_DIV, OP_REM,
+  OP_AND, OP_ANDI, OP_OR, OP_ORI, OP_XOR, OP_XORI, OP_NOR,
+  OP_SLL, OP_SRL, OP_SRA, OP_SLLV, OP_SRLV, OP_SRAV,
+  OP_SLT, OP_SLTI, OP_SLTU, OP_SEQ, OP_SNE, OP_SLE, OP_SGT, OP_SGE,
+  OP_B, OP_J, OP_JAL, OP_JR, OP_JALR,
+  OP_BEQ, OP_BNE, OP_BLT, OP_BLE, OP_BGT, OP_BGE,
+  OP_BEQZ, OP_BNEZ, OP_BLTZ, OP_BLEZ, OP_BGTZ, OP_BGEZ,
+  OP_NOP
+};
+
+struct OpInfo { const char *name; Opcode op; };
+
+static const OpInfo opinfo[] = {
+  {"lw", OP_LW}, {"sw", OP_SW}, {"lb", OP_LB}, {"sb", OP_SB},
+  {"li", OP_LI}, {"la", OP_LA}, {"move", OP_MOVE}, {"neg", OP_NEG},
+  {"negu", OP_NEGU}, {"not", OP_NOT},
+  {"add", OP_ADD}, {"addu", OP_ADDU}, {"addi", OP_ADDI}, {"addiu", OP_ADDIU},
+  {"sub", OP_SUB}, {"subu", OP_SUBU}, {"mul", OP_MUL}, {"div", OP_DIV},
+  {"rem", OP_REM},
+  {"and", OP_AND}, {"andi", OP_ANDI}, {"or", OP_OR}, {"ori", OP_ORI},
+  {"xor", OP_XOR}, {"xori", OP_XORI}, {"nor", OP_NOR},
+  {"sll", OP_SLL}, {"srl", OP_SRL}, {"sra", OP_SRA},
+  {"sllv", OP_SLLV}, {"srlv", OP_SRLV}, {"srav", OP_SRAV},
+  {"slt", OP_SLT}, {"slti", OP_SLTI}, {"sltu", OP_SLTU}, {"seq", OP_SEQ},
+  {"sne", OP_SNE}, {"sle", OP_SLE}, {"sgt", OP_SGT}, {"sge", OP_SGE},
+  {"b", OP_B}, {"j", OP_J}, {"jal", OP_JAL}, {"jr", OP_JR}, {"jalr", OP_JALR},
+  {"beq", OP_BEQ}, {"bne", OP_BNE}, {"blt", OP_BLT}, {"ble", OP_BLE},
+  {"bgt", OP_BGT}, {"bge", OP_BGE},
+  {"beqz", OP_BEQZ}, {"bnez", OP_BNEZ}, {"bltz", OP_BLTZ}, {"blez", OP_BLEZ},
+  {"bgtz", OP_BGTZ}, {"bgez", OP_BGEZ},
+  {"nop", OP_NOP},
+};
+
+//
+// Operands are decoded at assembly time: rd/rs/rt are register numbers,
+// imm is an immediate, memory offset or shift amount, and target is the
+// resolved address of a label operand.
+//
+struct Instr {
+  Opcode op;
+  int rd, rs, rt;
+  int32_t imm;
+  bool rt_is_imm;           // three-operand forms with an immediate last
+  std::string label;        // unresolved label operand
+  uint32_t target;
+  int line;                 // source line, for error messages
+};
+
+static const char *reg_names[32] = {
+  "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+  "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+  "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+  "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+enum { ZERO = 0, V0 = 2, A0 = 4, A1 = 5, T0 = 8, T1 = 9, T2 = 10,
+       S0 = 16, SP = 29, FP = 30, RA = 31 };
+
+//////////////////////////////////////////////////////////////////////
+//
+// The simulated machine
+//
+//////////////////////////////////////////////////////////////////////
+
+class Machine;
+typedef void (*NativeFn)(Machine&);
+
+struct Native { const char *name; NativeFn fn; };
+
+class Machine {
+public:
+  // memory
+  std::vector<uint8_t> data;          // data segment followed by the heap
+  std::vector<uint8_t> stack;
+  uint32_t heap_start, heap_ptr;
+
+  // program
+  std::vector<Instr> text;
+  std::map<std::string, uint32_t> labels;
+  std::vector<std::string> text_label_at;   // label naming each text address
+  std::vector<NativeFn> natives;
+  std::vector<std::string> native_names;
+
+  // registers
+  int32_t reg[32];
+  uint32_t pc;
+
+  // statistics
+  uint64_t instructions, loads, stores, branches, taken, calls, cycles;
+  uint64_t allocations, allocated_bytes, native_calls;
+  std::vector<uint64_t> exec_count;          // per text instruction
+  bool clobber;                              // trash caller-saved regs in natives
+
+  std::string output;
+  std::istream *input;
+
+  Machine() : heap_start(0), heap_ptr(0), pc(0), instructions(0), loads(0),
+              stores(0), branches(0), taken(0), calls(0), cycles(0),
+              allocations(0), allocated_bytes(0), native_calls(0),
+              clobber(true), input(&std::cin)
+  {
+    memset(reg, 0, sizeof(reg));
+    stack.resize(STACK_SIZE);
+  }
+
+  [[noreturn]] void fatal(const std::string& msg)
+  {
+    flush();
+    std::cerr << "coolsim: " << msg << std::endl;
+    exit(2);
+  }
+
+  // A runtime error of the program, reported as the native runtime does.
+  [[noreturn]] void trap(const char *msg)
+  {
+    flush();
+    std::cerr << msg << std::endl;
+    exit(1);
+  }
+
+  void flush()
+  {
+    std::cout << output;
+    std::cout.flush();
+    output.clear();
+  }
+
+  uint8_t *addr(uint32_t a, int n)
+  {
+    if (a >= DATA_BASE && a + n <= DATA_BASE + data.size())
+      return &data[a - DATA_BASE];
+    uint32_t stack_base = STACK_TOP + WORD_SIZE - STACK_SIZE;
+    if (a >= stack_base && a + n <= STACK_TOP + WORD_SIZE)
+      return &stack[a - stack_base];
+    std::stringstream ss;
+    ss << "bad address 0x" << std::hex << a << std::dec << " at " << where();
+    fatal(ss.str());
+  }
+
+  int32_t load_word(uint32_t a)
+  {
+    if (a & 3) fatal("unaligned load at " + where());
+    int32_t v; memcpy(&v, addr(a, 4), 4); return v;
+  }
+  void store_word(uint32_t a, int32_t v)
+  {
+    if (a & 3) fatal("unaligned store at " + where());
+    memcpy(addr(a, 4), &v, 4);
+  }
+  uint8_t load_byte(uint32_t a) { return *addr(a, 1); }
+  void store_byte(uint32_t a, uint8_t v) { *addr(a, 1) = v; }
+
+  std::string where()
+  {
+    if (pc >= TEXT_BASE && (pc - TEXT_BASE) / 4 < text.size()) {
+      size_t i = (pc - TEXT_BASE) / 4;
+      std::stringstream ss;
+      ss << text_label_at[i] << " (line " << text[i].line << ")";
+      return ss.str();
+    }
+    return "<native>";
+  }
+
+  uint32_t label(const std::string& name)
+  {
+    auto it = labels.find(name);
+    if (it == labels.end()) fatal("undefined label " + name);
+    return it->second;
+  }
+
+  //
+  // Heap objects are allocated with the -1 eye catcher the collectors
+  // expect in front of every object.
+  //
+  uint32_t alloc(int words)
+  {
+    uint32_t bytes = (words + 1) * WORD_SIZE;
+    if (heap_ptr + bytes - DATA_BASE > HEAP_LIMIT) fatal("heap exhausted");
+    if (heap_ptr + bytes - DATA_BASE > data.size())
+      data.resize(std::max<size_t>(data.size() * 2, heap_ptr + bytes - DATA_BASE));
+    store_word(heap_ptr, -1);
+    uint32_t obj = heap_ptr + WORD_SIZE;
+    heap_ptr += bytes;
+    allocations++;
+    allocated_bytes += bytes;
+    return obj;
+  }
+
+  uint32_t copy_object(uint32_t obj)
+  {
+    if (obj == 0) fatal("Object.copy on void at " + where());
+    int words = load_word(obj + SIZE_OFFSET * WORD_SIZE);
+    uint32_t fresh = alloc(words);
+    memcpy(addr(fresh, words * 4), addr(obj, words * 4), words * 4);
+    return fresh;
+  }
+
+  int32_t attr(uint32_t obj, int i) { return load_word(obj + (ATTR_OFFSET + i) * WORD_SIZE); }
+  void set_attr(uint32_t obj, int i, int32_t v) { store_word(obj + (ATTR_OFFSET + i) * WORD_SIZE, v); }
+  int32_t tag(uint32_t obj) { return load_word(obj + TAG_OFFSET * WORD_SIZE); }
+
+  uint32_t new_int(int32_t v)
+  {
+    uint32_t obj = copy_object(label("Int_protObj"));
+    set_attr(obj, 0, v);
+    return obj;
+  }
+
+  uint32_t new_bool(bool v) { return label(v ? "bool_const1" : "bool_const0"); }
+
+  std::string string_value(uint32_t obj)
+  {
+    int32_t len = attr(attr(obj, 0), 0);
+    std::string r;
+    uint32_t p = obj + (ATTR_OFFSET + 1) * WORD_SIZE;
+    for (int i = 0; i < len; i++) r += (char) load_byte(p + i);
+    return r;
+  }
+
+  uint32_t new_string(const std::string& v)
+  {
+    uint32_t proto = label("String_protObj");
+    int words = ATTR_OFFSET + 1 + (v.size() + 4) / 4;
+    uint32_t obj = alloc(words);
+    store_word(obj + TAG_OFFSET * WORD_SIZE, tag(proto));
+    store_word(obj + SIZE_OFFSET * WORD_SIZE, words);
+    store_word(obj + DISPTABLE_OFFSET * WORD_SIZE,
+               load_word(proto + DISPTABLE_OFFSET * WORD_SIZE));
+    set_attr(obj, 0, new_int(v.size()));
+    uint32_t p = obj + (ATTR_OFFSET + 1) * WORD_SIZE;
+    for (size_t i = 0; i < v.size(); i++) store_byte(p + i, v[i]);
+    for (size_t i = v.size(); i < (size_t) (words - ATTR_OFFSET - 1) * 4; i++)
+      store_byte(p + i, 0);
+    return obj;
+  }
+
+  std::string class_name(uint32_t obj)
+  {
+    uint32_t nametab = label("class_nameTab");
+    return string_value(load_word(nametab + tag(obj) * WORD_SIZE));
+  }
+
+  // Arguments of a native method: arg 0 was pushed first.
+  int32_t arg(int i, int nargs) { return load_word(reg[SP] + (nargs - i) * WORD_SIZE); }
+  void pop_args(int nargs) { reg[SP] += nargs * WORD_SIZE; }
+
+  void run();
+  void call_native(uint32_t a);
+  void report(std::ostream& s, int top);
+};
+
+//////////////////////////////////////////////////////////////////////
+//
+// The Cool runtime system
+//
+// Each routine follows the conventions of the SPIM trap handler: the
+// receiver is in $a0, arguments are on the stack and popped by the
+// callee, and the result is returned in $a0.
+//
+//////////////////////////////////////////////////////////////////////
+
+static void rt_object_copy(Machine& m) { m.reg[A0] = m.copy_object(m.reg[A0]); }
+
+static void rt_object_abort(Machine& m)
+{
+  m.output += "Abort called from class " + m.class_name(m.reg[A0]) + "\n";
+  m.flush();
+  exit(0);
+}
+
+static void rt_object_type_name(Machine& m)
+{
+  uint32_t nametab = m.label("class_nameTab");
+  m.reg[A0] = m.load_word(nametab + m.tag(m.reg[A0]) * WORD_SIZE);
+}
+
+static void rt_io_out_string(Machine& m)
+{
+  m.output += m.string_value(m.arg(0, 1));
+  m.pop_args(1);
+  if (m.output.size() > 4096) m.flush();
+}
+
+static void rt_io_out_int(Machine& m)
+{
+  m.output += std::to_string(m.attr(m.arg(0, 1), 0));
+  m.pop_args(1);
+  if (m.output.size() > 4096) m.flush();
+}
+
+static void rt_io_in_string(Machine& m)
+{
+  m.flush();
+  std::string line;
+  std::getline(*m.input, line);
+  if (line.find('\0') != std::string::npos) line = "";
+  m.reg[A0] = m.new_string(line);
+}
+
+static void rt_io_in_int(Machine& m)
+{
+  m.flush();
+  std::string line;
+  std::getline(*m.input, line);
+  m.reg[A0] = m.new_int(atoi(line.c_str()));
+}
+
+static void rt_string_length(Machine& m) { m.reg[A0] = m.attr(m.reg[A0], 0); }
+
+static void rt_string_concat(Machine& m)
+{
+  std::string a = m.string_value(m.reg[A0]);
+  std::string b = m.string_value(m.arg(0, 1));
+  m.pop_args(1);
+  m.reg[A0] = m.new_string(a + b);
+}
+
+static void rt_string_substr(Machine& m)
+{
+  std::string s = m.string_value(m.reg[A0]);
+  int32_t i = m.attr(m.arg(0, 2), 0);
+  int32_t l = m.attr(m.arg(1, 2), 0);
+  m.pop_args(2);
+  if (i < 0 || l < 0 || (size_t) i + l > s.size()) {
+    m.output += "Error: Index to substr is too big\n";
+    m.flush();
+    exit(1);
+  }
+  m.reg[A0] = m.new_string(s.substr(i, l));
+}
+
+//
+// equality_test compares the objects in $t1 and $t2 and returns $a0 if
+// they are equal and $a1 otherwise.
+//
+static void rt_equality_test(Machine& m)
+{
+  uint32_t a = m.reg[T1], b = m.reg[T2];
+  bool equal = false;
+  if (a == b)
+    equal = true;
+  else if (a != 0 && b != 0 && m.tag(a) == m.tag(b)) {
+    int32_t t = m.tag(a);
+    if (t == m.load_word(m.label("_int_tag")) || t == m.load_word(m.label("_bool_tag")))
+      equal = m.attr(a, 0) == m.attr(b, 0);
+    else if (t == m.load_word(m.label("_string_tag")))
+      equal = m.string_value(a) == m.string_value(b);
+  }
+  if (!equal) m.reg[A0] = m.reg[A1];
+}
+
+static void rt_dispatch_abort(Machine& m)
+{
+  m.output += m.string_value(m.reg[A0]) + ":" + std::to_string(m.reg[T1]) +
+              ": Dispatch to void.\n";
+  m.flush();
+  exit(1);
+}
+
+static void rt_case_abort(Machine& m)
+{
+  m.output += "No match in case statement for Class " + m.class_name(m.reg[A0]) + "\n";
+  m.flush();
+  exit(1);
+}
+
+static void rt_case_abort2(Machine& m)
+{
+  m.output += m.string_value(m.reg[A0]) + ":" + std::to_string(m.reg[T1]) +
+              ": Match on void in case statement.\n";
+  m.flush();
+  exit(1);
+}
+
+// The heap never needs collecting in the simulator.
+static void rt_nop(Machine& m) { }
+
+static const Native runtime[] = {
+  {"Object.copy", rt_object_copy},
+  {"Object.abort", rt_object_abort},
+  {"Object.type_name", rt_object_type_name},
+  {"IO.out_string", rt_io_out_string},
+  {"IO.out_int", rt_io_out_int},
+  {"IO.in_string", rt_io_in_string},
+  {"IO.in_int", rt_io_in_int},
+  {"String.length", rt_string_length},
+  {"String.concat", rt_string_concat},
+  {"String.substr", rt_string_substr},
+  {"equality_test", rt_equality_test},
+  {"_dispatch_abort", rt_dispatch_abort},
+  {"_case_abort", rt_case_abort},
+  {"_case_abort2", rt_case_abort2},
+  {"_gc_check", rt_nop},
+  {"_GenGC_Assign", rt_nop},
+  {"_NoGC_Init", rt_nop}, {"_NoGC_Collect", rt_nop},
+  {"_GenGC_Init", rt_nop}, {"_GenGC_Collect", rt_nop},
+  {"_ScnGC_Init", rt_nop}, {"_ScnGC_Collect", rt_nop},
+};
+
+//////////////////////////////////////////////////////////////////////
+//
+// Assembler
+//
+//////////////////////////////////////////////////////////////////////
+
+class Assembler {
+  Machine& m;
+  std::vector<std::pair<uint32_t, std::string> > data_fixups;
+  uint32_t data_ptr;
+  bool in_text;
+  int line_no;
+  std::string pending_label;
+
+  [[noreturn]] void error(const std::string& msg)
+  {
+    std::cerr << "coolsim: line " << line_no << ": " << msg << std::endl;
+    exit(2);
+  }
+
+  void emit_data_byte(uint8_t b)
+  {
+    if (data_ptr - DATA_BASE >= m.data.size()) m.data.resize(m.data.size() * 2 + 64);
+    m.data[data_ptr++ - DATA_BASE] = b;
+  }
+
+  void emit_data_word(int32_t w)
+  {
+    for (int i = 0; i < 4; i++) emit_data_byte((w >> (8 * i)) & 0xff);
+  }
+
+  static std::vector<std::string> split_operands(const std::string& s)
+  {
+    std::vector<std::string> ops;
+    std::string cur;
+    for (char c : s) {
+      if (isspace((unsigned char) c) || c == ',') {
+        if (!cur.empty()) ops.push_back(cur);
+        cur.clear();
+      } else
+        cur += c;
+    }
+    if (!cur.empty()) ops.push_back(cur);
+    return ops;
+  }
+
+  int parse_reg(const std::string& s)
+  {
+    if (s.empty() || s[0] != '$') error("expected register, got '" + s + "'");
+    std::string r = s.substr(1);
+    if (isdigit((unsigned char) r[0])) return atoi(r.c_str());
+    for (int i = 0; i < 32; i++)
+      if (r == reg_names[i]) return i;
+    if (r == "s8") return FP;
+    error("unknown register " + s);
+  }
+
+  static bool is_number(const std::string& s)
+  {
+    size_t i = (s[0] == '-' || s[0] == '+') ? 1 : 0;
+    return i < s.size() && isdigit((unsigned char) s[i]);
+  }
+
+  static int32_t parse_number(const std::string& s) { return (int32_t) strtol(s.c_str(), NULL, 0); }
+
+  // off($reg)
+  void parse_mem(const std::string& s, Instr& in)
+  {
+    size_t open = s.find('(');
+    if (open == std::string::npos) {
+      in.rs = -1;
+      in.label = s;
+      return;
+    }
+    in.imm = open == 0 ? 0 : parse_number(s.substr(0, open));
+    in.rs = parse_reg(s.substr(open + 1, s.find(')') - open - 1));
+  }
+
+  void parse_ascii(const std::string& rest)
+  {
+    size_t a = rest.find('"'), b = rest.rfind('"');
+    if (a == std::string::npos || a == b) error("bad .ascii");
+    for (size_t i = a + 1; i < b; i++) {
+      char c = rest[i];
+      if (c == '\\' && i + 1 < b) {
+        char d = rest[++i];
+        switch (d) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case '0': c = '\0'; break;
+        default: c = d; break;
+        }
+      }
+      emit_data_byte(c);
+    }
+  }
+
+  void define_label(const std::string& name)
+  {
+    if (m.labels.count(name)) error("label " + name + " defined twice");
+    if (in_text) {
+      m.labels[name] = TEXT_BASE + m.text.size() * WORD_SIZE;
+      pending_label = name;
+    } else
+      m.labels[name] = data_ptr;
+  }
+
+  void instruction(const std::string& mnemonic, const std::string& rest)
+  {
+    Instr in;
+    in.rd = in.rs = in.rt = 0;
+    in.imm = 0;
+    in.rt_is_imm = false;
+    in.target = 0;
+    in.line = line_no;
+
+    bool found = false;
+    for (const OpInfo& oi : opinfo)
+      if (mnemonic == oi.name) { in.op = oi.op; found = true; break; }
+    if (!found) error("unknown instruction " + mnemonic);
+
+    std::vector<std::string> ops = split_operands(rest);
+    auto need = [&](size_t n) { if (ops.size() != n) error("wrong operand count for " + mnemonic); };
+
+    switch (in.op) {
+    case OP_LW: case OP_SW: case OP_LB: case OP_SB:
+      need(2); in.rt = parse_reg(ops[0]); parse_mem(ops[1], in); break;
+    case OP_LI:
+      need(2); in.rd = parse_reg(ops[0]); in.imm = parse_number(ops[1]); break;
+    case OP_LA:
+      need(2); in.rd = parse_reg(ops[0]); in.label = ops[1]; break;
+    case OP_MOVE: case OP_NEG: case OP_NEGU: case OP_NOT:
+      need(2); in.rd = parse_reg(ops[0]); in.rs = parse_reg(ops[1]); break;
+    case OP_ADDI: case OP_ADDIU: case OP_ANDI: case OP_ORI: case OP_XORI:
+    case OP_SLTI: case OP_SLL: case OP_SRL: case OP_SRA:
+      need(3); in.rd = parse_reg(ops[0]); in.rs = parse_reg(ops[1]);
+      in.imm = parse_number(ops[2]); break;
+    case OP_ADD: case OP_ADDU: case OP_SUB: case OP_SUBU: case OP_MUL:
+    case OP_DIV: case OP_REM: case OP_AND: case OP_OR: case OP_XOR: case OP_NOR:
+    case OP_SLLV: case OP_SRLV: case OP_SRAV: case OP_SLT: case OP_SLTU:
+    case OP_SEQ: case OP_SNE: case OP_SLE: case OP_SGT: case OP_SGE:
+      need(3); in.rd = parse_reg(ops[0]); in.rs = parse_reg(ops[1]);
+      if (ops[2][0] == '$') in.rt = parse_reg(ops[2]);
+      else { in.rt_is_imm = true; in.imm = parse_number(ops[2]); }
+      break;
+    case OP_B: case OP_J: case OP_JAL:
+      need(1); in.label = ops[0]; break;
+    case OP_JR: case OP_JALR:
+      need(1); in.rs = parse_reg(ops[0]); break;
+    case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLE: case OP_BGT: case OP_BGE:
+      need(3); in.rs = parse_reg(ops[0]);
+      if (ops[1][0] == '$') in.rt = parse_reg(ops[1]);
+      else { in.rt_is_imm = true; in.imm = parse_number(ops[1]); }
+      in.label = ops[2];
+      break;
+    case OP_BEQZ: case OP_BNEZ: case OP_BLTZ: case OP_BLEZ: case OP_BGTZ: case OP_BGEZ:
+      need(2); in.rs = parse_reg(ops[0]); in.label = ops[1]; break;
+    case OP_NOP:
+      break;
+    }
+    m.text.push_back(in);
+    m.text_label_at.push_back(pending_label);
+  }
+
+  void directive(const std::string& d, const std::string& rest)
+  {
+    if (d == ".data") { in_text = false; return; }
+    if (d == ".text") { in_text = true; return; }
+    if (d == ".globl") return;
+    if (in_text) error("directive " + d + " in .text");
+    if (d == ".align") {
+      int a = 1 << atoi(rest.c_str());
+      while ((data_ptr - DATA_BASE) % a) emit_data_byte(0);
+    } else if (d == ".word") {
+      for (const std::string& w : split_operands(rest)) {
+        if (is_number(w))
+          emit_data_word(parse_number(w));
+        else {
+          data_fixups.push_back(std::make_pair(data_ptr, w));
+          emit_data_word(0);
+        }
+      }
+    } else if (d == ".byte") {
+      for (const std::string& b : split_operands(rest)) emit_data_byte(parse_number(b));
+    } else if (d == ".ascii" || d == ".asciiz") {
+      parse_ascii(rest);
+      if (d == ".asciiz") emit_data_byte(0);
+    } else if (d == ".space") {
+      for (int i = atoi(rest.c_str()); i > 0; i--) emit_data_byte(0);
+    } else
+      error("unknown directive " + d);
+  }
+
+public:
+  Assembler(Machine& mach) : m(mach), data_ptr(DATA_BASE), in_text(false), line_no(0)
+  {
+    m.data.resize(4096);
+  }
+
+  void line(const std::string& raw)
+  {
+    line_no++;
+    // strip comments outside string literals
+    std::string l;
+    bool in_str = false;
+    for (size_t i = 0; i < raw.size(); i++) {
+      char c = raw[i];
+      if (c == '"' && (i == 0 || raw[i - 1] != '\\')) in_str = !in_str;
+      if (c == '#' && !in_str) break;
+      l += c;
+    }
+    size_t p = 0;
+    while (true) {
+      while (p < l.size() && isspace((unsigned char) l[p])) p++;
+      if (p >= l.size()) return;
+      size_t q = p;
+      while (q < l.size() && !isspace((unsigned char) l[q]) && l[q] != ':') q++;
+      if (q < l.size() && l[q] == ':') {
+        define_label(l.substr(p, q - p));
+        p = q + 1;
+        continue;
+      }
+      std::string word = l.substr(p, q - p);
+      std::string rest = l.substr(q);
+      if (word[0] == '.') directive(word, rest);
+      else instruction(word, rest);
+      return;
+    }
+  }
+
+  //
+  // Resolves label operands.  Labels the program does not define are
+  // looked up in the runtime system.
+  //
+  void finish()
+  {
+    for (size_t i = 0; i < sizeof(runtime) / sizeof(runtime[0]); i++) {
+      if (!m.labels.count(runtime[i].name))
+        m.labels[runtime[i].name] = NATIVE_BASE + i * WORD_SIZE;
+      m.natives.push_back(runtime[i].fn);
+      m.native_names.push_back(runtime[i].name);
+    }
+    for (auto& f : data_fixups) {
+      line_no = 0;
+      m.store_word(f.first, m.label(f.second));
+    }
+    for (Instr& in : m.text)
+      if (!in.label.empty()) {
+        line_no = in.line;
+        auto it = m.labels.find(in.label);
+        if (it == m.labels.end()) error("undefined label " + in.label);
+        in.target = it->second;
+      }
+    // the heap starts after the data segment, word aligned
+    m.heap_start = m.heap_ptr = (data_ptr + 7) & ~3u;
+    m.data.resize(m.heap_ptr - DATA_BASE + (1 << 20));
+    m.exec_count.assign(m.text.size(), 0);
+  }
+};
+
+//////////////////////////////////////////////////////////////////////
+//
+// Execution
+//
+//////////////////////////////////////////////////////////////////////
+
+//
+// Natives may clobber the registers the SPIM runtime does not preserve;
+// doing so deliberately catches code that relies on them surviving.
+//
+void Machine::call_native(uint32_t a)
+{
+  size_t i = (a - NATIVE_BASE) / WORD_SIZE;
+  if (i >= natives.size()) fatal("bad native address");
+  native_calls++;
+  int32_t a1 = reg[A1];
+  natives[i](*this);
+  if (clobber) {
+    for (int r = T0; r <= T0 + 7; r++) reg[r] = 0xdeadbeef;
+    reg[24] = reg[25] = 0xdeadbeef;
+    reg[V0] = 0xdeadbeef;
+    if (native_names[i] != "equality_test") reg[A1] = 0xdeadbeef;
+    else reg[A1] = a1;
+  }
+}
+
+#define R(x) reg[x]
+#define RT_VAL (in.rt_is_imm ? in.imm : reg[in.rt])
+
+void Machine::run()
+{
+  // Mirror the SPIM trap handler's start-up sequence.
+  reg[SP] = STACK_TOP;
+  reg[FP] = STACK_TOP;
+  reg[A0] = copy_object(label("Main_protObj"));
+  const uint32_t exit_addr = 0xfffffff0u;
+  uint32_t entry[2] = { label("Main_init"), label("Main.main") };
+
+  for (int phase = 0; phase < 2; phase++) {
+    int32_t self = reg[A0];
+    reg[RA] = exit_addr;
+    pc = entry[phase];
+    while (pc != exit_addr) {
+      if (pc >= NATIVE_BASE && pc < TEXT_BASE) {
+        call_native(pc);
+        pc = reg[RA];
+        continue;
+      }
+      size_t idx = (pc - TEXT_BASE) / WORD_SIZE;
+      if (pc < TEXT_BASE || idx >= text.size()) {
+        std::stringstream ss;
+        ss << "jump to bad address 0x" << std::hex << pc;
+        fatal(ss.str());
+      }
+      const Instr& in = text[idx];
+      exec_count[idx]++;
+      instructions++;
+      cycles++;
+      uint32_t next = pc + WORD_SIZE;
+
+      switch (in.op) {
+      case OP_LW: {
+        uint32_t a = in.rs < 0 ? in.target : reg[in.rs] + in.imm;
+        reg[in.rt] = load_word(a); loads++; cycles++; break;
+      }
+      case OP_SW: {
+        uint32_t a = in.rs < 0 ? in.target : reg[in.rs] + in.imm;
+        store_word(a, reg[in.rt]); stores++; break;
+      }
+      case OP_LB: {
+        uint32_t a = in.rs < 0 ? in.target : reg[in.rs] + in.imm;
+        reg[in.rt] = (int8_t) load_byte(a); loads++; cycles++; break;
+      }
+      case OP_SB: {
+        uint32_t a = in.rs < 0 ? in.target : reg[in.rs] + in.imm;
+        store_byte(a, reg[in.rt]); stores++; break;
+      }
+      case OP_LI: reg[in.rd] = in.imm; break;
+      case OP_LA: reg[in.rd] = in.target; break;
+      case OP_MOVE: reg[in.rd] = reg[in.rs]; break;
+      case OP_NEG:
+        if (__builtin_sub_overflow(0, reg[in.rs], &reg[in.rd]))
+          trap("Arithmetic overflow");
+        break;
+      case OP_NEGU: reg[in.rd] = -(uint32_t) reg[in.rs]; break;
+      case OP_NOT: reg[in.rd] = ~reg[in.rs]; break;
+      case OP_ADD:
+        if (__builtin_add_overflow(reg[in.rs], (int32_t) RT_VAL, &reg[in.rd]))
+          trap("Arithmetic overflow");
+        break;
+      case OP_ADDU: reg[in.rd] = (uint32_t) reg[in.rs] + (uint32_t) RT_VAL; break;
+      case OP_ADDI:
+        if (__builtin_add_overflow(reg[in.rs], in.imm, &reg[in.rd]))
+          trap("Arithmetic overflow");
+        break;
+      case OP_ADDIU: reg[in.rd] = (uint32_t) reg[in.rs] + (uint32_t) in.imm; break;
+      case OP_SUB:
+        if (__builtin_sub_overflow(reg[in.rs], (int32_t) RT_VAL, &reg[in.rd]))
+          trap("Arithmetic overflow");
+        break;
+      case OP_SUBU: reg[in.rd] = (uint32_t) reg[in.rs] - (uint32_t) RT_VAL; break;
+      case OP_MUL: reg[in.rd] = (int32_t) ((int64_t) reg[in.rs] * RT_VAL); cycles += 3; break;
+      case OP_DIV: case OP_REM: {
+        int32_t d = RT_VAL;
+        if (d == 0)
+          trap("Division by zero");
+        if (reg[in.rs] == INT32_MIN && d == -1)
+          reg[in.rd] = in.op == OP_DIV ? INT32_MIN : 0;
+        else
+          reg[in.rd] = in.op == OP_DIV ? reg[in.rs] / d : reg[in.rs] % d;
+        cycles += 11;
+        break;
+      }
+      case OP_AND: reg[in.rd] = reg[in.rs] & RT_VAL; break;
+      case OP_ANDI: reg[in.rd] = reg[in.rs] & (in.imm & 0xffff); break;
+      case OP_OR: reg[in.rd] = reg[in.rs] | RT_VAL; break;
+      case OP_ORI: reg[in.rd] = reg[in.rs] | (in.imm & 0xffff); break;
+      case OP_XOR: reg[in.rd] = reg[in.rs] ^ RT_VAL; break;
+      case OP_XORI: reg[in.rd] = reg[in.rs] ^ (in.imm & 0xffff); break;
+      case OP_NOR: reg[in.rd] = ~(reg[in.rs] | RT_VAL); break;
+      case OP_SLL: reg[in.rd] = (uint32_t) reg[in.rs] << (in.imm & 31); break;
+      case OP_SRL: reg[in.rd] = (uint32_t) reg[in.rs] >> (in.imm & 31); break;
+      case OP_SRA: reg[in.rd] = reg[in.rs] >> (in.imm & 31); break;
+      case OP_SLLV: reg[in.rd] = (uint32_t) reg[in.rs] << (RT_VAL & 31); break;
+      case OP_SRLV: reg[in.rd] = (uint32_t) reg[in.rs] >> (RT_VAL & 31); break;
+      case OP_SRAV: reg[in.rd] = reg[in.rs] >> (RT_VAL & 31); break;
+      case OP_SLT: reg[in.rd] = reg[in.rs] < RT_VAL; break;
+      case OP_SLTI: reg[in.rd] = reg[in.rs] < in.imm; break;
+      case OP_SLTU: reg[in.rd] = (uint32_t) reg[in.rs] < (uint32_t) RT_VAL; break;
+      case OP_SEQ: reg[in.rd] = reg[in.rs] == RT_VAL; break;
+      case OP_SNE: reg[in.rd] = reg[in.rs] != RT_VAL; break;
+      case OP_SLE: reg[in.rd] = reg[in.rs] <= RT_VAL; break;
+      case OP_SGT: reg[in.rd] = reg[in.rs] > RT_VAL; break;
+      case OP_SGE: reg[in.rd] = reg[in.rs] >= RT_VAL; break;
+      case OP_B: case OP_J: next = in.target; branches++; taken++; break;
+      case OP_JAL: reg[RA] = next; next = in.target; calls++; break;
+      case OP_JR: next = reg[in.rs]; branches++; taken++; break;
+      case OP_JALR: { uint32_t t = reg[in.rs]; reg[RA] = next; next = t; calls++; break; }
+      case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLE: case OP_BGT: case OP_BGE:
+      case OP_BEQZ: case OP_BNEZ: case OP_BLTZ: case OP_BLEZ: case OP_BGTZ: case OP_BGEZ: {
+        int32_t a = reg[in.rs];
+        int32_t b = (in.op >= OP_BEQZ) ? 0 : RT_VAL;
+        bool t = false;
+        switch (in.op) {
+        case OP_BEQ: case OP_BEQZ: t = a == b; break;
+        case OP_BNE: case OP_BNEZ: t = a != b; break;
+        case OP_BLT: case OP_BLTZ: t = a < b; break;
+        case OP_BLE: case OP_BLEZ: t = a <= b; break;
+        case OP_BGT: case OP_BGTZ: t = a > b; break;
+        default: t = a >= b; break;
+        }
+        branches++;
+        if (t) { next = in.target; taken++; cycles++; }
+        break;
+      }
+      case OP_NOP: break;
+      }
+      reg[ZERO] = 0;
+      pc = next;
+    }
+    if (phase == 0) reg[A0] = self;   // Main_init returns self in $a0
+  }
+  output += "COOL program successfully executed\n";
+  flush();
+}
+
+void Machine::report(std::ostream& s, int top)
+{
+  s << "instructions:      " << instructions << "\n"
+    << "cycles:            " << cycles << "\n"
+    << "loads:             " << loads << "\n"
+    << "stores:            " << stores << "\n"
+    << "branches:          " << branches << " (" << taken << " taken)\n"
+    << "calls:             " << calls << " (" << native_calls << " to the runtime)\n"
+    << "allocations:       " << allocations << " (" << allocated_bytes << " bytes)\n";
+  if (top <= 0) return;
+
+  std::map<std::string, uint64_t> per_label;
+  for (size_t i = 0; i < text.size(); i++)
+    if (exec_count[i]) per_label[text_label_at[i]] += exec_count[i];
+  std::vector<std::pair<uint64_t, std::string> > sorted;
+  for (auto& p : per_label) sorted.push_back(std::make_pair(p.second, p.first));
+  std::sort(sorted.rbegin(), sorted.rend());
+  s << "hottest labels:\n";
+  for (int i = 0; i < top && i < (int) sorted.size(); i++) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%6.2f%%", 100.0 * sorted[i].first / instructions);
+    s << "  " << buf << "  " << sorted[i].first << "\t" << sorted[i].second << "\n";
+  }
+}
+
+static void usage()
+{
+  std::cerr << "usage: coolsim [-s] [-l n] [-k] [-i input] prog.s\n"
+            << "  -s        print execution statistics to stderr\n"
+            << "  -l n      also print the n most executed labels\n"
+            << "  -k        keep caller-saved registers across runtime calls\n"
+            << "  -i file   read program input from file\n";
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  bool stats = false;
+  int top = 0;
+  const char *input = NULL;
+  Machine m;
+  int c;
+  while ((c = getopt(argc, argv, "sl:ki:")) != -1) {
+    switch (c) {
+    case 's': stats = true; break;
+    case 'l': stats = true; top = atoi(optarg); break;
+    case 'k': m.clobber = false; break;
+    case 'i': input = optarg; break;
+    default: usage();
+    }
+  }
+  if (optind != argc - 1) usage();
+
+  std::ifstream src(argv[optind]);
+  if (!src) {
+    std::cerr << "coolsim: cannot open " << argv[optind] << std::endl;
+    return 2;
+  }
+  Assembler as(m);
+  std::string line;
+  while (std::getline(src, line)) as.line(line);
+  as.finish();
+
+  std::ifstream in;
+  if (input) {
+    in.open(input);
+    m.input = &in;
+  }
+  m.run();
+  if (stats) m.report(std::cerr, top);
+  return 0;
+}
@@ -0,0 +1,37 @@
+//
+// coolvm: runs a program compiled with CGEN_TARGET=bytecode (see vm.h).
+//
+//     coolvm [-b] [-j] prog.cbc
+//
+// -b reports the number of instructions executed and the rate at which
+// they ran on stderr.  -j compiles the methods to x86-64 as they are
+// first called instead of interpreting them.
+//
+#include <string.h>
+#include <fstream>
+#include "vm.h"
+
+int main(int argc, char *argv[])
+{
+  bool stats = false, jit = false;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++)
+    if (strcmp(argv[i], "-b") == 0)
+      stats = true;
+    else if (strcmp(argv[i], "-j") == 0)
+      jit = true;
+    else
+      break;
+  if (i + 1 != argc) {
+    std::cerr << "usage: coolvm [-b] [-j] prog.cbc" << std::endl;
+    return 1;
+  }
+
+  std::ifstream in(argv[i]);
+  VmProgram prog;
+  if (!in || !prog.read(in)) {
+    std::cerr << "coolvm: cannot read " << argv[i] << std::endl;
+    return 1;
+  }
+  return vm_run(prog, stats, jit);
+}
@@ -25,12 +25,16 @@
 #define BOOLTAG              "_bool_tag"
 #define STRINGTAG            "_string_tag"
 #define HEAP_START           "heap_start"
+#define STACK_MAPS           "_stack_maps"
+#define INT_CACHE            "_int_cache"
+#define INT_SCRATCH          "_int_scratch"
 
 // Naming conventions
 #define DISPTAB_SUFFIX       "_dispTab"
 #define METHOD_SEP           "."
 #define CLASSINIT_SUFFIX     "_init"
 #define PROTOBJ_SUFFIX       "_protObj"
+#define TAGS_SUFFIX          "_tags"
 #define OBJECTPROTOBJ        "Object" PROTOBJ_SUFFIX
 #define INTCONST_PREFIX      "int_const"
 #define STRCONST_PREFIX      "str_const"
@@ -67,8 +71,15 @@ Register const ZERO = "$zero";         // Zero register
 Register const ACC  = "$a0";           // Accumulator
 Register const A1   = "$a1";           // For arguments to prim funcs
 Register const SELF = "$s0";           // Ptr to self (callee saves)
+Register const S1   = "$s1";           // Expression temporaries (callee saves)
+Register const S2   = "$s2";
+Register const S3   = "$s3";
+Register const S4   = "$s4";
+Register const S5   = "$s5";
+Register const S6   = "$s6";
 Register const T1   = "$t1";           // Temporary 1
 Register const T2   = "$t2";           // Temporary 2
+Register const T3   = "$t3";           // Temporary 3
 Register const SP   = "$sp";           // Stack pointer
 Register const FP   = "$fp";           // Frame pointer
 Register const RA   = "$ra";           // Return address
@@ -78,6 +89,8 @@ Register const RA   = "$ra";           // Return address
 //
 #define JALR  "\tjalr\t"
 #define JAL   "\tjal\t"
+#define JR    "\tjr\t"
+#define JUMP  "\tj\t"
 #define RET   "\tjr\t$ra\t"
 
 #define SW    "\tsw\t"
@@ -95,6 +108,10 @@ Register const RA   = "$ra";           // Return address
 #define MUL   "\tmul\t"
 #define SUB   "\tsub\t"
 #define SLL   "\tsll\t"
+#define SLT   "\tslt\t"
+#define SLE   "\tsle\t"
+#define SEQ   "\tseq\t"
+#define XORI  "\txori\t"
 #define BEQZ  "\tbeqz\t"
 #define BRANCH   "\tb\t"
 #define BEQ      "\tbeq\t"
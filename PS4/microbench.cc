@@ -0,0 +1,314 @@
+//
+// microbench: times the primitives every phase leans on, the string
+// tables, the symbol table and list_node, at 1e3 to 1e7 entries.
+//
+//     microbench [-m max entries] [-b seconds] [benchmark ...]
+//
+// Each benchmark runs at 1e3 entries and grows tenfold up to the maximum
+// (1e7).  The next size is skipped, and the ones after it, when it would
+// take longer than the budget (5 seconds, setup included) going by how
+// the time grew over the last step: a structure with linear operations
+// takes a hundred times as long at ten times the size.  The names given
+// select benchmarks by prefix, `stringtab' or `symtab.lookup' for
+// instance.
+//
+// The string tables are measured as the lexer uses them: add_string
+// finds the entry when the string is there (a hit) and adds it when it
+// is not (a miss), so the add benchmarks mix the two in fixed ratios.
+// lookup_string only ever hits; it asserts when the string is missing.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "cool-tree.h"
+#include "symtab.h"
+
+FILE *ast_file = stdin;       // not used, but needed to link with the phase
+int cool_yydebug;             // not used, but needed to link with handle_flags
+char *curr_filename;
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//
+// A deterministic shuffle, so that lookups do not follow insertion order.
+//
+static std::vector<int> shuffled(int n)
+{
+  std::vector<int> order(n);
+  unsigned state = 12345;
+  for (int i = 0; i < n; i++)
+    order[i] = i;
+  for (int i = n - 1; i > 0; i--) {
+    state = state * 1103515245 + 12345;
+    std::swap(order[i], order[(state >> 8) % (i + 1)]);
+  }
+  return order;
+}
+
+static std::vector<std::string> names(const char *prefix, int n)
+{
+  std::vector<std::string> result(n);
+  for (int i = 0; i < n; i++)
+    result[i] = prefix + std::to_string(i);
+  return result;
+}
+
+static char *str(const std::string& s) { return (char *) s.c_str(); }
+
+//
+// Each benchmark sets up a structure of n entries, then returns the
+// number of operations it timed and their total time in *seconds.
+//
+typedef long (*Benchmark)(int n, double *seconds);
+
+static long stringtab_insert(int n, double *seconds)
+{
+  IdTable table;
+  std::vector<std::string> ids = names("id", n);
+  double start = now();
+  for (int i = 0; i < n; i++)
+    table.add_string(str(ids[i]));
+  *seconds = now() - start;
+  return n;
+}
+
+static long stringtab_lookup(int n, double *seconds)
+{
+  IdTable table;
+  std::vector<std::string> ids = names("id", n);
+  for (int i = 0; i < n; i++)
+    table.add_string(str(ids[i]));
+  std::vector<int> order = shuffled(n);
+  long found = 0;
+  double start = now();
+  for (int i = 0; i < n; i++)
+    found += table.lookup_string(str(ids[order[i]])) != NULL;
+  *seconds = now() - start;
+  return found;
+}
+
+//
+// n calls of add_string on a table of n strings, hit percent of them
+// for strings already there.
+//
+static long stringtab_add(int n, int hit, double *seconds)
+{
+  IdTable table;
+  std::vector<std::string> ids = names("id", n), fresh = names("new", n);
+  for (int i = 0; i < n; i++)
+    table.add_string(str(ids[i]));
+  std::vector<int> order = shuffled(n);
+  double start = now();
+  for (int i = 0; i < n; i++)
+    table.add_string(str(order[i] % 100 < hit ? ids[order[i]] : fresh[i]));
+  *seconds = now() - start;
+  return n;
+}
+
+static long stringtab_add_90(int n, double *seconds) { return stringtab_add(n, 90, seconds); }
+static long stringtab_add_50(int n, double *seconds) { return stringtab_add(n, 50, seconds); }
+
+//
+// The symbol table keyed by Symbol, as semant uses it.  The entries are
+// made directly so that their cost does not depend on the string table.
+//
+static std::vector<Symbol> symbols(int n)
+{
+  std::vector<Symbol> result(n);
+  std::vector<std::string> ids = names("sym", n);
+  for (int i = 0; i < n; i++)
+    result[i] = new IdEntry(str(ids[i]), ids[i].size(), i);
+  return result;
+}
+
+static int info;
+
+static long symtab_addid(int n, double *seconds)
+{
+  std::vector<Symbol> syms = symbols(n);
+  SymbolTable<Symbol, int> table;
+  table.enterscope();
+  double start = now();
+  for (int i = 0; i < n; i++)
+    table.addid(syms[i], &info);
+  *seconds = now() - start;
+  return n;
+}
+
+//
+// Lookups in n scopes of one symbol each, as deep as a method nested in
+// n lets; half of them are for symbols that are not there.
+//
+static long symtab_lookup(int n, double *seconds)
+{
+  std::vector<Symbol> syms = symbols(n), absent = symbols(n);
+  SymbolTable<Symbol, int> table;
+  for (int i = 0; i < n; i++) {
+    table.enterscope();
+    table.addid(syms[i], &info);
+  }
+  std::vector<int> order = shuffled(n);
+  long found = 0;
+  double start = now();
+  for (int i = 0; i < n; i++) {
+    Symbol s = order[i] % 2 ? syms[order[i]] : absent[order[i]];
+    found += table.lookup(s) != NULL;
+  }
+  *seconds = now() - start;
+  return n;
+}
+
+//
+// probe looks in the innermost scope only: a scope of n symbols, with
+// half the probes for symbols in the scope outside it.
+//
+static long symtab_probe(int n, double *seconds)
+{
+  std::vector<Symbol> syms = symbols(n), outer = symbols(n);
+  SymbolTable<Symbol, int> table;
+  table.enterscope();
+  for (int i = 0; i < n; i++)
+    table.addid(outer[i], &info);
+  table.enterscope();
+  for (int i = 0; i < n; i++)
+    table.addid(syms[i], &info);
+  std::vector<int> order = shuffled(n);
+  double start = now();
+  for (int i = 0; i < n; i++)
+    table.probe(order[i] % 2 ? syms[order[i]] : outer[order[i]]);
+  *seconds = now() - start;
+  return n;
+}
+
+//
+// n scopes entered and left, with a symbol added to each, as for the
+// lets and case branches of a method.
+//
+static long symtab_scopes(int n, double *seconds)
+{
+  std::vector<Symbol> syms = symbols(n);
+  SymbolTable<Symbol, int> table;
+  table.enterscope();
+  double start = now();
+  for (int i = 0; i < n; i++) {
+    table.enterscope();
+    table.addid(syms[i], &info);
+    table.exitscope();
+  }
+  *seconds = now() - start;
+  return n;
+}
+
+//
+// A list of n expressions built the way the parser builds one, by
+// appending a single element at a time.
+//
+static Expressions expressions(int n)
+{
+  Symbol one = inttable.add_string("1");
+  Expressions list = nil_Expressions();
+  for (int i = 0; i < n; i++)
+    list = append_Expressions(list, single_Expressions(int_const(one)));
+  return list;
+}
+
+static long list_append(int n, double *seconds)
+{
+  double start = now();
+  expressions(n);
+  *seconds = now() - start;
+  return n;
+}
+
+//
+// The usual walk over a list: first, more, next and nth.
+//
+static long list_iterate(int n, double *seconds)
+{
+  Expressions list = expressions(n);
+  long seen = 0;
+  double start = now();
+  for (int i = list->first(); list->more(i); i = list->next(i))
+    seen += list->nth(i) != NULL;
+  *seconds = now() - start;
+  return seen;
+}
+
+static const struct { const char *name; Benchmark run; } benchmarks[] = {
+  { "stringtab.insert",   stringtab_insert },
+  { "stringtab.lookup",   stringtab_lookup },
+  { "stringtab.add_90",   stringtab_add_90 },
+  { "stringtab.add_50",   stringtab_add_50 },
+  { "symtab.addid",       symtab_addid },
+  { "symtab.lookup_50",   symtab_lookup },
+  { "symtab.probe_50",    symtab_probe },
+  { "symtab.scopes",      symtab_scopes },
+  { "list.append",        list_append },
+  { "list.iterate",       list_iterate },
+};
+
+static bool selected(const char *name, int argc, char *argv[])
+{
+  if (optind == argc)
+    return true;
+  for (int i = optind; i < argc; i++)
+    if (strncmp(name, argv[i], strlen(argv[i])) == 0)
+      return true;
+  return false;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: microbench [-m max entries] [-b seconds] [benchmark ...]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  long max = 10000000;
+  double budget = 5;
+  int c;
+  while ((c = getopt(argc, argv, "m:b:")) != -1) {
+    switch (c) {
+    case 'm': max = atol(optarg); break;
+    case 'b': budget = atof(optarg); break;
+    default: usage();
+    }
+  }
+
+  printf("%-20s %10s %12s %12s\n", "benchmark", "entries", "ns/op", "Mops/s");
+  for (auto& b : benchmarks) {
+    if (!selected(b.name, argc, argv))
+      continue;
+    bool skip = false;
+    double last = 0;
+    for (long n = 1000; n <= max; n *= 10) {
+      if (skip) {
+        printf("%-20s %10ld %12s %12s\n", b.name, n, "skipped", "-");
+        continue;
+      }
+      // the projection counts the setup too
+      double seconds, start = now();
+      long ops = b.run(n, &seconds);
+      double total = now() - start;
+      if (ops <= 0)
+        ops = 1;
+      printf("%-20s %10ld %12.1f %12.3f\n", b.name, n, seconds * 1e9 / ops,
+             seconds > 0 ? ops / seconds / 1e6 : 0);
+      fflush(stdout);
+      double growth = last > 0 ? std::max(10.0, total / last) : 10;
+      skip = total * growth > budget;
+      last = total;
+    }
+  }
+  return 0;
+}
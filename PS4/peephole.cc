@@ -0,0 +1,404 @@
+//
+// Peephole optimization of generated code.
+//
+// The code generator emits each method into a buffer; with -O the
+// buffer is parsed into an InstrList, rewritten here, and printed back.
+// The rules are local: each one looks at two or three adjacent
+// instructions, using what every opcode reads and writes, and only
+// fires when the registers and memory the rest of the code can observe
+// are left unchanged.
+//
+#include <stdlib.h>
+#include <sstream>
+#include <map>
+#include "peephole.h"
+
+const char *Peephole::rule_names[NUM_RULES] = {
+  "self-move",
+  "store-load",
+  "copy-forward",
+  "dead-write",
+  "stack-adjust",
+  "jump-chain",
+  "jump-next",
+  "dead-code",
+};
+
+///////////////////////////////////////////////////////////////////////
+//
+// Parsing and printing
+//
+///////////////////////////////////////////////////////////////////////
+
+InstrList parse_instrs(const std::string& code)
+{
+  InstrList out;
+  std::istringstream in(code);
+  std::string line;
+  while (std::getline(in, line)) {
+    Instr ins;
+    if (!line.empty() && line[0] != '\t' && line[line.size() - 1] == ':')
+      ins.label = line.substr(0, line.size() - 1);
+    else if (line.size() > 1 && line[0] == '\t' && line[1] != '.') {
+      std::istringstream words(line);
+      std::string w;
+      words >> ins.op;
+      while (words >> w)
+        ins.args.push_back(w);
+    } else
+      ins.text = line;
+    out.push_back(ins);
+  }
+  return out;
+}
+
+void print_instrs(const InstrList& code, std::ostream& s)
+{
+  for (const Instr& ins : code) {
+    if (ins.is_label())
+      s << ins.label << ":" << std::endl;
+    else if (ins.is_instr()) {
+      s << "\t" << ins.op << "\t";
+      for (size_t a = 0; a < ins.args.size(); a++)
+        s << (a ? " " : "") << ins.args[a];
+      s << std::endl;
+    } else
+      s << ins.text << std::endl;
+  }
+}
+
+static int count_instrs(const InstrList& code)
+{
+  int n = 0;
+  for (const Instr& ins : code)
+    if (ins.is_instr())
+      n++;
+  return n;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// What instructions read and write
+//
+// DEF instructions write their first operand and read the others and
+// have no other effect.  TRAP instructions are the same but may raise
+// an exception (add, sub, addi and neg on overflow, div and rem on
+// zero), so they are never deleted.  Anything not listed is treated as
+// reading and writing everything.
+//
+///////////////////////////////////////////////////////////////////////
+
+enum Kind { LOAD, STORE, DEF, TRAP, JUMP, BRANCH, OTHER };
+
+static const struct { const char *op; Kind kind; int nargs; } shapes[] = {
+  {"lw", LOAD, 2}, {"lb", LOAD, 2}, {"sw", STORE, 2}, {"sb", STORE, 2},
+  {"li", DEF, 2}, {"la", DEF, 2}, {"move", DEF, 2}, {"not", DEF, 2},
+  {"addu", DEF, 3}, {"addiu", DEF, 3}, {"subu", DEF, 3}, {"mul", DEF, 3},
+  {"and", DEF, 3}, {"andi", DEF, 3}, {"or", DEF, 3}, {"ori", DEF, 3},
+  {"xor", DEF, 3}, {"xori", DEF, 3}, {"sll", DEF, 3}, {"srl", DEF, 3},
+  {"sra", DEF, 3}, {"slt", DEF, 3}, {"sltu", DEF, 3}, {"sle", DEF, 3},
+  {"seq", DEF, 3}, {"sne", DEF, 3}, {"sgt", DEF, 3}, {"sge", DEF, 3},
+  {"add", TRAP, 3}, {"addi", TRAP, 3}, {"sub", TRAP, 3}, {"div", TRAP, 3},
+  {"rem", TRAP, 3}, {"neg", TRAP, 2},
+  {"b", JUMP, 1}, {"j", JUMP, 1},
+  {"beqz", BRANCH, 2}, {"bnez", BRANCH, 2}, {"bltz", BRANCH, 2},
+  {"blez", BRANCH, 2}, {"bgtz", BRANCH, 2}, {"bgez", BRANCH, 2},
+  {"beq", BRANCH, 3}, {"bne", BRANCH, 3}, {"blt", BRANCH, 3},
+  {"ble", BRANCH, 3}, {"bgt", BRANCH, 3}, {"bge", BRANCH, 3},
+};
+
+static Kind kind_of(const Instr& ins)
+{
+  for (auto& sh : shapes)
+    if (ins.op == sh.op)
+      return (int) ins.args.size() == sh.nargs ? sh.kind : OTHER;
+  return OTHER;
+}
+
+// "12($fp)" => "$fp"; labels have no base register.
+static std::string base_reg(const std::string& addr)
+{
+  size_t open = addr.find('(');
+  if (open == std::string::npos)
+    return "";
+  return addr.substr(open + 1, addr.find(')') - open - 1);
+}
+
+static bool reads(const Instr& ins, const std::string& r)
+{
+  switch (kind_of(ins)) {
+  case LOAD:
+    return base_reg(ins.args[1]) == r;
+  case STORE:
+    return ins.args[0] == r || base_reg(ins.args[1]) == r;
+  case DEF:
+  case TRAP:
+    for (size_t a = 1; a < ins.args.size(); a++)
+      if (ins.args[a] == r)
+        return true;
+    return false;
+  case BRANCH:
+    for (size_t a = 0; a + 1 < ins.args.size(); a++)
+      if (ins.args[a] == r)
+        return true;
+    return false;
+  case JUMP:
+    return false;
+  default:
+    return true;
+  }
+}
+
+// The register written, or "" if none (or if the effects are unknown).
+static std::string writes(const Instr& ins)
+{
+  switch (kind_of(ins)) {
+  case LOAD:
+  case DEF:
+  case TRAP:
+    return ins.args[0];
+  default:
+    return "";
+  }
+}
+
+// True if the only effect of `ins' is to write its destination.
+static bool only_writes(const Instr& ins)
+{
+  Kind k = kind_of(ins);
+  return (k == LOAD || k == DEF) && ins.args[0] != "$zero";
+}
+
+// True if `ins' overwrites `r' without looking at its old value.
+static bool kills(const Instr& ins, const std::string& r)
+{
+  return writes(ins) == r && !reads(ins, r);
+}
+
+static bool is_jump_target(const std::string& op)
+{
+  return op == "b" || op == "j";
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// The optimizer
+//
+///////////////////////////////////////////////////////////////////////
+
+Peephole::Peephole() : instrs_in(0), instrs_out(0)
+{
+  for (int r = 0; r < NUM_RULES; r++) {
+    enabled[r] = true;
+    fired[r] = 0;
+  }
+}
+
+bool Peephole::configure(const std::string& spec)
+{
+  std::istringstream in(spec);
+  std::string item;
+  bool ok = true;
+  while (std::getline(in, item, ',')) {
+    bool on = true;
+    if (!item.empty() && item[0] == '-') {
+      on = false;
+      item = item.substr(1);
+    }
+    if (item == "all" || item == "none") {
+      for (int r = 0; r < NUM_RULES; r++)
+        enabled[r] = on && item == "all";
+      continue;
+    }
+    int r = 0;
+    while (r < NUM_RULES && item != rule_names[r])
+      r++;
+    if (r == NUM_RULES)
+      ok = false;
+    else
+      enabled[r] = on;
+  }
+  return ok;
+}
+
+//
+// Tries the straight-line rules at code[i].  Returns true if the code
+// changed.
+//
+bool Peephole::rewrite(InstrList& code, size_t i)
+{
+  Instr& a = code[i];
+  if (!a.is_instr())
+    return false;
+
+  if (enabled[SELF_MOVE] && a.op == "move" && a.args.size() == 2 &&
+      a.args[0] == a.args[1]) {
+    code.erase(code.begin() + i);
+    fired[SELF_MOVE]++;
+    return true;
+  }
+
+  if (i + 1 >= code.size() || !code[i + 1].is_instr())
+    return false;
+  Instr& b = code[i + 1];
+
+  // sw $a x; lw $b x  =>  sw $a x; move $b $a
+  if (enabled[STORE_LOAD] && a.op == "sw" && b.op == "lw" &&
+      kind_of(a) == STORE && kind_of(b) == LOAD && a.args[1] == b.args[1]) {
+    if (b.args[0] == a.args[0])
+      code.erase(code.begin() + i + 1);
+    else {
+      b.op = "move";
+      b.args[1] = a.args[0];
+    }
+    fired[STORE_LOAD]++;
+    return true;
+  }
+
+  // addiu $r $r m; addiu $r $r n  =>  addiu $r $r m+n
+  if (enabled[STACK_ADJUST] && a.op == "addiu" && b.op == "addiu" &&
+      a.args.size() == 3 && b.args.size() == 3 &&
+      a.args[0] == a.args[1] && b.args[0] == a.args[0] && b.args[1] == a.args[0]) {
+    int n = atoi(a.args[2].c_str()) + atoi(b.args[2].c_str());
+    if (n == 0)
+      code.erase(code.begin() + i, code.begin() + i + 2);
+    else {
+      a.args[2] = std::to_string(n);
+      code.erase(code.begin() + i + 1);
+    }
+    fired[STACK_ADJUST]++;
+    return true;
+  }
+
+  // op $a ..; op' $a ..  =>  op' $a ..   if op' does not read $a
+  if (enabled[DEAD_WRITE] && only_writes(a) && kills(b, a.args[0])) {
+    code.erase(code.begin() + i);
+    fired[DEAD_WRITE]++;
+    return true;
+  }
+
+  if (i + 2 >= code.size() || !code[i + 2].is_instr())
+    return false;
+  Instr& c = code[i + 2];
+
+  // op $a ..; move $b $a; op' $a ..  =>  op $b ..; op' $a ..
+  if (enabled[COPY_FORWARD] && only_writes(a) && b.op == "move" &&
+      kind_of(b) == DEF && b.args[1] == a.args[0] && b.args[0] != a.args[0] &&
+      b.args[0] != "$zero" && kills(c, a.args[0])) {
+    a.args[0] = b.args[0];
+    code.erase(code.begin() + i + 1);
+    fired[COPY_FORWARD]++;
+    return true;
+  }
+
+  return false;
+}
+
+//
+// The control flow rules.  Labels are local to a method, so every
+// branch target is in `code'.
+//
+bool Peephole::rewrite_jumps(InstrList& code)
+{
+  bool changed = false;
+
+  if (enabled[DEAD_CODE]) {
+    for (size_t i = 0; i < code.size(); i++) {
+      const Instr& ins = code[i];
+      if (!(is_jump_target(ins.op) || ins.op == "jr"))
+        continue;
+      size_t j = i + 1;
+      while (j < code.size() && code[j].is_instr())
+        j++;
+      if (j > i + 1) {
+        fired[DEAD_CODE] += j - i - 1;
+        code.erase(code.begin() + i + 1, code.begin() + j);
+        changed = true;
+      }
+    }
+  }
+
+  std::map<std::string, size_t> labels;
+  for (size_t i = 0; i < code.size(); i++)
+    if (code[i].is_label())
+      labels[code[i].label] = i;
+
+  // The first instruction at or after `label', or NULL.
+  auto code_at = [&](const std::string& label) -> const Instr * {
+    auto it = labels.find(label);
+    if (it == labels.end())
+      return NULL;
+    for (size_t j = it->second; j < code.size(); j++)
+      if (code[j].is_instr())
+        return &code[j];
+    return NULL;
+  };
+
+  if (enabled[JUMP_CHAIN]) {
+    for (Instr& ins : code) {
+      Kind k = kind_of(ins);
+      if (k != JUMP && k != BRANCH)
+        continue;
+      std::string& target = ins.args.back();
+      for (int hops = 0; hops < 8; hops++) {
+        const Instr *next = code_at(target);
+        if (next == NULL || kind_of(*next) != JUMP || next->args[0] == target)
+          break;
+        target = next->args[0];
+        fired[JUMP_CHAIN]++;
+        changed = true;
+      }
+    }
+  }
+
+  if (enabled[JUMP_NEXT]) {
+    for (size_t i = 0; i < code.size(); i++) {
+      if (kind_of(code[i]) != JUMP)
+        continue;
+      for (size_t j = i + 1; j < code.size() && code[j].is_label(); j++)
+        if (code[j].label == code[i].args[0]) {
+          code.erase(code.begin() + i);
+          fired[JUMP_NEXT]++;
+          changed = true;
+          break;
+        }
+    }
+  }
+
+  return changed;
+}
+
+void Peephole::optimize(InstrList& code)
+{
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < code.size(); ) {
+      if (rewrite(code, i)) {
+        changed = true;
+        i = i > 2 ? i - 2 : 0;
+      } else
+        i++;
+    }
+    if (rewrite_jumps(code))
+      changed = true;
+  }
+}
+
+void Peephole::run(const std::string& text, std::ostream& s)
+{
+  InstrList code = parse_instrs(text);
+  instrs_in += count_instrs(code);
+  optimize(code);
+  instrs_out += count_instrs(code);
+  print_instrs(code, s);
+}
+
+void Peephole::report(std::ostream& s)
+{
+  s << "peephole: removed " << instrs_in - instrs_out << " of "
+    << instrs_in << " instructions" << std::endl;
+  for (int r = 0; r < NUM_RULES; r++)
+    s << "  " << rule_names[r] << ": " << fired[r]
+      << (enabled[r] ? "" : " (disabled)") << std::endl;
+}
@@ -0,0 +1,73 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//
+// One line of generated text: a label definition or an instruction with
+// its operands, e.g. op "lw" with args {"$a0", "12($fp)"}.  Lines the
+// optimizer does not understand are kept verbatim in `text'.
+//
+struct Instr {
+  std::string label;
+  std::string op;
+  std::vector<std::string> args;
+  std::string text;
+
+  bool is_label() const { return !label.empty(); }
+  bool is_instr() const { return !op.empty(); }
+};
+typedef std::vector<Instr> InstrList;
+
+InstrList parse_instrs(const std::string& code);
+void print_instrs(const InstrList& code, std::ostream& s);
+
+//
+// The peephole optimizer rewrites the code of one method at a time.
+// Labels, calls and returns end a window, so every rule only looks at
+// straight-line code.  Rules are switched on and off by name with
+// `configure', which takes a comma separated list: "all", "none",
+// a rule name, or a rule name prefixed by '-' to disable it.
+// Once configured, one optimizer can be shared by several threads.
+//
+class Peephole {
+public:
+  enum Rule {
+    SELF_MOVE,       // move $r $r
+    STORE_LOAD,      // sw $a x; lw $b x         => sw $a x; move $b $a
+    COPY_FORWARD,    // op $a ..; move $b $a     => op $b ..   ($a dead)
+    DEAD_WRITE,      // op $a ..; op' $a ..      => op' $a ..  (op' ignores $a)
+    STACK_ADJUST,    // addiu $r $r m; addiu $r $r n => addiu $r $r m+n
+    JUMP_CHAIN,      // branch to a label whose code is `b L'
+    JUMP_NEXT,       // b L; L:
+    DEAD_CODE,       // code after b or jr up to the next label
+    NUM_RULES
+  };
+  static const char *rule_names[NUM_RULES];
+
+  Peephole();
+  bool configure(const std::string& spec);
+  void optimize(InstrList& code);
+  void run(const std::string& code, std::ostream& s);
+  void report(std::ostream& s);
+
+private:
+  bool enabled[NUM_RULES];
+  std::atomic<int> fired[NUM_RULES];
+  std::atomic<int> instrs_in;
+  std::atomic<int> instrs_out;
+
+  bool rewrite(InstrList& code, size_t i);
+  bool rewrite_jumps(InstrList& code);
+};
+
+#endif
@@ -0,0 +1,222 @@
+//
+// Tests of the peephole rules (make peephole_test).
+//
+// Each case runs one rule alone on a hand-written window and checks the
+// code it rewrites the window to.  Straight-line windows are also run,
+// before and after, from a few register and memory states, and must
+// leave the same registers and memory.
+//
+#include <stdint.h>
+#include <stdlib.h>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include "peephole.h"
+
+struct Case {
+  const char *rule;
+  const char *name;
+  const char *in;
+  const char *out;        // equal to `in' if the rule must not fire
+  bool straight;          // run both windows and compare their effects
+};
+
+static const Case cases[] = {
+  {"self-move", "removed",
+   "\tmove\t$a0 $a0\n\tlw\t$t1 4($a0)\n",
+   "\tlw\t$t1 4($a0)\n", true},
+  {"self-move", "other register",
+   "\tmove\t$a0 $s0\n",
+   "\tmove\t$a0 $s0\n", true},
+
+  {"store-load", "to a register",
+   "\tsw\t$a0 0($sp)\n\tlw\t$t1 0($sp)\n",
+   "\tsw\t$a0 0($sp)\n\tmove\t$t1 $a0\n", true},
+  {"store-load", "to the stored register",
+   "\tsw\t$a0 4($fp)\n\tlw\t$a0 4($fp)\n",
+   "\tsw\t$a0 4($fp)\n", true},
+  {"store-load", "other address",
+   "\tsw\t$a0 0($sp)\n\tlw\t$t1 4($sp)\n",
+   "\tsw\t$a0 0($sp)\n\tlw\t$t1 4($sp)\n", true},
+
+  {"copy-forward", "source overwritten",
+   "\tlw\t$a0 12($s0)\n\tmove\t$s1 $a0\n\tli\t$a0 5\n",
+   "\tlw\t$s1 12($s0)\n\tli\t$a0 5\n", true},
+  {"copy-forward", "source read again",
+   "\tlw\t$a0 12($s0)\n\tmove\t$s1 $a0\n\taddu\t$a0 $a0 $s1\n",
+   "\tlw\t$a0 12($s0)\n\tmove\t$s1 $a0\n\taddu\t$a0 $a0 $s1\n", true},
+  {"copy-forward", "source live after",
+   "\tli\t$a0 3\n\tmove\t$s1 $a0\n\tsw\t$a0 0($sp)\n",
+   "\tli\t$a0 3\n\tmove\t$s1 $a0\n\tsw\t$a0 0($sp)\n", true},
+
+  {"dead-write", "overwritten",
+   "\tli\t$t1 4\n\tli\t$t1 5\n",
+   "\tli\t$t1 5\n", true},
+  {"dead-write", "read by the next",
+   "\tli\t$t1 4\n\taddu\t$t1 $t1 $t2\n",
+   "\tli\t$t1 4\n\taddu\t$t1 $t1 $t2\n", true},
+  {"dead-write", "a trap is kept",
+   "\tadd\t$t1 $t2 $t3\n\tli\t$t1 0\n",
+   "\tadd\t$t1 $t2 $t3\n\tli\t$t1 0\n", false},
+  {"dead-write", "a trapping neg is kept",
+   "\tneg\t$a0 $a0\n\tla\t$a0 str_const1\n",
+   "\tneg\t$a0 $a0\n\tla\t$a0 str_const1\n", false},
+  {"dead-write", "a store is kept",
+   "\tsw\t$t1 0($sp)\n\tli\t$t1 0\n",
+   "\tsw\t$t1 0($sp)\n\tli\t$t1 0\n", true},
+
+  {"stack-adjust", "cancelled",
+   "\taddiu\t$sp $sp -4\n\taddiu\t$sp $sp 4\n",
+   "", true},
+  {"stack-adjust", "merged",
+   "\taddiu\t$sp $sp -4\n\taddiu\t$sp $sp -8\n",
+   "\taddiu\t$sp $sp -12\n", true},
+  {"stack-adjust", "other register",
+   "\taddiu\t$sp $sp -4\n\taddiu\t$fp $fp 4\n",
+   "\taddiu\t$sp $sp -4\n\taddiu\t$fp $fp 4\n", true},
+
+  {"jump-chain", "branch to a jump",
+   "\tbeqz\t$a0 label1\n\tli\t$a0 1\nlabel1:\n\tb\tlabel2\nlabel2:\n\tjr\t$ra\n",
+   "\tbeqz\t$a0 label2\n\tli\t$a0 1\nlabel1:\n\tb\tlabel2\nlabel2:\n\tjr\t$ra\n", false},
+  {"jump-chain", "jump to itself",
+   "label1:\n\tb\tlabel1\n",
+   "label1:\n\tb\tlabel1\n", false},
+
+  {"jump-next", "jump to the next label",
+   "\tb\tlabel1\nlabel0:\nlabel1:\n\tjr\t$ra\n",
+   "label0:\nlabel1:\n\tjr\t$ra\n", false},
+  {"jump-next", "code in between",
+   "\tbeqz\t$a0 label1\n\tb\tlabel2\nlabel1:\n\tli\t$a0 1\nlabel2:\n\tjr\t$ra\n",
+   "\tbeqz\t$a0 label1\n\tb\tlabel2\nlabel1:\n\tli\t$a0 1\nlabel2:\n\tjr\t$ra\n", false},
+
+  {"dead-code", "after a jump",
+   "\tb\tlabel1\n\tli\t$a0 1\n\tsw\t$a0 0($sp)\nlabel1:\n\tjr\t$ra\n",
+   "\tb\tlabel1\nlabel1:\n\tjr\t$ra\n", false},
+  {"dead-code", "after a branch",
+   "\tbeqz\t$a0 label1\n\tli\t$a0 1\nlabel1:\n\tjr\t$ra\n",
+   "\tbeqz\t$a0 label1\n\tli\t$a0 1\nlabel1:\n\tjr\t$ra\n", false},
+};
+
+///////////////////////////////////////////////////////////////////////
+//
+// Running straight-line code
+//
+///////////////////////////////////////////////////////////////////////
+
+struct State {
+  std::map<std::string, uint32_t> regs;
+  std::map<uint32_t, uint32_t> mem;
+  uint32_t seed;
+
+  // values not yet written are made up from the seed
+  uint32_t made_up(uint32_t x) { return (x ^ seed) * 2654435761u + seed; }
+  uint32_t& reg(const std::string& r)
+  {
+    if (!regs.count(r)) {
+      uint32_t h = 0;
+      for (char c : r)
+        h = h * 31 + c;
+      regs[r] = r == "$zero" ? 0 : made_up(h);
+    }
+    return regs[r];
+  }
+  uint32_t& word(const std::string& addr)
+  {
+    size_t open = addr.find('(');
+    uint32_t a = reg(addr.substr(open + 1, addr.find(')') - open - 1)) +
+                 (uint32_t) atoi(addr.substr(0, open).c_str());
+    if (!mem.count(a))
+      mem[a] = made_up(a);
+    return mem[a];
+  }
+};
+
+// Runs `code' from `st'; false if it has an instruction this does not know.
+static bool execute(const InstrList& code, State& st)
+{
+  for (const Instr& ins : code) {
+    const std::vector<std::string>& a = ins.args;
+    auto src = [&](size_t n) { return a[n][0] == '$' ? st.reg(a[n])
+                                                     : (uint32_t) atoi(a[n].c_str()); };
+    if (!ins.is_instr())
+      continue;
+    else if (ins.op == "lw" && a.size() == 2)
+      st.reg(a[0]) = st.word(a[1]);
+    else if (ins.op == "sw" && a.size() == 2)
+      st.word(a[1]) = st.reg(a[0]);
+    else if ((ins.op == "li" || ins.op == "move") && a.size() == 2)
+      st.reg(a[0]) = src(1);
+    else if ((ins.op == "addu" || ins.op == "addiu" || ins.op == "add") && a.size() == 3)
+      st.reg(a[0]) = src(1) + src(2);
+    else if (ins.op == "subu" && a.size() == 3)
+      st.reg(a[0]) = src(1) - src(2);
+    else if (ins.op == "mul" && a.size() == 3)
+      st.reg(a[0]) = src(1) * src(2);
+    else
+      return false;
+  }
+  return true;
+}
+
+static bool same_effects(const InstrList& before, const InstrList& after, std::string& why)
+{
+  for (uint32_t seed = 1; seed <= 4; seed++) {
+    State s1, s2;
+    s1.seed = s2.seed = seed;
+    if (!execute(before, s1) || !execute(after, s2)) {
+      why = "cannot run the window";
+      return false;
+    }
+    // compare every register either touched, and every word either wrote
+    std::set<std::string> regs;
+    for (auto& r : s1.regs) regs.insert(r.first);
+    for (auto& r : s2.regs) regs.insert(r.first);
+    for (const std::string& r : regs)
+      if (s1.reg(r) != s2.reg(r)) {
+        why = r + " differs";
+        return false;
+      }
+    std::set<uint32_t> words;
+    for (auto& w : s1.mem) words.insert(w.first);
+    for (auto& w : s2.mem) words.insert(w.first);
+    for (uint32_t w : words) {
+      if (!s1.mem.count(w)) s1.mem[w] = s1.made_up(w);
+      if (!s2.mem.count(w)) s2.mem[w] = s2.made_up(w);
+      if (s1.mem[w] != s2.mem[w]) {
+        why = "memory differs";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  int failed = 0;
+  for (const Case& c : cases) {
+    Peephole opt;
+    if (!opt.configure(std::string("none,") + c.rule)) {
+      std::cerr << c.rule << ": no such rule" << std::endl;
+      return 1;
+    }
+    InstrList in = parse_instrs(c.in), code = in;
+    opt.optimize(code);
+    std::ostringstream out;
+    print_instrs(code, out);
+
+    std::string why;
+    if (out.str() != c.out)
+      why = "rewritten to\n" + out.str() + "expected\n" + c.out;
+    else if (c.straight)
+      same_effects(in, code, why);
+    std::cout << c.rule << ", " << c.name << ": " << (why.empty() ? "ok" : "FAILED") << std::endl;
+    if (!why.empty()) {
+      std::cout << why << (why[why.size() - 1] == '\n' ? "" : "\n");
+      failed++;
+    }
+  }
+  return failed != 0;
+}
@@ -0,0 +1,114 @@
+#!/bin/bash
+#
+# Checks the optimizer and the other targets against the plain MIPS code:
+# every program must print the same with -O, with each peephole rule on
+# its own, on the bytecode interpreter and its JIT, and natively on
+# x86-64, with and without the collector.  Programs that read input get
+# tests/<name>.in.  Exits non-zero if any program fails to compile or
+# prints something different.
+#
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+NC='\033[0m'
+
+SPIM=/afs/ir/class/cs143/bin/spim
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# the names in Peephole::rule_names
+RULES="self-move store-load copy-forward dead-write stack-adjust jump-chain jump-next dead-code"
+
+shopt -s nullglob
+status=0
+
+fail() {
+    echo -e "${RED}$*${NC}"
+    status=1
+}
+
+# the program's output for the input file $2, without spim's banner;
+# without spim the programs run on the simulator (make coolsim)
+run_mips() {
+    if [ -x $SPIM ]; then
+        timeout 10 $SPIM -file "$1" < "$2" 2>&1 | sed '1,/^Loaded: /d'
+    else
+        timeout 10 ./coolsim "$1" < "$2" 2>&1
+    fi
+}
+
+# check <file> <what> <expected> <actual>
+check() {
+    if [ "$3" = "$4" ]; then
+        echo -e "$1 ($2) ${GREEN}✓${NC}"
+    else
+        fail "Difference found in $1 ($2):"
+        diff <(echo "$3") <(echo "$4")
+    fi
+}
+
+# the rules on hand-written code (make peephole_test)
+if [ -x ./peephole_test ]; then
+    ./peephole_test > "$OUT/peephole.log" || { fail "peephole_test failed:"; cat "$OUT/peephole.log"; }
+else
+    fail "peephole_test is not built"
+fi
+
+for file in example.cl ../PS2/tests/*.cl tests/*.cl; do
+    name=$(basename "$file" .cl)
+    # atoi.cl has no Main; it is compiled together with atoi_test.cl
+    [ "$name" = atoi ] && continue
+    srcs="$file"
+    [ "$name" = atoi_test ] && srcs="$file ../PS2/tests/atoi.cl"
+    input=tests/$name.in
+    [ -f "$input" ] || input=/dev/null
+
+    if ! ./mycoolc -o "$OUT/$name.s" $srcs; then
+        fail "$file does not compile"
+        continue
+    fi
+    plain=$(run_mips "$OUT/$name.s" "$input")
+
+    # -O, with all the peephole rules, none, and each one alone
+    for rules in all none $RULES; do
+        if ! CGEN_PEEPHOLE=none,$rules ./mycoolc -O -o "$OUT/$name.opt.s" $srcs; then
+            fail "$file does not compile with -O ($rules)"
+            continue
+        fi
+        check "$file" "-O $rules" "$plain" "$(run_mips "$OUT/$name.opt.s" "$input")"
+    done
+
+    # so must the bytecode interpreter, and on x86-64 its JIT
+    if [ -x ./coolvm ]; then
+        if CGEN_TARGET=bytecode ./mycoolc -O -o "$OUT/$name.cbc" $srcs; then
+            modes="bytecode"
+            [ "$(uname -m)" = x86_64 ] && modes="bytecode jit"
+            for mode in $modes; do
+                flags=""; [ $mode = jit ] && flags="-j"
+                check "$file" $mode "$plain" "$(timeout 10 ./coolvm $flags "$OUT/$name.cbc" < "$input" 2>&1)"
+            done
+        else
+            fail "$file does not compile to bytecode"
+        fi
+    fi
+
+    # on x86-64, the native build must print what spim does
+    [ "$(uname -m)" = x86_64 ] || continue
+    if CGEN_TARGET=x86-64 ./mycoolc -O -o "$OUT/$name.x86.s" $srcs &&
+       gcc -no-pie -o "$OUT/$name.x86" "$OUT/$name.x86.s" x86-runtime.c x86-runtime.s; then
+        check "$file" x86-64 "$plain" "$(timeout 10 "$OUT/$name.x86" < "$input" 2>&1)"
+    else
+        fail "$file does not build for x86-64"
+    fi
+
+    # again with the generational collector, collecting at every
+    # allocation, so a bad stack map or root shows up as a difference
+    if CGEN_TARGET=x86-64 ./mycoolc -O -g -t -o "$OUT/$name.x86gc.s" $srcs &&
+       gcc -no-pie -o "$OUT/$name.x86gc" "$OUT/$name.x86gc.s" x86-runtime.c x86-runtime.s; then
+        check "$file" "x86-64 -g -t" "$plain" "$(timeout 10 "$OUT/$name.x86gc" < "$input" 2>&1)"
+    else
+        fail "$file does not build for x86-64 with -g -t"
+    fi
+done
+
+exit $status
@@ -0,0 +1,11 @@
+-- -O drops statements of a block whose values are unused only if they
+-- cannot fail: this division by zero must still stop the program.
+class Main inherits IO {
+  zero : Int <- 0;
+
+  main() : Object { {
+    out_string("dividing\n");
+    1 / zero;
+    out_string("not reached\n");
+  } };
+};
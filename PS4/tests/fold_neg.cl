@@ -0,0 +1,12 @@
+-- Negating the least Int overflows.  The negation is not total, so -O
+-- keeps it as a statement, and the peephole optimizer must not delete
+-- it either when the next instruction overwrites its result.
+class Main inherits IO {
+  least : Int <- ~2147483647 - 1;
+
+  main() : Object { {
+    out_string("negating\n");
+    ~least;
+    out_string("not reached\n");
+  } };
+};
@@ -0,0 +1,14 @@
+-- -O drops statements of a block whose values are unused only if they
+-- cannot fail: this overflow must still stop the program, while the
+-- multiplication and comparison beside it may go.
+class Main inherits IO {
+  big : Int <- 2147483647;
+
+  main() : Object { {
+    big * 2;
+    big < 0;
+    out_string("adding\n");
+    big + 1;
+    out_string("not reached\n");
+  } };
+};
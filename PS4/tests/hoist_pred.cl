@@ -0,0 +1,13 @@
+-- An invariant that may fail is moved out of a loop only if nothing
+-- with an effect comes before it in the predicate: this one must fail
+-- after the predicate has printed, not before the loop starts.
+class Main inherits IO {
+  big : Int <- 2147483647;
+
+  main() : Object {
+    let i : Int <- 0 in
+      while { out_string("pred\n"); i < big + 1; } loop
+        i <- i + 1
+      pool
+  };
+};
@@ -0,0 +1,63 @@
+-- Loops whose invariants -O moves out and whose induction variables it
+-- strength reduces, and loops where it must not.  Each loop has its own
+-- variables, as the optimizer tells variables apart by name.
+class Main inherits IO {
+  k : Int <- 3;
+  n : Int <- 7;
+  s : String <- "hello";
+  big : Int <- 2147483647;
+
+  bump() : Int { n <- n + 1 };
+
+  show(x : Int) : Object { { out_int(x); out_string("\n"); } };
+
+  main() : Object { {
+    -- k * 3 and s.length() are invariant, a * 4 is reduced
+    let a : Int <- 0, sum : Int <- 0 in {
+      while a < s.length() loop { sum <- sum + k * 3 + a * 4; a <- a + 1; } pool;
+      show(sum);
+    };
+
+    -- n changes through a call in the body, so n * 2 is not invariant
+    let b : Int <- 0, sum : Int <- 0 in {
+      while b < 5 loop { sum <- sum + n * 2; bump(); b <- b + 1; } pool;
+      show(sum);
+    };
+
+    -- an induction variable stepping down, in the predicate and the body
+    let c : Int <- 10, sum : Int <- 0 in {
+      while 0 < c * 2 loop { sum <- sum + c * 5; c <- c - 3; } pool;
+      show(sum);
+    };
+
+    -- assigned twice, so not an induction variable
+    let d : Int <- 0, sum : Int <- 0 in {
+      while d < 10 loop {
+        sum <- sum + d * 7;
+        d <- d + 1;
+        if d = 5 then d <- 8 else 0 fi;
+      } pool;
+      show(sum);
+    };
+
+    -- a division that would fail stays in a body that never runs
+    let e : Int <- 0, z : Int <- 0 in {
+      while e < 0 loop { show(10 / z); e <- e + 1; } pool;
+      out_string("no division\n");
+    };
+
+    -- the inner invariant depends on the outer induction variable
+    let f : Int <- 0, sum : Int <- 0 in {
+      while f < 4 loop {
+        let g : Int <- 0 in
+          while g < 3 loop { sum <- sum + f * 10 + g; g <- g + 1; } pool;
+        f <- f + 1;
+      } pool;
+      show(sum);
+    };
+
+    -- the overflow comes after a call in the predicate
+    let h : Int <- 0 in
+      while { show(h); h < big + 1; } loop h <- h + 1 pool;
+  } };
+};
@@ -0,0 +1,1138 @@
+//
+// The bytecode format, the interpreter and the JIT.
+//
+// Values are tagged words: 0 is void, an Int i is 4i+1, a Bool b is
+// 4b+3, and anything else points to an object.  Tagged Ints compare
+// like the values they hold.  Objects have the header of the MIPS
+// prototype objects (tag, size, dispatch table) followed by the
+// attributes.  Every value a method holds is in its registers, so the
+// register stack up to the top window is exactly the collector's roots.
+//
+// The interpreter threads the code when it starts: every opcode is
+// replaced by the address of the code that runs it, and each
+// instruction ends by jumping to the next one's (computed goto).
+// Cool calls do not nest C calls, so recursion is only limited by the
+// register stack.  Each dynamic dispatch site caches the last class it
+// saw with the method that class runs.
+//
+// The JIT instead translates each method to x86-64 the first time it
+// is called (see JIT below).
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <algorithm>
+#include "vm.h"
+
+const char *vm_op_names[VM_NUM_OPS] = {
+  "move", "const", "add", "sub", "mul", "div", "neg", "step", "lt", "le",
+  "eq", "not", "isvoid", "jump", "jfalse", "getattr", "setattr", "new",
+  "newself", "call", "scall", "case", "ret",
+};
+
+const int vm_op_args[VM_NUM_OPS] = {
+  2, 2, 3, 3, 3, 3, 2, 2, 3, 3,
+  3, 2, 2, 1, 2, 2, 2, 3,
+  2, 4, 4, 2, 1,
+};
+
+///////////////////////////////////////////////////////////////////////
+//
+// Reading and writing
+//
+// The format is text: a section header with the number of entries,
+// then one entry per line.  Strings are written as their length and
+// the raw bytes.
+//
+///////////////////////////////////////////////////////////////////////
+
+static void write_ints(std::ostream& s, const std::vector<int>& v)
+{
+  s << " " << v.size();
+  for (int x : v)
+    s << " " << x;
+}
+
+void VmProgram::write(std::ostream& s) const
+{
+  s << "coolvm 1" << std::endl;
+  s << "strings " << strings.size() << std::endl;
+  for (auto& str : strings)
+    s << str.size() << " " << str << std::endl;
+  s << "consts " << consts.size() << std::endl;
+  for (auto& c : consts)
+    s << c.kind << " " << c.value << std::endl;
+  s << "classes " << classes.size() << " " << int_class << " " << bool_class
+    << " " << string_class << " " << main_class << " " << main_method << std::endl;
+  for (auto& c : classes) {
+    s << c.name << " " << c.parent << " " << c.max_tag << " " << c.init;
+    write_ints(s, c.attrs);
+    write_ints(s, c.vtable);
+    s << std::endl;
+  }
+  s << "methods " << methods.size() << std::endl;
+  for (auto& m : methods) {
+    s << m.name << " " << m.nformals << " " << m.nregs << " " << m.builtin
+      << " " << m.code.size();
+    for (int32_t w : m.code)
+      s << " " << w;
+    s << std::endl;
+  }
+  s << "sites " << sites.size() << std::endl;
+  for (auto& site : sites)
+    s << site.file << " " << site.line << " " << site.target << std::endl;
+  s << "cases " << cases.size() << std::endl;
+  for (auto& c : cases) {
+    s << c.file << " " << c.line << " " << c.branches.size();
+    for (auto& b : c.branches)
+      s << " " << b.tag << " " << b.max_tag << " " << b.target;
+    s << std::endl;
+  }
+}
+
+static bool read_section(std::istream& s, const char *name, size_t& n)
+{
+  std::string word;
+  return (s >> word >> n) && word == name;
+}
+
+static bool read_ints(std::istream& s, std::vector<int>& v)
+{
+  size_t n;
+  if (!(s >> n))
+    return false;
+  v.resize(n);
+  for (size_t i = 0; i < n; i++)
+    if (!(s >> v[i]))
+      return false;
+  return true;
+}
+
+bool VmProgram::read(std::istream& s)
+{
+  std::string magic;
+  int version;
+  size_t n;
+  if (!(s >> magic >> version) || magic != "coolvm" || version != 1)
+    return false;
+
+  if (!read_section(s, "strings", n))
+    return false;
+  strings.resize(n);
+  for (auto& str : strings) {
+    size_t len;
+    if (!(s >> len) || s.get() != ' ')
+      return false;
+    str.resize(len);
+    if (!s.read(&str[0], len))
+      return false;
+  }
+
+  if (!read_section(s, "consts", n))
+    return false;
+  consts.resize(n);
+  for (auto& c : consts) {
+    int kind;
+    if (!(s >> kind >> c.value))
+      return false;
+    c.kind = (decltype(c.kind)) kind;
+  }
+
+  if (!read_section(s, "classes", n) ||
+      !(s >> int_class >> bool_class >> string_class >> main_class >> main_method))
+    return false;
+  classes.resize(n);
+  for (auto& c : classes)
+    if (!(s >> c.name >> c.parent >> c.max_tag >> c.init) ||
+        !read_ints(s, c.attrs) || !read_ints(s, c.vtable))
+      return false;
+
+  if (!read_section(s, "methods", n))
+    return false;
+  methods.resize(n);
+  for (auto& m : methods) {
+    size_t len;
+    if (!(s >> m.name >> m.nformals >> m.nregs >> m.builtin >> len))
+      return false;
+    m.code.resize(len);
+    for (size_t i = 0; i < len; i++)
+      if (!(s >> m.code[i]))
+        return false;
+  }
+
+  if (!read_section(s, "sites", n))
+    return false;
+  sites.resize(n);
+  for (auto& site : sites)
+    if (!(s >> site.file >> site.line >> site.target))
+      return false;
+
+  if (!read_section(s, "cases", n))
+    return false;
+  cases.resize(n);
+  for (auto& c : cases) {
+    size_t branches;
+    if (!(s >> c.file >> c.line >> branches))
+      return false;
+    c.branches.resize(branches);
+    for (auto& b : c.branches)
+      if (!(s >> b.tag >> b.max_tag >> b.target))
+        return false;
+  }
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+// Values and objects
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef intptr_t Value;
+
+#define INT(i) ((Value) (int32_t) (i) * 4 + 1)
+#define INT_OF(v) ((int32_t) ((v) >> 2))
+#define BOOL(b) ((b) ? 7 : 3)
+#define IS_INT(v) (((v) & 3) == 1)
+#define IS_BOOL(v) (((v) & 3) == 3)
+#define TRUE_VALUE 7
+
+struct VmMethod;
+
+//
+// `size' is in bytes; the collector keeps its mark in the top bit.
+//
+struct Obj {
+  int32_t tag;
+  uint32_t size;
+  VmMethod **disptab;
+  Value attrs[1];
+};
+
+struct Str {
+  int32_t tag;
+  uint32_t size;
+  VmMethod **disptab;
+  int32_t len;
+  char chars[1];
+};
+
+#define GC_MARK 0x80000000u
+
+struct VmClass {
+  int tag, max_tag;
+  Str *name;
+  std::vector<Value> defaults;
+  std::vector<VmMethod *> vtable;
+  VmMethod *init;
+};
+
+typedef Value (*NativeCode)(Value *regs);
+
+struct VmMethod {
+  int builtin;
+  int nformals;
+  int nregs;
+  std::vector<intptr_t> code;
+  NativeCode native;            // set by the JIT
+};
+
+struct VmCallSite {
+  Str *file;
+  int line;
+  int target;
+  int cached;                   // the tag last seen, and its method
+  VmMethod *method;
+};
+
+struct VmCaseTable {
+  Str *file;
+  int line;
+  std::vector<VmCase::Branch> branches;
+};
+
+//
+// The program as the interpreter sees it.
+//
+static std::vector<VmClass> classes;
+static std::vector<VmMethod> methods;
+static std::vector<VmCallSite> sites;
+static std::vector<VmCaseTable> cases;
+static std::vector<Value> consts;
+static int int_tag, bool_tag, string_tag;
+static uint64_t executed;
+
+#define REGISTER_STACK (8 << 20)
+#define FRAME_STACK (1 << 20)
+
+static int tag_of(Value v)
+{
+  if (IS_INT(v))
+    return int_tag;
+  if (IS_BOOL(v))
+    return bool_tag;
+  return ((Obj *) v)->tag;
+}
+
+static VmClass *class_of(Value v) { return &classes[tag_of(v)]; }
+
+static void out(Str *s) { fwrite(s->chars, 1, s->len, stdout); }
+
+static void fatal(const char *msg)
+{
+  fflush(stdout);
+  fprintf(stderr, "%s\n", msg);
+  exit(1);
+}
+
+static void abort_at(Str *file, int line, const char *msg)
+{
+  out(file);
+  printf(":%d: %s\n", line, msg);
+  exit(1);
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// The heap
+//
+// Objects are allocated with malloc and collected by mark and sweep
+// once the heap has grown to twice what survived the last collection.
+// The roots are the registers of the calls in progress: each call
+// clears the registers it has not written (enter_window), so none of
+// them holds a stale pointer, and the windows end at `stack_top'.
+// Constants and class names are allocated outside the heap, marked.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define GC_MIN_HEAP (8 << 20)
+
+static std::vector<Obj *> heap;
+static size_t heap_bytes, heap_limit = GC_MIN_HEAP;
+static int collections;
+static Value *stack_base, *stack_top, *stack_end;
+
+static void mark(Value v, std::vector<Obj *>& work)
+{
+  if (v == 0 || (v & 3))
+    return;
+  Obj *obj = (Obj *) v;
+  if (obj->size & GC_MARK)
+    return;
+  obj->size |= GC_MARK;
+  if (obj->tag != string_tag)
+    work.push_back(obj);
+}
+
+static void collect()
+{
+  std::vector<Obj *> work;
+  for (Value *r = stack_base; r < stack_top; r++)
+    mark(*r, work);
+  while (!work.empty()) {
+    Obj *obj = work.back();
+    work.pop_back();
+    size_t n = classes[obj->tag].defaults.size();
+    for (size_t i = 0; i < n; i++)
+      mark(obj->attrs[i], work);
+  }
+
+  size_t kept = 0;
+  heap_bytes = 0;
+  for (Obj *obj : heap)
+    if (obj->size & GC_MARK) {
+      obj->size &= ~GC_MARK;
+      heap_bytes += obj->size;
+      heap[kept++] = obj;
+    } else
+      free(obj);
+  heap.resize(kept);
+  heap_limit = std::max((size_t) GC_MIN_HEAP, 2 * heap_bytes);
+  collections++;
+}
+
+static void *allocate(int tag, size_t size)
+{
+  if (heap_bytes >= heap_limit)
+    collect();
+  Obj *obj = (Obj *) malloc(size);
+  obj->tag = tag;
+  obj->size = size;
+  obj->disptab = classes[tag].vtable.data();
+  heap.push_back(obj);
+  heap_bytes += size;
+  return obj;
+}
+
+static Str *new_string(const char *s, size_t len)
+{
+  Str *str = (Str *) allocate(string_tag, offsetof(Str, chars) + len + 1);
+  str->len = len;
+  memcpy(str->chars, s, len);
+  str->chars[len] = 0;
+  return str;
+}
+
+static Str *static_string(const std::string& s)
+{
+  size_t size = offsetof(Str, chars) + s.size() + 1;
+  Str *str = (Str *) malloc(size);
+  str->tag = string_tag;
+  str->size = size | GC_MARK;
+  str->disptab = classes[string_tag].vtable.data();
+  str->len = s.size();
+  memcpy(str->chars, s.data(), s.size());
+  str->chars[s.size()] = 0;
+  return str;
+}
+
+static Value new_object(int tag)
+{
+  size_t n = classes[tag].defaults.size();
+  Obj *obj = (Obj *) allocate(tag, offsetof(Obj, attrs) + n * sizeof(Value));
+  if (n)
+    memcpy(obj->attrs, classes[tag].defaults.data(), n * sizeof(Value));
+  return (Value) obj;
+}
+
+//
+// Starts a call of `m' whose registers begin at `regs', and returns the
+// top of stack to restore when it returns.  The top only grows while
+// calls nest: a register the callee's window does not reach may still
+// hold a pointer the caller's caller reads back after the call, so it
+// stays a root.
+//
+static Value *enter_window(VmMethod *m, Value *regs)
+{
+  Value *top = stack_top;
+  Value *end = regs + m->nregs;
+  if (end > stack_end)
+    fatal("Stack overflow");
+  Value *locals = regs + 1 + m->nformals;
+  if (end > locals)
+    memset(locals, 0, (end - locals) * sizeof(Value));
+  if (end > top)
+    stack_top = end;
+  return top;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Operations shared by the interpreter and the JIT
+//
+///////////////////////////////////////////////////////////////////////
+
+static bool equal(Value a, Value b)
+{
+  if (a == b)
+    return true;
+  if (a == 0 || b == 0 || (a & 3) || (b & 3))
+    return false;
+  Str *x = (Str *) a, *y = (Str *) b;
+  return x->tag == string_tag && y->tag == string_tag &&
+         x->len == y->len && memcmp(x->chars, y->chars, x->len) == 0;
+}
+
+//
+// MIPS leaves INT_MIN / -1 as INT_MIN.
+//
+static Value divide(Value a, Value b)
+{
+  if (INT_OF(b) == 0)
+    fatal("Division by zero");
+  return INT(INT_OF(b) == -1 ? -(uint32_t) INT_OF(a) : INT_OF(a) / INT_OF(b));
+}
+
+//
+// The index of the branch of `table' that `v' takes.
+//
+static int case_branch(Value v, VmCaseTable& table)
+{
+  if (v == 0)
+    abort_at(table.file, table.line, "Match on void in case statement.");
+  int tag = tag_of(v);
+  for (size_t i = 0; i < table.branches.size(); i++)
+    if (tag >= table.branches[i].tag && tag <= table.branches[i].max_tag)
+      return i;
+  printf("No match in case statement for Class ");
+  out(class_of(v)->name);
+  printf("\n");
+  exit(1);
+}
+
+static VmMethod *lookup(Value self, VmCallSite& site)
+{
+  if (self == 0)
+    abort_at(site.file, site.line, "Dispatch to void.");
+  int tag = tag_of(self);
+  if (tag != site.cached) {
+    site.cached = tag;
+    site.method = classes[tag].vtable[site.target];
+  }
+  return site.method;
+}
+
+static Str *read_line()
+{
+  static char *line;
+  static size_t size;
+  fflush(stdout);
+  ssize_t n = getline(&line, &size, stdin);
+  if (n < 0)
+    n = 0;
+  if (n > 0 && line[n - 1] == '\n')
+    n--;
+  return new_string(n ? line : "", n);
+}
+
+//
+// `args' is the register window of the call: the receiver, then the
+// arguments.
+//
+static Value builtin(int id, Value *args)
+{
+  Value self = args[0];
+  switch (id) {
+  case VM_ABORT:
+    printf("Abort called from class ");
+    out(class_of(self)->name);
+    printf("\n");
+    exit(0);
+  case VM_TYPE_NAME:
+    return (Value) class_of(self)->name;
+  case VM_COPY: {
+    if (self & 3 || tag_of(self) == string_tag)
+      return self;
+    Obj *obj = (Obj *) new_object(tag_of(self));
+    memcpy(obj->attrs, ((Obj *) self)->attrs,
+           class_of(self)->defaults.size() * sizeof(Value));
+    return (Value) obj;
+  }
+  case VM_OUT_STRING:
+    out((Str *) args[1]);
+    return self;
+  case VM_OUT_INT:
+    printf("%d", INT_OF(args[1]));
+    return self;
+  case VM_IN_STRING: {
+    Str *s = read_line();
+    if (memchr(s->chars, 0, s->len) != NULL)
+      s->len = 0;
+    return (Value) s;
+  }
+  case VM_IN_INT:
+    return INT(atoi(read_line()->chars));
+  case VM_LENGTH:
+    return INT(((Str *) self)->len);
+  case VM_CONCAT: {
+    Str *a = (Str *) self, *b = (Str *) args[1];
+    Str *s = (Str *) allocate(string_tag, offsetof(Str, chars) + a->len + b->len + 1);
+    s->len = a->len + b->len;
+    memcpy(s->chars, a->chars, a->len);
+    memcpy(s->chars + a->len, b->chars, b->len);
+    s->chars[s->len] = 0;
+    return (Value) s;
+  }
+  case VM_SUBSTR: {
+    Str *s = (Str *) self;
+    int32_t i = INT_OF(args[1]), l = INT_OF(args[2]);
+    if (i < 0 || l < 0 || (int64_t) i + l > s->len) {
+      printf("Error: Index to substr is too big\n");
+      exit(1);
+    }
+    return (Value) new_string(s->chars + i, l);
+  }
+  }
+  fatal("bad builtin");
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// The interpreter
+//
+///////////////////////////////////////////////////////////////////////
+
+struct Frame {
+  VmMethod *method;
+  const intptr_t *pc;
+  Value *regs;
+  Value *dest;
+  Value *top;
+};
+
+//
+// Runs `m' with registers `regs'.  Called with a NULL method, it
+// threads the code of every method instead.
+//
+static Value interpret(VmMethod *m, Value *regs)
+{
+  static void *const ops[VM_NUM_OPS] = {
+    &&op_move, &&op_const, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_neg,
+    &&op_step, &&op_lt, &&op_le, &&op_eq, &&op_not, &&op_isvoid, &&op_jump,
+    &&op_jfalse, &&op_getattr, &&op_setattr, &&op_new, &&op_newself,
+    &&op_call, &&op_scall, &&op_case, &&op_ret,
+  };
+  static Frame *frames, *frames_end;
+
+  if (m == NULL) {
+    for (auto& method : methods)
+      for (size_t i = 0; i < method.code.size(); ) {
+        int op = method.code[i];
+        method.code[i] = (intptr_t) ops[op];
+        i += vm_op_args[op] + 1;
+      }
+    frames = (Frame *) malloc(FRAME_STACK * sizeof(Frame));
+    frames_end = frames + FRAME_STACK;
+    return 0;
+  }
+
+  Value *saved_top = enter_window(m, regs);
+  Frame *fp = frames;
+  const intptr_t *code = m->code.data();
+  const intptr_t *pc = code;
+  uint64_t n = 0;
+  Value a;
+  int32_t r;
+  VmMethod *callee;
+  Value *dest;
+
+#define R(i) regs[pc[i]]
+#define NEXT(len) do { pc += (len) + 1; n++; goto **(void **) pc; } while (0)
+#define JUMP(t) do { pc = code + (t); n++; goto **(void **) pc; } while (0)
+#define SYNC() (executed += n, n = 0)
+
+  n--;
+  JUMP(0);
+
+op_move:
+  R(1) = R(2);
+  NEXT(2);
+op_const:
+  R(1) = consts[pc[2]];
+  NEXT(2);
+op_add:
+  if (__builtin_add_overflow(INT_OF(R(2)), INT_OF(R(3)), &r))
+    fatal("Arithmetic overflow");
+  R(1) = INT(r);
+  NEXT(3);
+op_sub:
+  if (__builtin_sub_overflow(INT_OF(R(2)), INT_OF(R(3)), &r))
+    fatal("Arithmetic overflow");
+  R(1) = INT(r);
+  NEXT(3);
+op_mul:
+  R(1) = INT((uint32_t) INT_OF(R(2)) * (uint32_t) INT_OF(R(3)));
+  NEXT(3);
+op_div:
+  R(1) = divide(R(2), R(3));
+  NEXT(3);
+op_neg:
+  if (__builtin_sub_overflow(0, INT_OF(R(2)), &r))
+    fatal("Arithmetic overflow");
+  R(1) = INT(r);
+  NEXT(2);
+op_step:
+  R(1) = INT((uint32_t) INT_OF(R(1)) + (uint32_t) pc[2]);
+  NEXT(2);
+op_lt:
+  R(1) = BOOL(R(2) < R(3));
+  NEXT(3);
+op_le:
+  R(1) = BOOL(R(2) <= R(3));
+  NEXT(3);
+op_eq:
+  R(1) = BOOL(equal(R(2), R(3)));
+  NEXT(3);
+op_not:
+  R(1) = BOOL(R(2) != TRUE_VALUE);
+  NEXT(2);
+op_isvoid:
+  R(1) = BOOL(R(2) == 0);
+  NEXT(2);
+op_jump:
+  JUMP(pc[1]);
+op_jfalse:
+  if (R(1) != TRUE_VALUE)
+    JUMP(pc[2]);
+  NEXT(2);
+op_getattr:
+  R(1) = ((Obj *) regs[0])->attrs[pc[2]];
+  NEXT(2);
+op_setattr:
+  ((Obj *) regs[0])->attrs[pc[1]] = R(2);
+  NEXT(2);
+
+op_new:
+  regs[pc[3]] = new_object(pc[2]);
+  callee = classes[pc[2]].init;
+  dest = &R(1);
+  a = pc[3];
+  pc += 4;
+  goto call_init;
+op_newself:
+  regs[pc[2]] = new_object(tag_of(regs[0]));
+  callee = class_of(regs[0])->init;
+  dest = &R(1);
+  a = pc[2];
+  pc += 3;
+call_init:
+  if (callee == NULL) {
+    *dest = regs[a];
+    n++;
+    goto **(void **) pc;
+  }
+  goto enter;
+
+op_call:
+  SYNC();
+  callee = lookup(R(2), sites[pc[4]]);
+  goto call;
+op_scall:
+  if (R(2) == 0) {
+    SYNC();
+    lookup(0, sites[pc[4]]);
+  }
+  callee = &methods[sites[pc[4]].target];
+call:
+  dest = &R(1);
+  a = pc[2];
+  pc += 5;
+  if (callee->builtin) {
+    SYNC();
+    *dest = builtin(callee->builtin, regs + a);
+    n++;
+    goto **(void **) pc;
+  }
+enter:
+  if (fp == frames_end)
+    fatal("Stack overflow");
+  fp->method = m;
+  fp->pc = pc;
+  fp->regs = regs;
+  fp->dest = dest;
+  fp->top = enter_window(callee, regs + a);
+  fp++;
+  m = callee;
+  regs += a;
+  code = m->code.data();
+  JUMP(0);
+
+op_case:
+  SYNC();
+  JUMP(cases[pc[2]].branches[case_branch(R(1), cases[pc[2]])].target);
+
+op_ret:
+  a = R(1);
+  if (fp == frames) {
+    SYNC();
+    stack_top = saved_top;
+    return a;
+  }
+  fp--;
+  m = fp->method;
+  pc = fp->pc;
+  regs = fp->regs;
+  *fp->dest = a;
+  stack_top = fp->top;
+  code = m->code.data();
+  n++;
+  goto **(void **) pc;
+
+#undef R
+#undef NEXT
+#undef JUMP
+#undef SYNC
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// The JIT
+//
+// Each method becomes a function `Value f(Value *regs)' the first time
+// it is called.  %rbx holds `regs', and every instruction loads its
+// operands from the registers in memory and stores its result there, so
+// no value stays in a machine register from one instruction to the
+// next and the collector never needs to see the native stack.  Calls,
+// allocation and the rarer instructions call the helpers below, and a
+// Cool call is a C call: the program runs on a thread with a large
+// stack.  Code goes to one region mapped writable and executable.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define JIT_CODE_SPACE (256 << 20)
+#define JIT_STACK (1 << 30)
+
+static uint8_t *jit_code, *jit_code_end;
+static int jit_methods, jit_depth;
+
+static void jit_compile(VmMethod *m);
+
+static Value invoke(VmMethod *m, Value *args)
+{
+  if (m->builtin)
+    return builtin(m->builtin, args);
+  if (++jit_depth > FRAME_STACK)
+    fatal("Stack overflow");
+  Value *top = enter_window(m, args);
+  if (m->native == NULL)
+    jit_compile(m);
+  Value result = m->native(args);
+  stack_top = top;
+  jit_depth--;
+  return result;
+}
+
+static Value jit_call(Value *args, VmCallSite *site)
+{
+  return invoke(lookup(args[0], *site), args);
+}
+
+static Value jit_scall(Value *args, VmCallSite *site)
+{
+  if (args[0] == 0)
+    lookup(0, *site);
+  return invoke(&methods[site->target], args);
+}
+
+static Value jit_new(Value *args, int tag)
+{
+  args[0] = new_object(tag);
+  VmMethod *init = classes[tag].init;
+  return init != NULL ? invoke(init, args) : args[0];
+}
+
+static Value jit_newself(Value *args, Value self)
+{
+  return jit_new(args, tag_of(self));
+}
+
+static Value jit_eq(Value a, Value b) { return BOOL(equal(a, b)); }
+
+static int jit_case(Value v, VmCaseTable *table) { return case_branch(v, *table); }
+
+static void jit_overflow() { fatal("Arithmetic overflow"); }
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+
+//
+// Just the instructions the JIT uses.  `reg' operands name a Cool
+// register, that is the word at reg * 8 (%rbx).
+//
+class JitAssembler {
+public:
+  uint8_t *p;
+
+  JitAssembler(uint8_t *start) : p(start) { }
+  void bytes(std::initializer_list<int> bs) { for (int b : bs) *p++ = b; }
+  void word(int32_t w) { memcpy(p, &w, 4); p += 4; }
+  void quad(int64_t q) { memcpy(p, &q, 8); p += 8; }
+
+  void load(int r, int reg) { bytes({0x48, 0x8B, 0x83 | r << 3}); word(reg * 8); }
+  void store(int reg) { bytes({0x48, 0x89, 0x83}); word(reg * 8); }
+  void address(int r, int reg) { bytes({0x48, 0x8D, 0x83 | r << 3}); word(reg * 8); }
+  void imm64(int r, int64_t v) { bytes({0x48, 0xB8 | r}); quad(v); }
+  void call(void *fn) { imm64(RAX, (intptr_t) fn); bytes({0xFF, 0xD0}); }
+  // sar $2, r
+  void untag(int r) { bytes({0x48, 0xC1, 0xF8 | r, 0x02}); }
+  // %rax <- %eax * 4 + low, sign extended
+  void tag(int low) { bytes({0x48, 0x63, 0xC0, 0x48, 0x8D, 0x04, 0x85}); word(low); }
+  // %rax <- the Bool for condition code cc
+  void set_bool(int cc) { bytes({0x0F, 0x90 | cc, 0xC0, 0x0F, 0xB6, 0xC0}); tag(3); }
+  void trap_overflow() { bytes({0x71, 12}); call((void *) jit_overflow); }
+  // a jump with a 32 bit displacement, returning where it goes
+  uint8_t *jump() { bytes({0xE9}); word(0); return p - 4; }
+  uint8_t *jump_if(int cc) { bytes({0x0F, 0x80 | cc}); word(0); return p - 4; }
+};
+
+enum { CC_O = 0x0, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_LE = 0xE };
+
+static void jit_compile(VmMethod *m)
+{
+  const std::vector<intptr_t>& code = m->code;
+  std::vector<uint8_t *> at(code.size());
+  std::vector<std::pair<uint8_t *, int> > jumps;
+  JitAssembler a(jit_code);
+  uint8_t *start = a.p;
+
+  a.bytes({0x53, 0x48, 0x89, 0xFB});                    // push %rbx; mov %rdi, %rbx
+  for (size_t i = 0; i < code.size(); i += vm_op_args[code[i]] + 1) {
+    const intptr_t *x = &code[i];
+    size_t branches = x[0] == VM_CASE ? cases[x[2]].branches.size() : 0;
+    if (jit_code_end - a.p < (ptrdiff_t) (64 + 16 * branches))
+      fatal("JIT: out of code space");
+    at[i] = a.p;
+    switch (x[0]) {
+    case VM_MOVE:
+      a.load(RAX, x[2]);
+      a.store(x[1]);
+      break;
+    case VM_CONST:
+      a.imm64(RAX, consts[x[2]]);
+      a.store(x[1]);
+      break;
+    case VM_ADD:
+    case VM_SUB:
+    case VM_MUL:
+      a.load(RAX, x[2]);
+      a.load(RCX, x[3]);
+      a.untag(RAX);
+      a.untag(RCX);
+      if (x[0] == VM_ADD)
+        a.bytes({0x01, 0xC8});                          // add %ecx, %eax
+      else if (x[0] == VM_SUB)
+        a.bytes({0x29, 0xC8});                          // sub %ecx, %eax
+      else
+        a.bytes({0x0F, 0xAF, 0xC1});                    // imul %ecx, %eax
+      if (x[0] != VM_MUL)
+        a.trap_overflow();
+      a.tag(1);
+      a.store(x[1]);
+      break;
+    case VM_DIV:
+      a.load(RDI, x[2]);
+      a.load(RSI, x[3]);
+      a.call((void *) divide);
+      a.store(x[1]);
+      break;
+    case VM_NEG:
+      a.load(RAX, x[2]);
+      a.untag(RAX);
+      a.bytes({0xF7, 0xD8});                            // neg %eax
+      a.trap_overflow();
+      a.tag(1);
+      a.store(x[1]);
+      break;
+    case VM_STEP:
+      a.load(RAX, x[1]);
+      a.untag(RAX);
+      a.bytes({0x05});                                  // add $imm, %eax
+      a.word(x[2]);
+      a.tag(1);
+      a.store(x[1]);
+      break;
+    case VM_LT:
+    case VM_LE:
+      a.load(RAX, x[2]);
+      a.bytes({0x48, 0x3B, 0x83});                      // cmp reg, %rax
+      a.word(x[3] * 8);
+      a.set_bool(x[0] == VM_LT ? CC_L : CC_LE);
+      a.store(x[1]);
+      break;
+    case VM_EQ:
+      a.load(RDI, x[2]);
+      a.load(RSI, x[3]);
+      a.call((void *) jit_eq);
+      a.store(x[1]);
+      break;
+    case VM_NOT:
+      a.load(RAX, x[2]);
+      a.bytes({0x48, 0x83, 0xF0, 0x04});                // xor $4, %rax
+      a.store(x[1]);
+      break;
+    case VM_ISVOID:
+      a.bytes({0x48, 0x83, 0xBB});                      // cmpq $0, reg
+      a.word(x[2] * 8);
+      a.bytes({0x00});
+      a.set_bool(CC_E);
+      a.store(x[1]);
+      break;
+    case VM_JUMP:
+      jumps.push_back(std::make_pair(a.jump(), x[1]));
+      break;
+    case VM_JFALSE:
+      a.bytes({0x48, 0x83, 0xBB});                      // cmpq $TRUE_VALUE, reg
+      a.word(x[1] * 8);
+      a.bytes({TRUE_VALUE});
+      jumps.push_back(std::make_pair(a.jump_if(CC_NE), x[2]));
+      break;
+    case VM_GETATTR:
+      a.load(RAX, 0);
+      a.bytes({0x48, 0x8B, 0x80});                      // mov attr(%rax), %rax
+      a.word(offsetof(Obj, attrs) + x[2] * sizeof(Value));
+      a.store(x[1]);
+      break;
+    case VM_SETATTR:
+      a.load(RAX, 0);
+      a.load(RCX, x[2]);
+      a.bytes({0x48, 0x89, 0x88});                      // mov %rcx, attr(%rax)
+      a.word(offsetof(Obj, attrs) + x[1] * sizeof(Value));
+      break;
+    case VM_NEW:
+      a.address(RDI, x[3]);
+      a.bytes({0xBE});                                  // mov $tag, %esi
+      a.word(x[2]);
+      a.call((void *) jit_new);
+      a.store(x[1]);
+      break;
+    case VM_NEWSELF:
+      a.address(RDI, x[2]);
+      a.load(RSI, 0);
+      a.call((void *) jit_newself);
+      a.store(x[1]);
+      break;
+    case VM_CALL:
+    case VM_SCALL:
+      a.address(RDI, x[2]);
+      a.imm64(RSI, (intptr_t) &sites[x[4]]);
+      a.call((void *) (x[0] == VM_CALL ? jit_call : jit_scall));
+      a.store(x[1]);
+      break;
+    case VM_CASE:
+      a.load(RDI, x[1]);
+      a.imm64(RSI, (intptr_t) &cases[x[2]]);
+      a.call((void *) jit_case);
+      for (size_t b = 0; b < branches; b++) {
+        a.bytes({0x3D});                                // cmp $b, %eax
+        a.word(b);
+        jumps.push_back(std::make_pair(a.jump_if(CC_E), cases[x[2]].branches[b].target));
+      }
+      break;
+    case VM_RET:
+      a.load(RAX, x[1]);
+      a.bytes({0x5B, 0xC3});                            // pop %rbx; ret
+      break;
+    }
+  }
+
+  for (auto& j : jumps) {
+    int32_t rel = at[j.second] - (j.first + 4);
+    memcpy(j.first, &rel, 4);
+  }
+  jit_code = a.p;
+  m->native = (NativeCode) start;
+  jit_methods++;
+}
+
+//
+// Mirrors the SPIM trap handler's start-up: a new Main is initialized
+// and then receives main().
+//
+struct Start {
+  VmMethod *init, *main;
+  Value *regs;
+};
+
+static void *jit_start(void *arg)
+{
+  Start *start = (Start *) arg;
+  if (start->init != NULL)
+    invoke(start->init, start->regs);
+  invoke(start->main, start->regs);
+  return NULL;
+}
+
+static void jit_run(Start& start)
+{
+  jit_code = (uint8_t *) mmap(NULL, JIT_CODE_SPACE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (jit_code == MAP_FAILED)
+    fatal("JIT: cannot map code space");
+  jit_code_end = jit_code + JIT_CODE_SPACE;
+
+  pthread_attr_t attr;
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, JIT_STACK);
+  if (pthread_create(&thread, &attr, jit_start, &start) != 0)
+    fatal("JIT: cannot start");
+  pthread_join(thread, NULL);
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Loading and running
+//
+///////////////////////////////////////////////////////////////////////
+
+static void load(const VmProgram& prog)
+{
+  classes.resize(prog.classes.size());
+  methods.resize(prog.methods.size());
+  for (size_t i = 0; i < prog.methods.size(); i++) {
+    const VmMethodInfo& info = prog.methods[i];
+    methods[i].builtin = info.builtin;
+    methods[i].nformals = info.nformals;
+    methods[i].nregs = info.nregs;
+    methods[i].code.assign(info.code.begin(), info.code.end());
+    methods[i].native = NULL;
+  }
+
+  int_tag = prog.int_class;
+  bool_tag = prog.bool_class;
+  string_tag = prog.string_class;
+  for (size_t i = 0; i < prog.classes.size(); i++) {
+    const VmClassInfo& info = prog.classes[i];
+    VmClass& c = classes[i];
+    c.tag = i;
+    c.max_tag = info.max_tag;
+    c.init = info.init >= 0 ? &methods[info.init] : NULL;
+    for (int m : info.vtable)
+      c.vtable.push_back(m >= 0 ? &methods[m] : NULL);
+  }
+  Value empty = (Value) static_string("");
+  for (size_t i = 0; i < prog.classes.size(); i++) {
+    classes[i].name = static_string(prog.strings[prog.classes[i].name]);
+    for (int d : prog.classes[i].attrs)
+      classes[i].defaults.push_back(d == VM_ZERO ? INT(0) : d == VM_FALSE ? BOOL(false)
+                                    : d == VM_EMPTY_STRING ? empty : 0);
+  }
+
+  for (auto& c : prog.consts)
+    consts.push_back(c.kind == VmConst::INT ? INT(c.value)
+                     : c.kind == VmConst::BOOL ? BOOL(c.value)
+                     : c.kind == VmConst::STRING ? (Value) static_string(prog.strings[c.value])
+                     : 0);
+  for (auto& s : prog.sites) {
+    VmCallSite site = { static_string(prog.strings[s.file]), s.line, s.target, -1, NULL };
+    sites.push_back(site);
+  }
+  for (auto& c : prog.cases) {
+    VmCaseTable table = { static_string(prog.strings[c.file]), c.line, c.branches };
+    cases.push_back(table);
+  }
+}
+
+int vm_run(const VmProgram& prog, bool stats, bool jit)
+{
+  load(prog);
+  stack_base = (Value *) calloc(REGISTER_STACK, sizeof(Value));
+  stack_top = stack_base;
+  stack_end = stack_base + REGISTER_STACK;
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  stack_base[0] = new_object(prog.main_class);
+  stack_top = stack_base + 1;
+  Start run = { classes[prog.main_class].init, &methods[prog.main_method], stack_base };
+  if (jit)
+    jit_run(run);
+  else {
+    interpret(NULL, stack_base);
+    if (run.init != NULL)
+      interpret(run.init, stack_base);
+    interpret(run.main, stack_base);
+  }
+  printf("COOL program successfully executed\n");
+  gettimeofday(&end, NULL);
+
+  if (stats) {
+    fflush(stdout);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    if (jit) {
+      fprintf(stderr, "methods compiled:  %d\n", jit_methods);
+      fprintf(stderr, "code bytes:        %ld\n", (long) (jit_code - (jit_code_end - JIT_CODE_SPACE)));
+    } else {
+      fprintf(stderr, "instructions:      %llu\n", (unsigned long long) executed);
+      fprintf(stderr, "instructions/s:    %.1fM\n", secs > 0 ? executed / secs / 1e6 : 0.0);
+    }
+    fprintf(stderr, "collections:       %d\n", collections);
+    fprintf(stderr, "seconds:           %.3f\n", secs);
+  }
+  return 0;
+}
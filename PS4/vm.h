@@ -0,0 +1,133 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//
+// The bytecode backend.  With CGEN_TARGET=bytecode the code generator
+// writes the program as register bytecode (see VmCompiler in cgen.h),
+// which `coolvm' runs directly:
+//
+//     CGEN_TARGET=bytecode ./mycoolc -o prog.cbc prog.cl
+//     coolvm [-b] [-j] prog.cbc
+//
+// Each method has its own registers: r0 is self, r1..rn the formals,
+// and the rest let variables and temporaries.  A call puts the receiver
+// and the arguments in consecutive registers r[base], r[base+1], ...;
+// they become r0, r1, ... of the callee.  Operands are register numbers
+// unless noted; jump targets are indices into the method's code.
+//
+enum VmOp {
+  VM_MOVE,      // d s
+  VM_CONST,     // d k          r[d] = constant k
+  VM_ADD,       // d a b        Int arithmetic; add, sub and neg trap on
+  VM_SUB,       // d a b        overflow, div on a zero divisor
+  VM_MUL,       // d a b
+  VM_DIV,       // d a b
+  VM_NEG,       // d a
+  VM_STEP,      // d imm        r[d] += imm, wrapping
+  VM_LT,        // d a b
+  VM_LE,        // d a b
+  VM_EQ,        // d a b        Cool `='
+  VM_NOT,       // d a
+  VM_ISVOID,    // d a
+  VM_JUMP,      // t
+  VM_JFALSE,    // a t          jump to t if r[a] is false
+  VM_GETATTR,   // d i          r[d] = attribute i of self
+  VM_SETATTR,   // i s
+  VM_NEW,       // d c base     r[d] = a new, initialized object of class c
+  VM_NEWSELF,   // d base       ... of the class of self
+  VM_CALL,      // d base n s   dynamic dispatch from call site s
+  VM_SCALL,     // d base n s   static dispatch from call site s
+  VM_CASE,      // a c          jump to the branch of case table c
+  VM_RET,       // a
+  VM_NUM_OPS
+};
+
+extern const char *vm_op_names[VM_NUM_OPS];
+extern const int vm_op_args[VM_NUM_OPS];
+
+// The methods of the basic classes are implemented by the interpreter.
+enum VmBuiltin {
+  VM_NOT_BUILTIN,
+  VM_ABORT, VM_TYPE_NAME, VM_COPY,
+  VM_OUT_STRING, VM_OUT_INT, VM_IN_STRING, VM_IN_INT,
+  VM_LENGTH, VM_CONCAT, VM_SUBSTR
+};
+
+// The initial value of an attribute.
+enum VmDefault { VM_VOID, VM_ZERO, VM_FALSE, VM_EMPTY_STRING };
+
+struct VmConst {
+  enum { INT, BOOL, STRING, VOID } kind;
+  int value;                    // or an index into `strings'
+};
+
+//
+// Tags are numbered in preorder, so the tags of a class and all of its
+// descendants are [tag, max_tag]; classes are listed in tag order.
+//
+struct VmClassInfo {
+  int name;                     // index into `strings'
+  int parent;                   // -1 for Object
+  int max_tag;
+  std::vector<int> attrs;       // VmDefault of each attribute
+  int init;                     // method index, or -1
+  std::vector<int> vtable;      // method indices; -1 for dead methods
+};
+
+struct VmMethodInfo {
+  int name;                     // "Class.method"
+  int nformals;
+  int nregs;
+  int builtin;
+  std::vector<int32_t> code;
+};
+
+struct VmSite {
+  int file;
+  int line;
+  int target;                   // the vtable slot (VM_CALL) or method (VM_SCALL)
+};
+
+struct VmCase {
+  int file;
+  int line;
+  // most specific first: a value takes the first branch whose range
+  // holds its tag
+  struct Branch { int tag, max_tag, target; };
+  std::vector<Branch> branches;
+};
+
+struct VmProgram {
+  std::vector<std::string> strings;
+  std::vector<VmConst> consts;
+  std::vector<VmClassInfo> classes;
+  std::vector<VmMethodInfo> methods;
+  std::vector<VmSite> sites;
+  std::vector<VmCase> cases;
+  int int_class, bool_class, string_class, main_class, main_method;
+
+  void write(std::ostream& s) const;
+  bool read(std::istream& s);
+};
+
+//
+// Runs the program with the program's input and output on stdin and
+// stdout, interpreting it or, with `jit', compiling each method to
+// x86-64 when it is first called.  With `stats', reports the
+// instructions executed and their rate (or the code compiled) on
+// stderr.
+//
+int vm_run(const VmProgram& prog, bool stats, bool jit);
+
+#endif
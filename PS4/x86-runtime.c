@@ -0,0 +1,557 @@
+/*
+ * The x86-64 Cool runtime (see x86.h).
+ *
+ * The routines mirror the SPIM trap handler: the receiver is in $a0,
+ * arguments are on the Cool stack and popped by the callee, and the
+ * result is returned in $a0.  They read and write the MIPS registers
+ * through cool_regs, which x86-runtime.s fills in around every call.
+ *
+ * Objects are allocated from a heap in the low 2G.  Unless the program
+ * was compiled for no collector, a full heap is collected by a
+ * non-moving mark-sweep collector.  The frames are scanned with the
+ * compiler's stack maps; a word taken for a pointer is only followed
+ * if an object starts there, so a raw value can only keep garbage
+ * alive.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* the MIPS register file; x86.cc relies on these offsets */
+struct cool_regs {
+  uint32_t a0, a1, t1, t2, t3, s0, s1, s2, s3, s4, s5, s6, sp, fp, ra;
+} cool_regs;
+
+/* generated by the compiler */
+extern uint32_t class_nameTab[];
+extern uint32_t Int_protObj[], String_protObj[], Main_protObj[];
+extern uint32_t _int_tag, _bool_tag, _string_tag;
+extern uint32_t _MemMgr_COLLECTOR, _MemMgr_TEST;
+extern uint32_t _stack_maps[];
+extern char Main_init[];
+
+/* in x86-runtime.s */
+extern char _NoGC_Collect[];
+extern uint32_t cool_main;
+void cool_enter(uint32_t code);
+
+#define TAG_OFFSET 0
+#define SIZE_OFFSET 1
+#define DISPTABLE_OFFSET 2
+#define ATTR_OFFSET 3
+
+#define STACK_SIZE (64 << 20)
+#define HEAP_RESERVE (1u << 30)
+#define HEAP_INITIAL (4 << 20)
+
+#define W(a) ((uint32_t *) (uintptr_t) (a))
+#define ADDR(p) ((uint32_t) (uintptr_t) (p))
+
+static void *low_map(size_t bytes)
+{
+  void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT | MAP_NORESERVE, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+static void fatal(const char *msg)
+{
+  fflush(stdout);
+  fprintf(stderr, "%s\n", msg);
+  exit(1);
+}
+
+/*********************************************************************
+ *
+ * The heap
+ *
+ * Every object is preceded by the -1 eye catcher of the MIPS runtime,
+ * so a block is size + 1 words.  `starts' has a bit for every word
+ * where an object begins; only those are taken for pointers.  Free
+ * blocks have a 0 header followed by their length in words, and are
+ * kept on free lists by length.
+ *
+ *********************************************************************/
+
+#define SMALL_BLOCKS 64
+
+static uint32_t *heap, *heap_top, *heap_limit, *heap_end, *stack_base;
+static uint8_t *starts, *marks;
+static uint32_t free_small[SMALL_BLOCKS];
+static uint32_t free_large;
+static int collecting, collect_always;
+static uint32_t rt_roots[2];
+
+#define BIT(map, p) ((map)[((p) - heap) >> 3] & (1 << (((p) - heap) & 7)))
+#define SET(map, p) ((map)[((p) - heap) >> 3] |= (1 << (((p) - heap) & 7)))
+#define CLEAR(map, p) ((map)[((p) - heap) >> 3] &= ~(1 << (((p) - heap) & 7)))
+
+static void maps_init(void);
+
+static void heap_init(void)
+{
+  size_t reserve = HEAP_RESERVE;
+  while ((heap = low_map(reserve)) == NULL && reserve > HEAP_INITIAL)
+    reserve /= 2;
+  if (heap == NULL)
+    fatal("cannot map the heap");
+  heap_top = heap;
+  heap_end = heap + reserve / 4;
+  heap_limit = heap + HEAP_INITIAL / 4;
+  starts = calloc(reserve / 32, 1);
+  marks = calloc(reserve / 32, 1);
+  if (starts == NULL || marks == NULL)
+    fatal("cannot allocate the heap bitmaps");
+  collecting = _MemMgr_COLLECTOR != ADDR(_NoGC_Collect);
+  collect_always = collecting && _MemMgr_TEST;
+  if (collecting)
+    maps_init();
+}
+
+/* the third word of a free block links it to the next one */
+static void add_free(uint32_t *b, uint32_t words)
+{
+  uint32_t *list = words < SMALL_BLOCKS ? &free_small[words] : &free_large;
+  b[0] = 0;
+  b[1] = words;
+  b[2] = *list;
+  *list = ADDR(b);
+}
+
+static uint32_t *from_free_lists(uint32_t words)
+{
+  uint32_t *b, *link;
+  if (words < SMALL_BLOCKS && free_small[words] != 0) {
+    b = W(free_small[words]);
+    free_small[words] = b[2];
+    return b;
+  }
+  for (link = &free_large; *link != 0; link = &b[2]) {
+    b = W(*link);
+    /* what is left over must hold a free block header */
+    if (b[1] == words || b[1] >= words + 3) {
+      *link = b[2];
+      if (b[1] > words)
+        add_free(b + words, b[1] - words);
+      return b;
+    }
+  }
+  return NULL;
+}
+
+static void mark(uint32_t p)
+{
+  static uint32_t **stack;
+  static size_t size;
+  size_t n = 0;
+  uint32_t *obj = W(p);
+
+  if (obj <= heap || obj >= heap_top || (p & 3) || !BIT(starts, obj) || BIT(marks, obj))
+    return;
+  SET(marks, obj);
+  if (stack == NULL)
+    stack = malloc((size = 1024) * sizeof(*stack));
+  stack[n++] = obj;
+  while (n > 0) {
+    uint32_t *o = stack[--n];
+    uint32_t tag = o[TAG_OFFSET], first = ATTR_OFFSET, end = o[SIZE_OFFSET], i;
+    if (tag == _int_tag || tag == _bool_tag)
+      continue;
+    if (tag == _string_tag)
+      end = ATTR_OFFSET + 1;
+    for (i = first; i < end; i++) {
+      uint32_t *q = W(o[i]);
+      if (q <= heap || q >= heap_top || (o[i] & 3) || !BIT(starts, q) || BIT(marks, q))
+        continue;
+      SET(marks, q);
+      if (n == size)
+        stack = realloc(stack, (size *= 2) * sizeof(*stack));
+      stack[n++] = q;
+    }
+  }
+}
+
+/* returns the number of free words */
+static size_t sweep(void)
+{
+  uint32_t *b = heap, *run = NULL;
+  size_t free_words = heap_limit - heap_top;
+  memset(free_small, 0, sizeof(free_small));
+  free_large = 0;
+  while (b < heap_top) {
+    uint32_t *obj = b + 1;
+    uint32_t words;
+    int live = 0;
+    if (BIT(starts, obj)) {
+      words = obj[SIZE_OFFSET] + 1;
+      live = BIT(marks, obj) != 0;
+      CLEAR(marks, obj);
+      if (!live)
+        CLEAR(starts, obj);
+    } else
+      words = b[1];
+    if (live) {
+      if (run != NULL)
+        add_free(run, b - run);
+      run = NULL;
+    } else {
+      free_words += words;
+      if (run == NULL)
+        run = b;
+    }
+    b += words;
+  }
+  if (run != NULL)
+    add_free(run, b - run);
+  return free_words;
+}
+
+/*********************************************************************
+ *
+ * Stack maps
+ *
+ * The compiler describes the frame at the return address of every call
+ * that may allocate (see code_classes in cgen.cc).  The frames are
+ * walked from the innermost one, whose return address is in $ra,
+ * through the saved $fp and $ra of each; a frame's own $s0-$s6 are in
+ * the registers or where a frame inside it saved them.  Marked are the
+ * formals, self, the live locals and temporaries and the words the
+ * frame has pushed.  The call from cool_enter has no map and ends the
+ * walk.
+ *
+ *********************************************************************/
+
+struct stack_map {
+  uint32_t ret, formals, locals, saved, live_locals, live_temps;
+};
+
+static struct stack_map *maps;
+static size_t num_maps;
+
+static int by_ret(const void *a, const void *b)
+{
+  uint32_t x = ((const struct stack_map *) a)->ret;
+  uint32_t y = ((const struct stack_map *) b)->ret;
+  return x < y ? -1 : x > y;
+}
+
+static void maps_init(void)
+{
+  maps = (struct stack_map *) _stack_maps;
+  while (maps[num_maps].ret != 0)
+    num_maps++;
+  qsort(maps, num_maps, sizeof(*maps), by_ret);
+}
+
+static struct stack_map *find_map(uint32_t ret)
+{
+  struct stack_map key;
+  key.ret = ret;
+  return bsearch(&key, maps, num_maps, sizeof(*maps), by_ret);
+}
+
+static void mark_frames(void)
+{
+  uint32_t *home[7];
+  uint32_t ra = cool_regs.ra, *fp = W(cool_regs.fp), *sp = W(cool_regs.sp), *p;
+  struct stack_map *m = find_map(ra);
+  uint32_t i;
+
+  if (m == NULL) {
+    /* not called from compiled code: everything may be a pointer */
+    for (i = 0; i < sizeof(cool_regs) / 4; i++)
+      mark(((uint32_t *) &cool_regs)[i]);
+    for (p = sp; p < stack_base; p++)
+      mark(*p);
+    return;
+  }
+  for (i = 0; i < 7; i++)
+    home[i] = &cool_regs.s0 + i;
+  for (; m != NULL; m = find_map(ra)) {
+    uint32_t *frame_sp = fp - (3 + m->locals + m->saved);
+    for (p = sp + 1; p <= frame_sp; p++)
+      mark(*p);
+    for (i = 1; i <= m->formals; i++)
+      mark(fp[i]);
+    mark(*home[0]);
+    for (i = 0; i < m->live_locals; i++)
+      mark(fp[-3 - (int) i]);
+    for (i = 0; i < m->live_temps; i++)
+      mark(*home[1 + i]);
+    /* the caller's registers, as this frame saved them */
+    home[0] = fp - 1;
+    for (i = 0; i < m->saved; i++)
+      home[1 + i] = fp - 3 - m->locals - i;
+    ra = fp[-2];
+    sp = fp + m->formals;
+    fp = W(fp[0]);
+  }
+  /* the outermost frame's caller and self */
+  mark(*home[0]);
+  for (p = sp + 1; p < stack_base; p++)
+    mark(*p);
+}
+
+static void collect(void)
+{
+  size_t i;
+  /* the arguments of the runtime routine that is allocating */
+  mark(cool_regs.a0);
+  mark(cool_regs.a1);
+  mark(cool_regs.t1);
+  mark(cool_regs.t2);
+  mark(cool_regs.t3);
+  for (i = 0; i < sizeof(rt_roots) / 4; i++)
+    mark(rt_roots[i]);
+  mark_frames();
+  /* keep the heap at least half empty */
+  if (sweep() < (size_t) (heap_limit - heap) / 2) {
+    size_t grow = heap_limit - heap;
+    heap_limit = (size_t) (heap_end - heap_limit) < grow ? heap_end : heap_limit + grow;
+  }
+}
+
+/* allocates an object of `words' words, collecting if need be */
+static uint32_t *alloc(uint32_t words)
+{
+  uint32_t *b = NULL;
+  uint32_t blocks = words + 1;
+  if (collect_always)
+    collect();
+  if (collecting)
+    b = from_free_lists(blocks);
+  if (b == NULL && heap_top + blocks > heap_limit) {
+    if (collecting && !collect_always) {
+      collect();
+      b = from_free_lists(blocks);
+    }
+    while (b == NULL && heap_top + blocks > heap_limit) {
+      if (heap_limit == heap_end)
+        fatal("out of memory");
+      heap_limit = heap_end - heap_limit < heap_limit - heap ? heap_end
+                 : heap_limit + (heap_limit - heap);
+    }
+  }
+  if (b == NULL) {
+    b = heap_top;
+    heap_top += blocks;
+  }
+  b[0] = -1;
+  SET(starts, b + 1);
+  return b + 1;
+}
+
+static uint32_t copy_object(uint32_t p)
+{
+  uint32_t *obj = W(p), *fresh;
+  if (obj == NULL)
+    fatal("Object.copy on void");
+  fresh = alloc(obj[SIZE_OFFSET]);
+  memcpy(fresh, obj, obj[SIZE_OFFSET] * 4);
+  return ADDR(fresh);
+}
+
+/*********************************************************************
+ *
+ * Object values
+ *
+ *********************************************************************/
+
+static uint32_t attr(uint32_t obj, int i) { return W(obj)[ATTR_OFFSET + i]; }
+
+static uint32_t new_int(int32_t v)
+{
+  uint32_t obj = copy_object(ADDR(Int_protObj));
+  W(obj)[ATTR_OFFSET] = v;
+  return obj;
+}
+
+static int32_t string_length(uint32_t obj) { return attr(attr(obj, 0), 0); }
+
+static const char *string_chars(uint32_t obj)
+{
+  return (const char *) &W(obj)[ATTR_OFFSET + 1];
+}
+
+static uint32_t new_string(const char *s, size_t len)
+{
+  uint32_t words = ATTR_OFFSET + 1 + (len + 4) / 4;
+  uint32_t *obj;
+  rt_roots[0] = new_int(len);
+  obj = alloc(words);
+  obj[TAG_OFFSET] = String_protObj[TAG_OFFSET];
+  obj[SIZE_OFFSET] = words;
+  obj[DISPTABLE_OFFSET] = String_protObj[DISPTABLE_OFFSET];
+  obj[ATTR_OFFSET] = rt_roots[0];
+  rt_roots[0] = 0;
+  memset(&obj[ATTR_OFFSET + 1], 0, (words - ATTR_OFFSET - 1) * 4);
+  memcpy(&obj[ATTR_OFFSET + 1], s, len);
+  return ADDR(obj);
+}
+
+static uint32_t class_name(uint32_t obj) { return class_nameTab[W(obj)[TAG_OFFSET]]; }
+
+/* argument i of n; argument 0 was pushed first */
+static uint32_t arg(int i, int n) { return W(cool_regs.sp)[n - i]; }
+static void pop_args(int n) { cool_regs.sp += 4 * n; }
+
+static void out_string(uint32_t obj)
+{
+  fwrite(string_chars(obj), 1, string_length(obj), stdout);
+}
+
+/*********************************************************************
+ *
+ * The routines
+ *
+ *********************************************************************/
+
+void rt_object_copy(void) { cool_regs.a0 = copy_object(cool_regs.a0); }
+
+void rt_object_abort(void)
+{
+  printf("Abort called from class ");
+  out_string(class_name(cool_regs.a0));
+  printf("\n");
+  exit(0);
+}
+
+void rt_object_type_name(void) { cool_regs.a0 = class_name(cool_regs.a0); }
+
+void rt_io_out_string(void)
+{
+  out_string(arg(0, 1));
+  pop_args(1);
+}
+
+void rt_io_out_int(void)
+{
+  printf("%d", (int32_t) attr(arg(0, 1), 0));
+  pop_args(1);
+}
+
+static char *read_line(size_t *len)
+{
+  static char *line;
+  static size_t size;
+  ssize_t n;
+  fflush(stdout);
+  n = getline(&line, &size, stdin);
+  if (line == NULL)
+    line = calloc(size = 1, 1);
+  if (n < 0)
+    n = 0;
+  if (n > 0 && line[n - 1] == '\n')
+    n--;
+  *len = n;
+  return line;
+}
+
+void rt_io_in_string(void)
+{
+  size_t len;
+  char *line = read_line(&len);
+  if (memchr(line, 0, len) != NULL)
+    len = 0;
+  cool_regs.a0 = new_string(line, len);
+}
+
+void rt_io_in_int(void)
+{
+  size_t len;
+  char *line = read_line(&len);
+  line[len] = 0;
+  cool_regs.a0 = new_int(atoi(line));
+}
+
+void rt_string_length(void) { cool_regs.a0 = attr(cool_regs.a0, 0); }
+
+void rt_string_concat(void)
+{
+  uint32_t a = cool_regs.a0, b = arg(0, 1);
+  size_t la = string_length(a), lb = string_length(b);
+  char *s = malloc(la + lb + 1);
+  memcpy(s, string_chars(a), la);
+  memcpy(s + la, string_chars(b), lb);
+  pop_args(1);
+  cool_regs.a0 = new_string(s, la + lb);
+  free(s);
+}
+
+void rt_string_substr(void)
+{
+  uint32_t s = cool_regs.a0;
+  int32_t i = attr(arg(0, 2), 0), l = attr(arg(1, 2), 0);
+  pop_args(2);
+  if (i < 0 || l < 0 || (int64_t) i + l > string_length(s)) {
+    printf("Error: Index to substr is too big\n");
+    exit(1);
+  }
+  /* the substring cannot move, but may be collected with s unrooted */
+  rt_roots[1] = s;
+  cool_regs.a0 = new_string(string_chars(s) + i, l);
+  rt_roots[1] = 0;
+}
+
+/* returns $a0 if the objects in $t1 and $t2 are equal and $a1 if not */
+void rt_equality_test(void)
+{
+  uint32_t a = cool_regs.t1, b = cool_regs.t2;
+  int equal = a == b;
+  if (!equal && a != 0 && b != 0 && W(a)[TAG_OFFSET] == W(b)[TAG_OFFSET]) {
+    uint32_t tag = W(a)[TAG_OFFSET];
+    if (tag == _int_tag || tag == _bool_tag)
+      equal = attr(a, 0) == attr(b, 0);
+    else if (tag == _string_tag)
+      equal = string_length(a) == string_length(b) &&
+              memcmp(string_chars(a), string_chars(b), string_length(a)) == 0;
+  }
+  if (!equal)
+    cool_regs.a0 = cool_regs.a1;
+}
+
+/* the file name is in $a0 and the line in $t1 */
+static void abort_at(const char *msg)
+{
+  out_string(cool_regs.a0);
+  printf(":%d: %s\n", (int32_t) cool_regs.t1, msg);
+  exit(1);
+}
+
+void rt_dispatch_abort(void) { abort_at("Dispatch to void."); }
+
+void rt_case_abort2(void) { abort_at("Match on void in case statement."); }
+
+void rt_case_abort(void)
+{
+  printf("No match in case statement for Class ");
+  out_string(class_name(cool_regs.a0));
+  printf("\n");
+  exit(1);
+}
+
+void rt_overflow(void) { fatal("Arithmetic overflow"); }
+
+void rt_div_zero(void) { fatal("Division by zero"); }
+
+/*
+ * Mirrors the SPIM trap handler's start-up: a copy of Main is
+ * initialized and then receives main().
+ */
+int main(void)
+{
+  uint8_t *stack = low_map(STACK_SIZE);
+  if (stack == NULL)
+    fatal("cannot map the stack");
+  heap_init();
+  stack_base = (uint32_t *) (stack + STACK_SIZE);
+  cool_regs.sp = cool_regs.fp = ADDR(stack_base - 1);
+
+  cool_regs.a0 = copy_object(ADDR(Main_protObj));
+  cool_enter(ADDR(Main_init));
+  cool_enter(cool_main);
+  printf("COOL program successfully executed\n");
+  return 0;
+}
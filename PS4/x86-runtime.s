@@ -0,0 +1,124 @@
+#
+# Entry points of the x86-64 Cool runtime (see x86.h).
+#
+# Cool code calls the runtime the way it calls methods: the return
+# address is in %r15 (MIPS $ra) and the routine returns with
+# `jmp *%r15'.  Each routine saves the mapped registers into cool_regs,
+# calls its C half (x86-runtime.c) on the native stack, and reloads
+# them, so the C code sees and updates the MIPS register file.
+#
+
+	.macro	SAVE
+	movl	%ebx, cool_regs+0
+	movl	%esi, cool_regs+4
+	movl	%r8d, cool_regs+8
+	movl	%r9d, cool_regs+12
+	movl	%r10d, cool_regs+16
+	movl	%r12d, cool_regs+20
+	movl	%r11d, cool_regs+24
+	movl	%ebp, cool_regs+28
+	movl	%edi, cool_regs+32
+	movl	%ecx, cool_regs+36
+	movl	%r14d, cool_regs+48
+	movl	%r13d, cool_regs+52
+	movl	%r15d, cool_regs+56
+	.endm
+
+	.macro	RESTORE
+	movl	cool_regs+0, %ebx
+	movl	cool_regs+4, %esi
+	movl	cool_regs+8, %r8d
+	movl	cool_regs+12, %r9d
+	movl	cool_regs+16, %r10d
+	movl	cool_regs+20, %r12d
+	movl	cool_regs+24, %r11d
+	movl	cool_regs+28, %ebp
+	movl	cool_regs+32, %edi
+	movl	cool_regs+36, %ecx
+	movl	cool_regs+48, %r14d
+	movl	cool_regs+52, %r13d
+	movl	cool_regs+56, %r15d
+	.endm
+
+	.macro	ROUTINE name, fn
+	.globl	\name
+\name:
+	SAVE
+	call	\fn
+	RESTORE
+	jmp	*%r15
+	.endm
+
+	.text
+
+	ROUTINE	Object.copy, rt_object_copy
+	ROUTINE	Object.abort, rt_object_abort
+	ROUTINE	Object.type_name, rt_object_type_name
+	ROUTINE	IO.out_string, rt_io_out_string
+	ROUTINE	IO.out_int, rt_io_out_int
+	ROUTINE	IO.in_string, rt_io_in_string
+	ROUTINE	IO.in_int, rt_io_in_int
+	ROUTINE	String.length, rt_string_length
+	ROUTINE	String.concat, rt_string_concat
+	ROUTINE	String.substr, rt_string_substr
+	ROUTINE	equality_test, rt_equality_test
+	ROUTINE	_dispatch_abort, rt_dispatch_abort
+	ROUTINE	_case_abort, rt_case_abort
+	ROUTINE	_case_abort2, rt_case_abort2
+	ROUTINE	_cool_overflow, rt_overflow
+	ROUTINE	_cool_div_zero, rt_div_zero
+
+# The collector is non-moving and scans conservatively, so it needs no
+# write barrier.  The generated code names a collector in
+# _MemMgr_COLLECTOR; the runtime collects unless that is _NoGC_Collect.
+	.macro	NOP_ROUTINE name
+	.globl	\name
+\name:
+	jmp	*%r15
+	.endm
+
+	NOP_ROUTINE	_GenGC_Assign
+	NOP_ROUTINE	_gc_check
+	NOP_ROUTINE	_NoGC_Init
+	NOP_ROUTINE	_NoGC_Collect
+	NOP_ROUTINE	_GenGC_Init
+	NOP_ROUTINE	_GenGC_Collect
+	NOP_ROUTINE	_ScnGC_Init
+	NOP_ROUTINE	_ScnGC_Collect
+
+#
+# void cool_enter(uint32_t code)
+#
+# Runs Cool code from C: loads the register file, calls `code' and
+# saves the register file when it returns.  The native stack is left
+# 16 byte aligned for the routines above.
+#
+	.globl	cool_enter
+cool_enter:
+	pushq	%rbx
+	pushq	%rbp
+	pushq	%r12
+	pushq	%r13
+	pushq	%r14
+	pushq	%r15
+	subq	$8, %rsp
+	movl	%edi, %eax
+	RESTORE
+	movl	$1f, %r15d
+	jmp	*%rax
+1:
+	SAVE
+	addq	$8, %rsp
+	popq	%r15
+	popq	%r14
+	popq	%r13
+	popq	%r12
+	popq	%rbp
+	popq	%rbx
+	ret
+
+	.data
+	.globl	cool_main
+cool_main:
+	.long	Main.main
+	.section	.note.GNU-stack,"",@progbits
@@ -0,0 +1,329 @@
+//
+// Lowering of the generated MIPS code to x86-64.
+//
+// Every MIPS instruction the code generator emits becomes a short x86
+// sequence with the same effect on the (mapped) registers and memory.
+// %eax and %edx are scratch.  Calls load the return address into the
+// register holding $ra and jump; returns jump through it.  `add', `sub'
+// and `neg' trap on overflow and `div' on a zero divisor, as on MIPS.
+//
+#include <stdlib.h>
+#include <sstream>
+#include "peephole.h"
+#include "x86.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Registers
+//
+///////////////////////////////////////////////////////////////////////
+
+//
+// `wide' is the 64 bit register used when the value is an address.
+// Registers without one live in memory, at the given offset into
+// cool_regs.
+//
+static const struct { const char *mips; const char *reg; const char *wide; } regs[] = {
+  { "$a0", "%ebx",  "%rbx" },
+  { "$a1", "%esi",  "%rsi" },
+  { "$t1", "%r8d",  "%r8" },
+  { "$t2", "%r9d",  "%r9" },
+  { "$t3", "%r10d", "%r10" },
+  { "$s0", "%r12d", "%r12" },
+  { "$s1", "%r11d", "%r11" },
+  { "$s2", "%ebp",  "%rbp" },
+  { "$s3", "%edi",  "%rdi" },
+  { "$s4", "%ecx",  "%rcx" },
+  { "$s5", "cool_regs+40", NULL },
+  { "$s6", "cool_regs+44", NULL },
+  { "$sp", "%r14d", "%r14" },
+  { "$fp", "%r13d", "%r13" },
+  { "$ra", "%r15d", "%r15" },
+};
+
+class X86Lowering {
+public:
+  X86Lowering(std::ostream& s) : s(s), returns(0) { }
+  void lower(const Instr& ins);
+
+private:
+  std::ostream& s;
+  int returns;
+
+  void emit(const std::string& op, const std::string& a, const std::string& b = "");
+  std::string operand(const std::string& mips);
+  std::string address(const std::string& mips);
+  std::string indirect(const std::string& mips);
+  bool in_memory(const std::string& x86) { return x86[0] != '%' && x86[0] != '$'; }
+  void move(const std::string& src, const std::string& dst);
+  void compute(const std::string& op, const Instr& ins, bool trap = false);
+  void compare(const std::string& set, const Instr& ins);
+  void branch(const std::string& jcc, const std::string& a, const std::string& b,
+              const std::string& target);
+  void divide(const Instr& ins);
+  void call(const std::string& target);
+  void directive(const std::string& text);
+  void unknown(const std::string& what);
+};
+
+void X86Lowering::emit(const std::string& op, const std::string& a,
+                       const std::string& b)
+{
+  s << "\t" << op << "\t" << a;
+  if (!b.empty())
+    s << ", " << b;
+  s << std::endl;
+}
+
+//
+// A register, or an immediate.
+//
+std::string X86Lowering::operand(const std::string& mips)
+{
+  if (mips == "$zero")
+    return "$0";
+  if (mips[0] != '$')
+    return "$" + mips;
+  for (auto& r : regs)
+    if (mips == r.mips)
+      return r.reg;
+  unknown("register " + mips);
+  return "$0";
+}
+
+//
+// An `offset(base)' memory operand.  A base kept in memory is loaded
+// into %rax first.
+//
+std::string X86Lowering::address(const std::string& mips)
+{
+  size_t open = mips.find('(');
+  if (open == std::string::npos)
+    return mips;
+  std::string offset = mips.substr(0, open);
+  std::string base = mips.substr(open + 1, mips.size() - open - 2);
+  for (auto& r : regs)
+    if (base == r.mips) {
+      if (r.wide != NULL)
+        return offset + "(" + r.wide + ")";
+      emit("movl", r.reg, "%eax");
+      return offset + "(%rax)";
+    }
+  unknown("base register " + base);
+  return mips;
+}
+
+//
+// The target of a jump through a register.
+//
+std::string X86Lowering::indirect(const std::string& mips)
+{
+  for (auto& r : regs)
+    if (mips == r.mips) {
+      if (r.wide != NULL)
+        return std::string("*") + r.wide;
+      emit("movl", r.reg, "%eax");
+      return "*%rax";
+    }
+  unknown("register " + mips);
+  return mips;
+}
+
+void X86Lowering::move(const std::string& src, const std::string& dst)
+{
+  if (src == dst)
+    return;
+  if (in_memory(src) && in_memory(dst)) {
+    emit("movl", src, "%edx");
+    emit("movl", "%edx", dst);
+  } else
+    emit("movl", src, dst);
+}
+
+//
+// d <- a op b, through %eax.
+//
+void X86Lowering::compute(const std::string& op, const Instr& ins, bool trap)
+{
+  emit("movl", operand(ins.args[1]), "%eax");
+  emit(op, operand(ins.args[2]), "%eax");
+  if (trap)
+    emit("jo", "_cool_overflow");
+  emit("movl", "%eax", operand(ins.args[0]));
+}
+
+void X86Lowering::compare(const std::string& set, const Instr& ins)
+{
+  emit("movl", operand(ins.args[1]), "%eax");
+  emit("cmpl", operand(ins.args[2]), "%eax");
+  emit(set, "%al");
+  emit("movzbl", "%al", "%eax");
+  emit("movl", "%eax", operand(ins.args[0]));
+}
+
+void X86Lowering::branch(const std::string& jcc, const std::string& a,
+                         const std::string& b, const std::string& target)
+{
+  std::string x = operand(a), y = operand(b);
+  if (in_memory(x) && in_memory(y)) {
+    emit("movl", x, "%eax");
+    x = "%eax";
+  }
+  emit("cmpl", y, x);
+  emit(jcc, target);
+}
+
+//
+// MIPS leaves INT_MIN / -1 as INT_MIN, where idiv would fault.
+//
+void X86Lowering::divide(const Instr& ins)
+{
+  std::string d = operand(ins.args[2]);
+  emit("cmpl", "$0", d);
+  emit("je", "_cool_div_zero");
+  emit("movl", operand(ins.args[1]), "%eax");
+  emit("cmpl", "$-1", d);
+  emit("je", "1f");
+  emit("cltd", "");
+  emit("idivl", d);
+  emit("jmp", "2f");
+  s << "1:" << std::endl;
+  emit("negl", "%eax");
+  s << "2:" << std::endl;
+  emit("movl", "%eax", operand(ins.args[0]));
+}
+
+void X86Lowering::call(const std::string& target)
+{
+  std::stringstream ret;
+  ret << ".Lret" << returns++;
+  emit("movl", "$" + ret.str(), "%r15d");
+  emit("jmp", target);
+  s << ret.str() << ":" << std::endl;
+}
+
+void X86Lowering::directive(const std::string& text)
+{
+  std::istringstream words(text);
+  std::string d, rest;
+  words >> d;
+  std::getline(words, rest);
+  if (d == ".word")
+    s << "\t.long" << rest << std::endl;
+  else if (d == ".align")
+    s << "\t.p2align" << rest << std::endl;
+  else if (d.empty() || d[0] == '#' || d == ".data" || d == ".text" ||
+           d == ".globl" || d == ".ascii" || d == ".byte")
+    s << text << std::endl;
+  else
+    unknown("directive " + d);
+}
+
+void X86Lowering::unknown(const std::string& what)
+{
+  std::cerr << "x86: cannot lower " << what << std::endl;
+  exit(1);
+}
+
+void X86Lowering::lower(const Instr& ins)
+{
+  if (ins.is_label()) {
+    s << ins.label << ":" << std::endl;
+    return;
+  }
+  if (!ins.is_instr()) {
+    directive(ins.text);
+    return;
+  }
+
+  const std::string& op = ins.op;
+  const std::vector<std::string>& a = ins.args;
+  if (op == "lw") {
+    std::string src = address(a[1]), dst = operand(a[0]);
+    if (in_memory(dst)) {
+      emit("movl", src, "%edx");
+      emit("movl", "%edx", dst);
+    } else
+      emit("movl", src, dst);
+  } else if (op == "sw") {
+    std::string src = operand(a[0]);
+    if (in_memory(src)) {
+      emit("movl", src, "%edx");
+      src = "%edx";
+    }
+    emit("movl", src, address(a[1]));
+  } else if (op == "li" || op == "la")
+    emit("movl", "$" + a[1], operand(a[0]));
+  else if (op == "move")
+    move(operand(a[1]), operand(a[0]));
+  else if (op == "addiu" || op == "addi") {
+    std::string dst = operand(a[0]);
+    if (a[0] == a[1] && !in_memory(dst))
+      emit("addl", "$" + a[2], dst);
+    else {
+      emit("movl", operand(a[1]), "%eax");
+      emit("addl", "$" + a[2], "%eax");
+      if (op == "addi")
+        emit("jo", "_cool_overflow");
+      emit("movl", "%eax", dst);
+    }
+  } else if (op == "addu")
+    compute("addl", ins);
+  else if (op == "add")
+    compute("addl", ins, true);
+  else if (op == "sub")
+    compute("subl", ins, true);
+  else if (op == "mul")
+    compute("imull", ins);
+  else if (op == "xori")
+    compute("xorl", ins);
+  else if (op == "sll")
+    compute("shll", ins);
+  else if (op == "div")
+    divide(ins);
+  else if (op == "neg") {
+    emit("movl", operand(a[1]), "%eax");
+    emit("negl", "%eax");
+    emit("jo", "_cool_overflow");
+    emit("movl", "%eax", operand(a[0]));
+  } else if (op == "seq")
+    compare("sete", ins);
+  else if (op == "slt")
+    compare("setl", ins);
+  else if (op == "sle")
+    compare("setle", ins);
+  else if (op == "beqz")
+    branch("je", a[0], "$zero", a[1]);
+  else if (op == "beq")
+    branch("je", a[0], a[1], a[2]);
+  else if (op == "bne")
+    branch("jne", a[0], a[1], a[2]);
+  else if (op == "blt")
+    branch("jl", a[0], a[1], a[2]);
+  else if (op == "ble")
+    branch("jle", a[0], a[1], a[2]);
+  else if (op == "bgt")
+    branch("jg", a[0], a[1], a[2]);
+  else if (op == "b" || op == "j")
+    emit("jmp", a[0]);
+  else if (op == "jal")
+    call(a[0]);
+  else if (op == "jalr" || op == "jr") {
+    std::string r = address("0(" + a[0] + ")");
+    r = "*" + r.substr(2, r.size() - 3);
+    if (op == "jalr")
+      call(r);
+    else
+      emit("jmp", r);
+  } else
+    unknown("instruction " + op);
+}
+
+void lower_x86(const std::string& mips, std::ostream& s)
+{
+  X86Lowering x86(s);
+  s << "# lowered to x86-64; link with x86-runtime.c and x86-runtime.s" << std::endl;
+  for (const Instr& ins : parse_instrs(mips))
+    x86.lower(ins);
+  s << "\t.section\t.note.GNU-stack,\"\",@progbits" << std::endl;
+}
@@ -0,0 +1,31 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+#ifndef X86_H
+#define X86_H
+
+#include <iostream>
+#include <string>
+
+//
+// The x86-64 backend.  The code generator always produces MIPS; with
+// CGEN_TARGET=x86-64 (see cgen_target in cgen.h) the finished program is lowered instruction by
+// instruction to x86-64 (GNU as, AT&T syntax) and linked with
+// x86-runtime.c and x86-runtime.s:
+//
+//     gcc -no-pie -o prog prog.s x86-runtime.c x86-runtime.s
+//
+// Objects keep their MIPS layout, words stay 32 bits wide, and the Cool
+// calling conventions are unchanged.  That works because the program is
+// linked below 4G and the runtime puts the heap and the Cool stack in
+// the low 2G, so every address fits in a word.  The MIPS registers the
+// code generator uses live in x86 registers, except $s5 and $s6, which
+// live in memory (see `cool_regs' in x86-runtime.c).  The native stack
+// belongs to the runtime, which calls C following the System V ABI.
+//
+void lower_x86(const std::string& mips, std::ostream& s);
+
+#endif
@@ -0,0 +1,172 @@
+//
+// Allocation accounting (see alloc.h).
+//
+// Built with ALLOC_ACCOUNTING, the global operator new and delete are
+// replaced by ones that call malloc and free, and charge the size malloc
+// reports for the block.  They may run before any constructor of this
+// file, so everything they touch is initialized statically, and the
+// level is read from the environment by the first of them, or else by
+// the first AllocStats made.
+//
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iomanip>
+#include <new>
+#include "alloc.h"
+
+static AllocStats *first_stats, *last_stats;
+
+std::atomic<AllocStats *> alloc_phase(nullptr);
+thread_local AllocStats *alloc_site;
+
+// the whole program
+static std::atomic<long> total_allocs, total_bytes, total_frees, total_freed;
+static std::atomic<long> live, peak_live;
+
+AllocStats::AllocStats(AllocLevel level, const char *name)
+  : level(level), name(name), allocs(0), bytes(0), frees(0), freed(0), peak(0),
+    next(NULL)
+{
+  // made by static constructors, one thread at a time
+  if (last_stats)
+    last_stats->next = this;
+  else
+    first_stats = this;
+  last_stats = this;
+  alloc_level();
+}
+
+static void report_at_exit()
+{
+  alloc_report(std::cerr);
+}
+
+AllocLevel alloc_level()
+{
+  static AllocLevel level = []() {
+    const char *env = getenv("COOL_ALLOC");
+    if (env == NULL || *env == '\0')
+      return ALLOC_OFF;
+#ifndef ALLOC_ACCOUNTING
+    fprintf(stderr, "COOL_ALLOC: accounting is not built in (make ALLOC=1)\n");
+    return ALLOC_OFF;
+#endif
+    AllocLevel l = strcmp(env, "sites") == 0 ? ALLOC_SITES : ALLOC_PHASES;
+    if (strcmp(env, "phases") != 0 && l != ALLOC_SITES)
+      fprintf(stderr, "COOL_ALLOC: unknown level \"%s\", using phases\n", env);
+    atexit(report_at_exit);
+    return l;
+  }();
+  return level;
+}
+
+static void raise(std::atomic<long>& peak, long value)
+{
+  long p = peak.load(std::memory_order_relaxed);
+  while (value > p && !peak.compare_exchange_weak(p, value, std::memory_order_relaxed))
+    ;
+}
+
+static void charge(AllocStats *s, long n, long now_live)
+{
+  if (s == NULL)
+    return;
+  if (n > 0) {
+    s->allocs.fetch_add(1, std::memory_order_relaxed);
+    s->bytes.fetch_add(n, std::memory_order_relaxed);
+    raise(s->peak, now_live);
+  } else {
+    s->frees.fetch_add(1, std::memory_order_relaxed);
+    s->freed.fetch_add(-n, std::memory_order_relaxed);
+  }
+}
+
+//
+// Charges an allocation (n > 0) or a free (n < 0) of |n| bytes.
+//
+static void account(long n)
+{
+  long now_live = live.fetch_add(n, std::memory_order_relaxed) + n;
+  if (n > 0) {
+    total_allocs.fetch_add(1, std::memory_order_relaxed);
+    total_bytes.fetch_add(n, std::memory_order_relaxed);
+    raise(peak_live, now_live);
+  } else {
+    total_frees.fetch_add(1, std::memory_order_relaxed);
+    total_freed.fetch_add(-n, std::memory_order_relaxed);
+  }
+  charge(alloc_phase.load(std::memory_order_relaxed), n, now_live);
+  charge(alloc_site, n, now_live);
+}
+
+#ifdef ALLOC_ACCOUNTING
+void *operator new(size_t n)
+{
+  void *p = malloc(n == 0 ? 1 : n);
+  if (p == NULL)
+    throw std::bad_alloc();
+  if (alloc_level() != ALLOC_OFF)
+    account(malloc_usable_size(p));
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  if (p == NULL)
+    return;
+  if (alloc_level() != ALLOC_OFF)
+    account(-(long) malloc_usable_size(p));
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  operator delete(p);
+}
+#endif
+
+static void print_row(std::ostream& s, const char *name, long allocs, long bytes,
+                      long frees, long freed, long peak)
+{
+  s << std::left << std::setw(28) << name << std::right << std::setw(11) << allocs
+    << std::setw(14) << bytes << std::setw(11) << frees << std::setw(14)
+    << bytes - freed << std::setw(14);
+  if (peak >= 0)
+    s << peak << std::endl;
+  else
+    s << "-" << std::endl;
+}
+
+static void print_header(std::ostream& s, const char *what)
+{
+  s << std::left << std::setw(28) << what << std::right << std::setw(11) << "allocs"
+    << std::setw(14) << "bytes" << std::setw(11) << "frees" << std::setw(14)
+    << "live" << std::setw(14) << "peak live" << std::endl;
+}
+
+void alloc_report(std::ostream& s)
+{
+  // what was allocated outside any phase
+  long allocs = total_allocs, bytes = total_bytes, frees = total_frees, freed = total_freed;
+  for (int level = ALLOC_PHASES; level <= alloc_level(); level++) {
+    print_header(s, level == ALLOC_PHASES ? "phase" : "site");
+    for (AllocStats *st = first_stats; st; st = st->next) {
+      if (st->level != level || st->allocs + st->frees == 0)
+        continue;
+      print_row(s, st->name, st->allocs, st->bytes, st->frees, st->freed, st->peak);
+      if (level == ALLOC_PHASES) {
+        allocs -= st->allocs;
+        bytes -= st->bytes;
+        frees -= st->frees;
+        freed -= st->freed;
+      }
+    }
+    if (level == ALLOC_PHASES) {
+      print_row(s, "(outside phases)", allocs, bytes, frees, freed, -1);
+      print_row(s, "(total)", total_allocs, total_bytes, total_frees, total_freed, peak_live);
+    }
+    s << std::endl;
+  }
+}
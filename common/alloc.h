@@ -0,0 +1,78 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+//
+// Accounting of the memory the compiler allocates with new, by phase
+// and by call site.
+//
+// Setting COOL_ALLOC=phases charges every allocation and every free to
+// the phase running when it is made, and COOL_ALLOC=sites to the call
+// site inside it as well; the allocations, bytes, frees and live bytes
+// of each are printed on stderr when the program exits, together with
+// the most bytes that were live at once while each was running.  What
+// is still live at exit has leaked, as far as a phase is concerned.
+// Sizes are those malloc gives, which round the requests up.
+//
+// A phase or site is a static AllocStats, charged by the AllocScopes
+// that name it.  There is one phase at a time, entered on the main
+// thread and charged by the threads it starts as well; sites are per
+// thread.
+//
+// Accounting replaces the global operator new and delete, so it is only
+// built in with ALLOC_ACCOUNTING defined (make ALLOC=1).  Then, with
+// COOL_ALLOC unset, a scope costs two stores and new a test of one flag;
+// without it a scope costs nothing, and COOL_ALLOC only gets a warning.
+//
+#include <atomic>
+#include <iostream>
+
+enum AllocLevel { ALLOC_OFF, ALLOC_PHASES, ALLOC_SITES };
+
+// what COOL_ALLOC asks for
+AllocLevel alloc_level();
+
+struct AllocStats {
+  AllocStats(AllocLevel level, const char *name);
+
+  const AllocLevel level;
+  const char *const name;
+  std::atomic<long> allocs, bytes, frees, freed;
+  std::atomic<long> peak;    // of the live bytes of the whole program
+  AllocStats *next;          // in the order they were made
+};
+
+extern std::atomic<AllocStats *> alloc_phase;
+extern thread_local AllocStats *alloc_site;
+
+//
+// Charges what the calling thread allocates to stats for as long as it
+// is in scope.
+//
+#ifdef ALLOC_ACCOUNTING
+class AllocScope {
+public:
+  AllocScope(AllocStats& stats)
+    : stats(&stats), outer(stats.level == ALLOC_PHASES ? alloc_phase.load() : alloc_site)
+  { enter(&stats); }
+  ~AllocScope() { enter(outer); }
+
+private:
+  void enter(AllocStats *s)
+  {
+    if (stats->level == ALLOC_PHASES)
+      alloc_phase = s;
+    else
+      alloc_site = s;
+  }
+  AllocStats *stats;
+  AllocStats *outer;
+};
+#else
+class AllocScope {
+public:
+  AllocScope(AllocStats&) { }
+};
+#endif
+
+void alloc_report(std::ostream& s);
+
+#endif
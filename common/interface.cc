@@ -0,0 +1,120 @@
+//
+// Reading interfaces of separately compiled modules (see interface.h).
+// The code generator writes them.
+//
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "interface.h"
+
+const char *module_interface()
+{
+  const char *file = getenv("COOL_MODULE");
+  return file != NULL && *file != '\0' ? file : NULL;
+}
+
+std::string module_name()
+{
+  std::string name = module_interface();
+  size_t slash = name.rfind('/');
+  if (slash != std::string::npos)
+    name.erase(0, slash + 1);
+  size_t dot = name.rfind('.');
+  if (dot != std::string::npos && dot > 0)
+    name.erase(dot);
+  for (auto& c : name)
+    if (!isalnum((unsigned char) c))
+      c = '_';
+  return name;
+}
+
+static Symbol id(const std::string& s)
+{
+  return idtable.add_string((char *) s.c_str());
+}
+
+static void malformed(const std::string& file, int line)
+{
+  std::cerr << file << ":" << line << ": malformed interface line" << std::endl;
+  exit(1);
+}
+
+static Interface read_interface(const std::string& file)
+{
+  std::ifstream in(file.c_str());
+  if (!in) {
+    std::cerr << "COOL_INTERFACES: cannot open " << file << std::endl;
+    exit(1);
+  }
+  Interface ifc;
+  ifc.file = file;
+  Symbol filename = stringtable.add_string((char *) file.c_str());
+  node_lineno = 0;
+
+  // the class being read
+  Symbol name = NULL, parent = NULL;
+  Features features = NULL;
+  std::vector<std::pair<Symbol, Symbol> > slots;
+  auto finish = [&]() {
+    if (name != NULL)
+      ifc.classes.push_back(InterfaceClass{class_(name, parent, features, filename), slots});
+    name = NULL;
+    slots.clear();
+  };
+
+  std::string line;
+  for (int lineno = 1; std::getline(in, line); lineno++) {
+    std::istringstream words(line);
+    std::string kind, a, b;
+    if (!(words >> kind))
+      continue;
+    if (kind == "map") {
+      std::getline(words >> std::ws, a);
+      ifc.maps.push_back(a);
+      continue;
+    }
+    if (!(words >> a >> b) || (kind != "class" && name == NULL))
+      malformed(file, lineno);
+    if (kind == "class") {
+      finish();
+      name = id(a);
+      parent = id(b);
+      features = nil_Features();
+    } else if (kind == "attr") {
+      features = append_Features(features, single_Features(attr(id(a), id(b), no_expr())));
+    } else if (kind == "method") {
+      Formals formals = nil_Formals();
+      std::string f, t;
+      while (words >> f) {
+        if (!(words >> t))
+          malformed(file, lineno);
+        formals = append_Formals(formals, single_Formals(formal(id(f), id(t))));
+      }
+      features = append_Features(features,
+                                 single_Features(method(id(a), formals, id(b), no_expr())));
+    } else if (kind == "slot") {
+      slots.push_back(std::make_pair(id(a), id(b)));
+    } else
+      malformed(file, lineno);
+  }
+  finish();
+  return ifc;
+}
+
+std::vector<Interface>& interfaces()
+{
+  static std::vector<Interface> *all = NULL;
+  if (all == NULL) {
+    all = new std::vector<Interface>();
+    const char *env = getenv("COOL_INTERFACES");
+    std::istringstream files(env != NULL ? env : "");
+    std::string file;
+    while (std::getline(files, file, ':'))
+      if (!file.empty())
+        all->push_back(read_interface(file));
+  }
+  return *all;
+}
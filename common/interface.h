@@ -0,0 +1,53 @@
+#ifndef INTERFACE_H
+#define INTERFACE_H
+//
+// Interfaces of separately compiled Cool modules.
+//
+// A module is a set of library classes compiled once.  Compiled with
+// COOL_MODULE=file.ci (and no Main), the classes are checked as any
+// program is, and the code generator writes their code and constants
+// as the module's .s and describes the classes in the interface file.
+// A program, or another module, compiled with COOL_INTERFACES=a.ci:b.ci
+// (a module after those it uses) is checked and coded against the
+// classes the interfaces describe, without their sources.  The code of
+// the modules goes before the program's when they are put together for
+// spim:  cat a.s b.s prog.s > all.s
+//
+// An interface is a text file of lines of words:
+//
+//     class <name> <parent>
+//     attr <name> <type>
+//     method <name> <return type> [<formal> <type>]...
+//     slot <class> <method>      the dispatch table, in slot order
+//     map <entry>                a stack map entry of the module's code
+//
+// The attr, method and slot lines of a class follow its class line,
+// and a class comes after its parent.
+//
+#include <string>
+#include <vector>
+#include "cool-tree.h"
+
+struct InterfaceClass {
+  Class_ cls;        // the bodies and initializers are no_expr
+  // the class defining each method of the dispatch table
+  std::vector<std::pair<Symbol, Symbol> > slots;
+};
+
+struct Interface {
+  std::string file;
+  std::vector<InterfaceClass> classes;
+  std::vector<std::string> maps;
+};
+
+// the interface to write when compiling a module, or NULL
+const char *module_interface();
+
+// a name for the labels of the module's code, made of the interface's
+std::string module_name();
+
+// the interfaces COOL_INTERFACES names, read the first time; one that
+// cannot be read ends the program
+std::vector<Interface>& interfaces();
+
+#endif
@@ -0,0 +1,264 @@
+//
+// Performance counters (see perf.h).
+//
+// Each event has a counter of its own rather than a group, so that the
+// ones the machine has still count when another is missing.  The kernel
+// multiplexes them when there are more than registers, so every value is
+// scaled by the fraction of the time its counter was running.
+//
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "perf.h"
+
+const char *perf_event_names[PERF_EVENTS] = {
+  "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+static const struct { uint32_t type; uint64_t config; } events[PERF_EVENTS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+PerfCounts::PerfCounts() : seconds(0)
+{
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    value[e] = 0;
+    valid[e] = false;
+  }
+}
+
+PerfCounts PerfCounts::operator-(const PerfCounts& other) const
+{
+  PerfCounts d;
+  d.seconds = seconds - other.seconds;
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    d.valid[e] = valid[e] && other.valid[e];
+    d.value[e] = d.valid[e] && value[e] > other.value[e] ? value[e] - other.value[e] : 0;
+  }
+  return d;
+}
+
+PerfCounts& PerfCounts::operator+=(const PerfCounts& other)
+{
+  seconds += other.seconds;
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    valid[e] = valid[e] || other.valid[e];
+    value[e] += other.value[e];
+  }
+  return *this;
+}
+
+PerfCounters::PerfCounters(pid_t pid, bool on_exec) : err(0)
+{
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[e].type;
+    attr.config = events[e].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    if (on_exec) {
+      attr.disabled = 1;
+      attr.enable_on_exec = 1;
+    }
+    fd[e] = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd[e] < 0 && err == 0)
+      err = errno;
+  }
+}
+
+PerfCounters::~PerfCounters()
+{
+  for (int e = 0; e < PERF_EVENTS; e++)
+    if (fd[e] >= 0)
+      close(fd[e]);
+}
+
+bool PerfCounters::available() const
+{
+  for (int e = 0; e < PERF_EVENTS; e++)
+    if (fd[e] >= 0)
+      return true;
+  return false;
+}
+
+PerfCounts PerfCounters::read() const
+{
+  PerfCounts c;
+  c.seconds = now();
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    uint64_t buf[3];   // value, time enabled, time running
+    if (fd[e] < 0 || ::read(fd[e], buf, sizeof(buf)) != sizeof(buf))
+      continue;
+    c.valid[e] = true;
+    c.value[e] = buf[2] == 0 ? 0 : buf[2] == buf[1] ? buf[0]
+                 : (uint64_t) ((double) buf[0] * buf[1] / buf[2]);
+  }
+  return c;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Regions and the report
+//
+///////////////////////////////////////////////////////////////////////
+
+struct PerfTotal {
+  long calls = 0;
+  PerfCounts counts;
+};
+
+// the phases in the order they first ran, the classes by name
+static std::mutex report_lock;
+static std::vector<std::pair<std::string, PerfTotal>> phases;
+static std::map<std::string, PerfTotal> classes;
+static int open_error;
+
+static void report_at_exit()
+{
+  perf_report(std::cerr, 10);
+}
+
+PerfLevel perf_level()
+{
+  static PerfLevel level = []() {
+    const char *env = getenv("COOL_PERF");
+    if (env == NULL || *env == '\0')
+      return PERF_OFF;
+    PerfLevel l = strcmp(env, "classes") == 0 ? PERF_CLASSES : PERF_PHASES;
+    if (strcmp(env, "phases") != 0 && l != PERF_CLASSES)
+      std::cerr << "COOL_PERF: unknown level \"" << env << "\", using phases" << std::endl;
+    atexit(report_at_exit);
+    return l;
+  }();
+  return level;
+}
+
+//
+// Every thread opens its counters the first time it enters a region.
+//
+static PerfCounters& thread_counters()
+{
+  static thread_local std::unique_ptr<PerfCounters> counters;
+  if (!counters) {
+    counters.reset(new PerfCounters());
+    if (counters->error() != 0) {
+      std::lock_guard<std::mutex> hold(report_lock);
+      open_error = counters->error();
+    }
+  }
+  return *counters;
+}
+
+PerfRegion::PerfRegion(PerfLevel level, const std::string& name)
+  : on(perf_level() >= level), level(level), name(name)
+{
+  if (on)
+    start = thread_counters().read();
+}
+
+PerfRegion::~PerfRegion()
+{
+  if (!on)
+    return;
+  PerfCounts d = thread_counters().read() - start;
+  std::lock_guard<std::mutex> hold(report_lock);
+  PerfTotal *t;
+  if (level == PERF_CLASSES)
+    t = &classes[name];
+  else {
+    auto it = std::find_if(phases.begin(), phases.end(),
+                           [&](const std::pair<std::string, PerfTotal>& p)
+                           { return p.first == name; });
+    if (it == phases.end()) {
+      phases.push_back(std::make_pair(name, PerfTotal()));
+      it = phases.end() - 1;
+    }
+    t = &it->second;
+  }
+  t->calls++;
+  t->counts += d;
+}
+
+static void print_row(std::ostream& s, const std::string& name, const PerfTotal& t)
+{
+  const PerfCounts& c = t.counts;
+  s << std::left << std::setw(28) << name << std::right << std::setw(7) << t.calls
+    << std::fixed << std::setprecision(3) << std::setw(11) << c.seconds * 1e3;
+  for (int e = 0; e < PERF_EVENTS; e++)
+    if (c.valid[e])
+      s << std::setw(15) << c.value[e];
+    else
+      s << std::setw(15) << "n/a";
+  if (c.valid[PERF_CYCLES] && c.valid[PERF_INSTRUCTIONS] && c.value[PERF_CYCLES] > 0)
+    s << std::setprecision(2) << std::setw(7)
+      << (double) c.value[PERF_INSTRUCTIONS] / c.value[PERF_CYCLES];
+  else
+    s << std::setw(7) << "n/a";
+  s << std::endl;
+}
+
+static void print_header(std::ostream& s, const char *what)
+{
+  s << std::left << std::setw(28) << what << std::right << std::setw(7) << "calls"
+    << std::setw(11) << "msec";
+  for (int e = 0; e < PERF_EVENTS; e++)
+    s << std::setw(15) << perf_event_names[e];
+  s << std::setw(7) << "IPC" << std::endl;
+}
+
+void perf_report(std::ostream& s, int top_classes)
+{
+  std::lock_guard<std::mutex> hold(report_lock);
+  if (phases.empty() && classes.empty())
+    return;
+  if (open_error != 0)
+    s << "perf: some counters are unavailable (" << strerror(open_error) << ")" << std::endl;
+
+  print_header(s, "phase");
+  for (auto& p : phases)
+    print_row(s, p.first, p.second);
+
+  if (classes.empty())
+    return;
+  // hottest by cycles, or by time when there are no cycles to go by
+  std::vector<std::pair<std::string, PerfTotal>> hot(classes.begin(), classes.end());
+  std::sort(hot.begin(), hot.end(),
+            [](const std::pair<std::string, PerfTotal>& a,
+               const std::pair<std::string, PerfTotal>& b) {
+              const PerfCounts& x = a.second.counts;
+              const PerfCounts& y = b.second.counts;
+              if (x.valid[PERF_CYCLES] && y.valid[PERF_CYCLES])
+                return x.value[PERF_CYCLES] > y.value[PERF_CYCLES];
+              return x.seconds > y.seconds;
+            });
+  s << std::endl;
+  print_header(s, "class");
+  for (int i = 0; i < (int) hot.size() && i < top_classes; i++)
+    print_row(s, hot[i].first, hot[i].second);
+}
@@ -0,0 +1,82 @@
+#ifndef PERF_H
+#define PERF_H
+//
+// Hardware performance counters around regions of the compiler, read
+// with perf_event_open(2).
+//
+// Setting COOL_PERF=phases counts each phase of the compiler, and
+// COOL_PERF=classes each class type checked or coded as well; the counts
+// are printed on stderr when the program exits, the classes hottest
+// first.  A region counts the thread it runs on.  A counter the kernel
+// or the machine does not provide (in a virtual machine, or with
+// perf_event_paranoid set) is reported as n/a, and the wall time is
+// reported regardless.
+//
+#include <stdint.h>
+#include <sys/types.h>
+#include <iostream>
+#include <string>
+
+enum PerfEvent {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_EVENTS
+};
+
+extern const char *perf_event_names[PERF_EVENTS];
+
+struct PerfCounts {
+  double seconds;
+  uint64_t value[PERF_EVENTS];
+  bool valid[PERF_EVENTS];
+
+  PerfCounts();
+  PerfCounts operator-(const PerfCounts& other) const;
+  PerfCounts& operator+=(const PerfCounts& other);
+};
+
+//
+// The counters of the calling thread, or of a child process that has
+// not yet called exec (they start counting at the exec).
+//
+class PerfCounters {
+public:
+  PerfCounters(pid_t pid = 0, bool on_exec = false);
+  ~PerfCounters();
+  bool available() const;
+  // why the first counter that could not be opened was not
+  int error() const { return err; }
+  PerfCounts read() const;
+
+private:
+  int fd[PERF_EVENTS];
+  int err;
+};
+
+enum PerfLevel { PERF_OFF, PERF_PHASES, PERF_CLASSES };
+
+// what COOL_PERF asks for
+PerfLevel perf_level();
+
+//
+// Counts the calling thread for as long as it is in scope, under name
+// in the report of phases or of classes.
+//
+class PerfRegion {
+public:
+  PerfRegion(PerfLevel level, const std::string& name);
+  ~PerfRegion();
+
+private:
+  bool on;
+  PerfLevel level;
+  std::string name;
+  PerfCounts start;
+};
+
+void perf_report(std::ostream& s, int top_classes);
+
+#endif
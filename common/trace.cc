@@ -0,0 +1,108 @@
+//
+// Trace spans (see trace.h).
+//
+// Every process appends its spans to the file under an exclusive lock,
+// and the first to find the file empty opens the array, so the phases
+// of a compilation may exit in any order.  The timestamps come from the
+// monotonic clock, which the processes of one machine share.
+//
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <mutex>
+#include <vector>
+#include "trace.h"
+
+struct TraceEvent {
+  const char *cat;     // always a literal
+  std::string name;
+  double start, end;
+  long tid;
+};
+
+static const char *trace_file;
+static std::mutex trace_lock;
+static std::vector<TraceEvent> events;
+
+static void write_at_exit();
+
+static bool trace_init()
+{
+  trace_file = getenv("COOL_TRACE");
+  if (trace_file == NULL || *trace_file == '\0')
+    return false;
+  atexit(write_at_exit);
+  return true;
+}
+
+bool trace_on = trace_init();
+
+double trace_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+void trace_event(const char *cat, const char *name, double start, double end)
+{
+  static thread_local long tid = syscall(SYS_gettid);
+  std::lock_guard<std::mutex> hold(trace_lock);
+  events.push_back(TraceEvent{cat, name, start, end, tid});
+}
+
+void TraceFiles::change(const char *file)
+{
+  double t = trace_now();
+  if (!name.empty())
+    trace_event(cat, name.c_str(), start, t);
+  name = file ? file : "";
+  start = t;
+}
+
+static std::string quoted(const std::string& s)
+{
+  std::string q = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      q += '\\';
+    if ((unsigned char) c < ' ') {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      q += esc;
+    } else
+      q += c;
+  }
+  return q + "\"";
+}
+
+static void write_at_exit()
+{
+  std::lock_guard<std::mutex> hold(trace_lock);
+  FILE *f = fopen(trace_file, "a");
+  if (f == NULL) {
+    fprintf(stderr, "COOL_TRACE: cannot open %s: %s\n", trace_file, strerror(errno));
+    return;
+  }
+  flock(fileno(f), LOCK_EX);
+  struct stat st;
+  if (fstat(fileno(f), &st) == 0 && st.st_size == 0)
+    fputs("[\n", f);
+
+  long pid = getpid();
+  fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %ld, "
+          "\"args\": {\"name\": %s}},\n", pid, quoted(program_invocation_short_name).c_str());
+  for (const TraceEvent& e : events)
+    fprintf(f, "{\"name\": %s, \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+            "\"dur\": %.3f, \"pid\": %ld, \"tid\": %ld},\n",
+            quoted(e.name).c_str(), e.cat, e.start, e.end - e.start, pid, e.tid);
+  fflush(f);
+  flock(fileno(f), LOCK_UN);
+  fclose(f);
+}
@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+//
+// Spans of time in the Chrome trace-event format, for chrome://tracing
+// or ui.perfetto.dev.
+//
+// Setting COOL_TRACE=file (mycoolc -trace=file does) records a span for
+// each file lexed and parsed, each stage of semantic analysis and code
+// generation and each class checked or coded.  The spans of a process
+// are kept in memory and appended to the file when it exits, so the
+// phases of a compilation, one process each, share one trace; the file
+// is a JSON array that is left open, as the format allows.  When
+// COOL_TRACE is not set a span costs a test of one flag.
+//
+#include <string>
+
+extern bool trace_on;
+
+inline bool tracing() { return trace_on; }
+
+// microseconds on a clock all processes share
+double trace_now();
+
+// records the span [start, end) of the calling thread
+void trace_event(const char *cat, const char *name, double start, double end);
+
+//
+// A span for as long as it is in scope.  The strings must outlive it.
+//
+class TraceSpan {
+public:
+  TraceSpan(const char *cat, const char *name)
+    : cat(tracing() ? cat : NULL), name(name), start(this->cat ? trace_now() : 0) {}
+  ~TraceSpan() { if (cat) trace_event(cat, name, start, trace_now()); }
+
+private:
+  const char *cat;
+  const char *name;
+  double start;
+};
+
+//
+// A span for each file a phase reads in turn, for scanners that see
+// the file name change between tokens: at() ends the span of the file
+// before when the name changes and begins one for the new, and end()
+// ends the last.
+//
+class TraceFiles {
+public:
+  TraceFiles(const char *cat) : cat(cat), start(0) {}
+  void at(const char *file) { if (tracing() && file && name != file) change(file); }
+  void end() { if (tracing()) change(NULL); }
+
+private:
+  void change(const char *file);
+  const char *cat;
+  std::string name;
+  double start;
+};
+
+#endif